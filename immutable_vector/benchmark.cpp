@@ -0,0 +1,629 @@
+#include "main.cpp"
+#include "hamt_map.h"
+#include "vector_store.h"
+#include "../map/hash_map.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <ranges>
+#include <span>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace benchmarks {
+
+constexpr size_t kElements = 1'000'000;
+
+// keeps results of timed lookups from being optimized away
+volatile size_t sink;
+
+template <typename Func>
+double measure_ns_per_op(size_t ops, Func func) {
+    auto start = std::chrono::steady_clock::now();
+    func();
+    auto finish = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(finish - start).count() / ops;
+}
+
+void report(const std::string& name, const std::string& order, double ns_per_op) {
+    std::cout << name << " [" << order << "]: " << ns_per_op << " ns/op\n";
+}
+
+std::vector<size_t> make_indices(const std::string& order) {
+    std::vector<size_t> indices(kElements);
+    std::iota(indices.begin(), indices.end(), 0);
+    if (order == "random") {
+        std::shuffle(indices.begin(), indices.end(), std::mt19937(42));
+    }
+    return indices;
+}
+
+/* random access by index, persistent vector versus std::vector */
+void bench_get() {
+    std::vector<int> values(kElements);
+    std::iota(values.begin(), values.end(), 0);
+    Vector<int> vector(values.begin(), values.end());
+
+    for (const std::string order : {"sequential", "random"}) {
+        std::vector<size_t> indices = make_indices(order);
+        size_t checksum = 0;
+
+        report("Vector::Get", order, measure_ns_per_op(kElements, [&] {
+            for (size_t index : indices) {
+                checksum += vector.Get(index);
+            }
+        }));
+
+        report("std::vector::operator[]", order, measure_ns_per_op(kElements, [&] {
+            for (size_t index : indices) {
+                checksum += values[index];
+            }
+        }));
+        sink = checksum;
+    }
+}
+
+/* summing every element: Get per index, the iterator, leaf chunks, std::vector */
+void bench_scan() {
+    std::vector<int> values(kElements);
+    std::iota(values.begin(), values.end(), 0);
+    Vector<int> vector(values.begin(), values.end());
+    size_t checksum = 0;
+
+    report("Vector::Get", "scan", measure_ns_per_op(kElements, [&] {
+        for (size_t i = 0; i < vector.Size(); ++i) {
+            checksum += vector.Get(i);
+        }
+    }));
+    report("Vector::Iterator", "scan", measure_ns_per_op(kElements, [&] {
+        for (int value : vector) {
+            checksum += value;
+        }
+    }));
+    report("Vector::ForEachChunk", "scan", measure_ns_per_op(kElements, [&] {
+        vector.ForEachChunk([&checksum](std::span<const int> chunk) {
+            checksum += std::accumulate(chunk.begin(), chunk.end(), size_t{0});
+        });
+    }));
+    report("std::vector", "scan", measure_ns_per_op(kElements, [&] {
+        checksum += std::accumulate(values.begin(), values.end(), size_t{0});
+    }));
+    sink = checksum;
+}
+
+/* fill construction, which shares one full subtree per level, versus the
+ * same values from iterators and versus std::vector, then the first updates */
+void bench_fill() {
+    for (size_t size : {kElements, 100 * kElements}) {
+        std::string order = std::to_string(size) + " elements";
+        const size_t kOps = 1'000;
+        report("Vector(count, value)", order, measure_ns_per_op(kOps, [&] {
+            for (size_t i = 0; i < kOps; ++i) {
+                sink = Vector<int>(size, 0).Size();
+            }
+        }));
+        report("std::vector(count, value)", order, measure_ns_per_op(1, [&] {
+            sink = std::vector<int>(size, 0).size();
+        }));
+
+        Vector<int> zeros(size, 0);
+        std::vector<size_t> indices(kOps);
+        std::mt19937 rng(23);
+        for (auto& index : indices) {
+            index = rng() % size;
+        }
+        report("Vector::Set on a filled vector", order, measure_ns_per_op(kOps, [&] {
+            for (size_t index : indices) {
+                sink = zeros.Set(index, 1).Size();
+            }
+        }));
+    }
+
+    std::vector<int> values(kElements, 0);
+    report("Vector(first, last)", std::to_string(kElements) + " elements",
+           measure_ns_per_op(1, [&] {
+               sink = Vector<int>(values.begin(), values.end()).Size();
+           }));
+}
+
+/* persistent Set on a small and a large vector, every call path-copies */
+void bench_update() {
+    for (size_t size : {size_t{10}, kElements}) {
+        std::string order = std::to_string(size) + " elements";
+        std::vector<int> values(size);
+        std::iota(values.begin(), values.end(), 0);
+        Vector<int> vector(values.begin(), values.end());
+        const size_t kOps = 100'000;
+        size_t checksum = 0;
+
+        report("Vector::Set", order, measure_ns_per_op(kOps, [&] {
+            for (size_t i = 0; i < kOps; ++i) {
+                checksum += vector.Set(i % size, 1).Size();
+            }
+        }));
+        sink = checksum;
+    }
+}
+
+/* growing a vector to kElements one PushBack at a time and popping it empty,
+ * each call keeps the previous version alive until the next one replaces it */
+void bench_append() {
+    std::optional<Vector<int>> vector(std::in_place);
+    report("Vector::PushBack", "chain", measure_ns_per_op(kElements, [&] {
+        for (size_t i = 0; i < kElements; ++i) {
+            vector.emplace(vector->PushBack(static_cast<int>(i)));
+        }
+    }));
+    report("Vector::PopBack", "chain", measure_ns_per_op(kElements, [&] {
+        for (size_t i = 0; i < kElements; ++i) {
+            vector.emplace(vector->PopBack());
+        }
+    }));
+    sink = vector->Size();
+}
+
+/* the same batches through a transient editor, frozen once at the end */
+void bench_transient() {
+    Vector<int> empty;
+    report("TransientVector::PushBack", "batch", measure_ns_per_op(kElements, [&] {
+        auto editor = empty.Transient();
+        for (size_t i = 0; i < kElements; ++i) {
+            editor.PushBack(static_cast<int>(i));
+        }
+        sink = editor.Persistent().Size();
+    }));
+
+    std::vector<int> values(kElements);
+    std::iota(values.begin(), values.end(), 0);
+    Vector<int> vector(values.begin(), values.end());
+    std::vector<size_t> indices = make_indices("random");
+    const size_t kBatch = 100'000;
+    report("TransientVector::Set", "random batch", measure_ns_per_op(kBatch, [&] {
+        auto editor = vector.Transient();
+        for (size_t i = 0; i < kBatch; ++i) {
+            editor.Set(indices[i], 1);
+        }
+        sink = editor.Persistent().Size();
+    }));
+
+    std::optional<Vector<int>> chain(std::in_place, vector);
+    report("Vector::Set", "random chain", measure_ns_per_op(kBatch, [&] {
+        for (size_t i = 0; i < kBatch; ++i) {
+            chain.emplace(chain->Set(indices[i], 1));
+        }
+    }));
+}
+
+/* structural edits on 1M elements: concatenation, slicing, insertion and
+ * erasure in the middle, versus rebuilding the result from iterators */
+void bench_rrb() {
+    std::vector<int> values(kElements);
+    std::iota(values.begin(), values.end(), 0);
+    Vector<int> vector(values.begin(), values.end());
+    const size_t kOps = 1'000;
+    std::mt19937 rng(19);
+    std::vector<size_t> positions(kOps);
+    for (auto& position : positions) {
+        position = rng() % kElements;
+    }
+    size_t checksum = 0;
+
+    report("Vector::Concat", "1M + 1M", measure_ns_per_op(kOps, [&] {
+        for (size_t i = 0; i < kOps; ++i) {
+            checksum += Vector<int>::Concat(vector, vector).Size();
+        }
+    }));
+    report("Vector::Slice", "random halves", measure_ns_per_op(kOps, [&] {
+        for (size_t position : positions) {
+            checksum += vector.Slice(position / 2, position / 2 + kElements / 2).Size();
+        }
+    }));
+    report("Vector::Insert", "random position", measure_ns_per_op(kOps, [&] {
+        for (size_t position : positions) {
+            checksum += vector.Insert(position, 1).Size();
+        }
+    }));
+    report("Vector::Erase", "random position", measure_ns_per_op(kOps, [&] {
+        for (size_t position : positions) {
+            checksum += vector.Erase(position).Size();
+        }
+    }));
+
+    const size_t kRebuilds = 10;
+    report("Vector rebuilt by iterators", "random halves", measure_ns_per_op(kRebuilds, [&] {
+        for (size_t i = 0; i < kRebuilds; ++i) {
+            size_t from = positions[i] / 2;
+            Vector<int> slice(vector.begin() + from, vector.begin() + from + kElements / 2);
+            checksum += slice.Size();
+        }
+    }));
+
+    // reads after many small concatenations, where most nodes are relaxed
+    std::optional<Vector<int>> pieces(std::in_place);
+    for (size_t i = 0; i < kElements / 50; ++i) {
+        Vector<int> piece(values.begin(), values.begin() + 1 + rng() % 99);
+        pieces.emplace(Vector<int>::Concat(*pieces, piece));
+    }
+    std::vector<size_t> indices(kElements);
+    for (auto& index : indices) {
+        index = rng() % pieces->Size();
+    }
+    report("Vector::Get", "random, relaxed", measure_ns_per_op(kElements, [&] {
+        for (size_t index : indices) {
+            checksum += pieces->Get(index);
+        }
+    }));
+    sink = checksum;
+}
+
+/* k random updates on 1M elements in one SetMany call, versus k chained Set
+ * calls and a transient editor; then finding those k changes again with
+ * Diff, versus comparing every value */
+void bench_batch() {
+    std::vector<int> values(kElements);
+    std::iota(values.begin(), values.end(), 0);
+    Vector<int> vector(values.begin(), values.end());
+    std::mt19937 rng(29);
+    size_t checksum = 0;
+
+    for (size_t batch : {size_t{10}, size_t{1'000}, size_t{100'000}}) {
+        std::string order = std::to_string(batch) + " updates";
+        std::vector<std::pair<size_t, int>> updates(batch);
+        for (auto& update : updates) {
+            update = {rng() % kElements, -1};
+        }
+        const size_t kRounds = std::max<size_t>(1, 10'000 / batch);
+
+        report("Vector::SetMany", order, measure_ns_per_op(kRounds * batch, [&] {
+            for (size_t i = 0; i < kRounds; ++i) {
+                checksum += vector.SetMany(updates).Size();
+            }
+        }));
+        report("Vector::Set chain", order, measure_ns_per_op(kRounds * batch, [&] {
+            for (size_t i = 0; i < kRounds; ++i) {
+                std::optional<Vector<int>> chain(std::in_place, vector);
+                for (const auto& update : updates) {
+                    chain.emplace(chain->Set(update.first, update.second));
+                }
+                checksum += chain->Size();
+            }
+        }));
+        report("TransientVector::Set", order, measure_ns_per_op(kRounds * batch, [&] {
+            for (size_t i = 0; i < kRounds; ++i) {
+                auto editor = vector.Transient();
+                for (const auto& update : updates) {
+                    editor.Set(update.first, update.second);
+                }
+                checksum += editor.Persistent().Size();
+            }
+        }));
+
+        Vector<int> changed = vector.SetMany(updates);
+        report("Vector::Diff", order, measure_ns_per_op(kRounds, [&] {
+            for (size_t i = 0; i < kRounds; ++i) {
+                Vector<int>::Diff(vector, changed, [&](size_t index, const int*, const int*) {
+                    checksum += index;
+                });
+            }
+        }));
+        report("iterator compare", order, measure_ns_per_op(1, [&] {
+            auto it = changed.begin();
+            for (int value : vector) {
+                checksum += value != *it++;
+            }
+        }));
+    }
+    sink = checksum;
+}
+
+/* opening a saved version from the store and reading it in place, versus
+ * rebuilding it in memory; the file is in the page cache, so this is a
+ * process restart, not a cold disk. Then saving a version 100 updates on,
+ * and compacting 100 such versions down to the last */
+void bench_store() {
+    std::string path = "/tmp/iv_bench_store";
+    for (size_t size : {kElements, 10 * kElements}) {
+        std::string order = std::to_string(size) + " elements";
+        std::remove(path.c_str());
+        std::remove((path + ".versions").c_str());
+        std::vector<int> values(size);
+        std::iota(values.begin(), values.end(), 0);
+        std::optional<Vector<int>> vector(std::in_place, values.begin(), values.end());
+        size_t checksum = 0;
+
+        {
+            VectorStore<int> store(path);
+            report("VectorStore::Save", order + ", per element", measure_ns_per_op(size, [&] {
+                checksum += store.Save(*vector);
+            }));
+        }
+
+        const size_t kOpens = 100;
+        report("VectorStore open + Get", order, measure_ns_per_op(kOpens, [&] {
+            for (size_t i = 0; i < kOpens; ++i) {
+                VectorStore<int> store(path);
+                checksum += store.Version(store.Versions() - 1).Get(size / 2);
+            }
+        }));
+        report("Vector rebuilt from values", order, measure_ns_per_op(1, [&] {
+            Vector<int> rebuilt(values.begin(), values.end());
+            checksum += rebuilt.Get(size / 2);
+        }));
+
+        VectorStore<int> store(path);
+        report("VectorStore::Load", order, measure_ns_per_op(1, [&] {
+            vector.emplace(store.Load(0));
+        }));
+
+        const size_t kGets = 1'000'000;
+        std::mt19937 rng(31);
+        std::vector<size_t> indices(kGets);
+        for (auto& index : indices) {
+            index = rng() % size;
+        }
+        auto view = store.Version(0);
+        report("VectorStore::View::Get", order + ", random", measure_ns_per_op(kGets, [&] {
+            for (size_t index : indices) {
+                checksum += view.Get(index);
+            }
+        }));
+        report("Vector::Get", order + ", random", measure_ns_per_op(kGets, [&] {
+            for (size_t index : indices) {
+                checksum += vector->Get(index);
+            }
+        }));
+
+        const size_t kSaves = 100;
+        const size_t kUpdates = 100;
+        report("VectorStore::Save", order + ", 100 updates on", measure_ns_per_op(kSaves, [&] {
+            for (size_t i = 0; i < kSaves; ++i) {
+                auto editor = vector->Transient();
+                for (size_t j = 0; j < kUpdates; ++j) {
+                    editor.Set(rng() % size, static_cast<int>(j));
+                }
+                vector.emplace(editor.Persistent());
+                checksum += store.Save(*vector);
+            }
+        }));
+        size_t last = store.Versions() - 1;
+        report("VectorStore::Compact", order + ", 101 versions to 1", measure_ns_per_op(1, [&] {
+            store.Compact(std::span<const size_t>(&last, 1));
+        }));
+        sink = checksum;
+    }
+    std::remove(path.c_str());
+    std::remove((path + ".versions").c_str());
+}
+
+/* persistent hash map on 1M int keys: lookups, one-call updates, a batch
+ * through the transient and iteration, versus std::unordered_map; then a
+ * snapshot, O(1) for HamtMap and a full copy for HashMap */
+void bench_hamt() {
+    std::vector<int> keys(kElements);
+    std::iota(keys.begin(), keys.end(), 0);
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(37));
+    size_t checksum = 0;
+
+    std::optional<HamtMap<int, int>> map(std::in_place);
+    report("TransientHamtMap::Set", "batch", measure_ns_per_op(kElements, [&] {
+        auto editor = map->Transient();
+        for (int key : keys) {
+            editor.Set(key, key);
+        }
+        map.emplace(editor.Persistent());
+    }));
+    std::unordered_map<int, int> standard;
+    report("std::unordered_map::emplace", "batch", measure_ns_per_op(kElements, [&] {
+        for (int key : keys) {
+            standard.emplace(key, key);
+        }
+    }));
+
+    report("HamtMap::Find", "random", measure_ns_per_op(kElements, [&] {
+        for (int key : keys) {
+            checksum += *map->Find(key);
+        }
+    }));
+    report("std::unordered_map::find", "random", measure_ns_per_op(kElements, [&] {
+        for (int key : keys) {
+            checksum += standard.find(key)->second;
+        }
+    }));
+
+    const size_t kUpdates = 100'000;
+    report("HamtMap::Set", "random chain", measure_ns_per_op(kUpdates, [&] {
+        for (size_t i = 0; i < kUpdates; ++i) {
+            map.emplace(map->Set(keys[i], -1));
+        }
+    }));
+    report("HamtMap::Erase", "random chain", measure_ns_per_op(kUpdates, [&] {
+        for (size_t i = 0; i < kUpdates; ++i) {
+            map.emplace(map->Erase(keys[i]));
+        }
+    }));
+
+    report("HamtMap iteration", "all", measure_ns_per_op(map->Size(), [&] {
+        for (const auto& entry : *map) {
+            checksum += entry.second;
+        }
+    }));
+    report("std::unordered_map iteration", "all", measure_ns_per_op(standard.size(), [&] {
+        for (const auto& entry : standard) {
+            checksum += entry.second;
+        }
+    }));
+
+    const size_t kSnapshots = 1'000;
+    report("HamtMap copy", "snapshot", measure_ns_per_op(kSnapshots, [&] {
+        for (size_t i = 0; i < kSnapshots; ++i) {
+            HamtMap<int, int> snapshot(*map);
+            checksum += snapshot.Size();
+        }
+    }));
+    HashMap<int, int> hash_map;
+    for (int key : keys) {
+        hash_map.insert(std::make_pair(key, key));
+    }
+    report("HashMap copy", "snapshot", measure_ns_per_op(1, [&] {
+        HashMap<int, int> snapshot(hash_map);
+        checksum += snapshot.size();
+    }));
+    sink = checksum;
+}
+
+/* Reduce, Map and Filter over 100M elements with 1..16 threads, versus one
+ * thread summing through the iterator; the speedup is capped by the cores */
+void bench_parallel() {
+    const size_t kHuge = 100 * kElements;
+    auto range = std::views::iota(0, static_cast<int>(kHuge));
+    Vector<int> vector(range.begin(), range.end());
+    std::cout << "hardware threads: " << std::thread::hardware_concurrency() << "\n";
+
+    report("Vector::Iterator sum", "1 thread", measure_ns_per_op(kHuge, [&] {
+        size_t sum = 0;
+        for (int value : vector) {
+            sum += value;
+        }
+        sink = sum;
+    }));
+    for (size_t threads : {size_t{1}, size_t{2}, size_t{4}, size_t{8}, size_t{16}}) {
+        std::string order = std::to_string(threads) + " threads";
+        report("Vector::Reduce sum", order, measure_ns_per_op(kHuge, [&] {
+            sink = vector.Reduce(size_t{0}, [](size_t acc, size_t value) { return acc + value; },
+                                 threads);
+        }));
+        report("Vector::Map", order, measure_ns_per_op(kHuge, [&] {
+            sink = vector.Map([](int value) { return value * 2; }, threads).Size();
+        }));
+        report("Vector::Filter", order, measure_ns_per_op(kHuge, [&] {
+            sink = vector.Filter([](int value) { return value % 3 == 0; }, threads).Size();
+        }));
+    }
+}
+
+/* chained Set and PushBack from every thread, atomic counts on a base shared
+ * by all threads versus plain counts on a private copy per thread */
+template <class RefCount>
+double run_updates(size_t threads, bool shared_base) {
+    std::vector<int> values(kElements);
+    std::iota(values.begin(), values.end(), 0);
+    Vector<int, RefCount> base(values.begin(), values.end());
+    std::vector<std::optional<Vector<int, RefCount>>> starts(threads);
+    for (auto& start : starts) {
+        if (shared_base) {
+            start.emplace(base);
+        } else {
+            start.emplace(values.begin(), values.end());
+        }
+    }
+
+    const size_t kOps = 200'000;
+    return measure_ns_per_op(threads * kOps, [&] {
+        std::vector<std::thread> workers;
+        for (size_t t = 0; t < threads; ++t) {
+            workers.emplace_back([&starts, t] {
+                std::mt19937 rng(static_cast<unsigned>(t));
+                auto& vector = starts[t];
+                for (size_t i = 0; i < kOps; ++i) {
+                    if (i % 2 == 0) {
+                        vector.emplace(vector->Set(rng() % kElements, 1));
+                    } else {
+                        vector.emplace(vector->PushBack(1));
+                    }
+                }
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    });
+}
+
+void bench_refcount() {
+    for (size_t threads : {size_t{1}, size_t{4}}) {
+        std::string order = std::to_string(threads) + " threads";
+        report("Vector<int, refcount::Atomic> updates, shared base", order,
+               run_updates<refcount::Atomic>(threads, true));
+        report("Vector<int, refcount::Plain> updates, private copies", order,
+               run_updates<refcount::Plain>(threads, false));
+    }
+}
+
+/* reads versus path-copying updates on 1M elements for each branching width */
+template <class T, size_t Width>
+void run_width(const std::string& type, const std::vector<T>& values) {
+    Vector<T, refcount::Atomic, Width> vector(values.begin(), values.end());
+    std::vector<size_t> indices = make_indices("random");
+    std::string order = type + ", width " + std::to_string(Width);
+    size_t checksum = 0;
+
+    report("Vector::Get", order, measure_ns_per_op(kElements, [&] {
+        for (size_t index : indices) {
+            checksum += vector.Get(index) == values[0];
+        }
+    }));
+
+    const size_t kOps = 100'000;
+    report("Vector::Set", order, measure_ns_per_op(kOps, [&] {
+        for (size_t i = 0; i < kOps; ++i) {
+            checksum += vector.Set(indices[i], values[0]).Size();
+        }
+    }));
+
+    std::optional<Vector<T, refcount::Atomic, Width>> chain(std::in_place);
+    report("Vector::PushBack", order, measure_ns_per_op(kOps, [&] {
+        for (size_t i = 0; i < kOps; ++i) {
+            chain.emplace(chain->PushBack(values[i]));
+        }
+    }));
+    sink = checksum;
+}
+
+template <class T>
+void run_widths(const std::string& type, const std::vector<T>& values) {
+    run_width<T, 8>(type, values);
+    run_width<T, 16>(type, values);
+    run_width<T, 32>(type, values);
+    run_width<T, 64>(type, values);
+}
+
+void bench_width() {
+    std::vector<int> ints(kElements);
+    std::iota(ints.begin(), ints.end(), 0);
+    run_widths("int", ints);
+
+    std::vector<std::string> strings;
+    strings.reserve(kElements);
+    for (size_t i = 0; i < kElements; ++i) {
+        strings.push_back("value " + std::to_string(i));
+    }
+    run_widths("std::string", strings);
+}
+
+void run_all() {
+    bench_get();
+    bench_scan();
+    bench_fill();
+    bench_update();
+    bench_append();
+    bench_transient();
+    bench_rrb();
+    bench_batch();
+    bench_store();
+    bench_hamt();
+    bench_parallel();
+    bench_refcount();
+    bench_width();
+}
+}
+
+int main() {
+    benchmarks::run_all();
+    return 0;
+}
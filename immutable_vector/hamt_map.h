@@ -0,0 +1,663 @@
+#pragma once
+
+#include "main.cpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+template <class K, class V, class Hash = std::hash<K>, class RefCount = refcount::Atomic>
+class TransientHamtMap;
+
+// Persistent hash map: a 32-way trie over the bits of the key hash, the same
+// path copying as Vector with the slots of a node compressed by bitmaps. A
+// node keeps one bitmap of the digits that hold an entry in place and one of
+// those that lead to a child, and stores just those entries and children,
+// found by popcount. Copies are O(1), updates copy one root-to-entry path.
+// Keys whose 64 hash bits are all equal end up together in a collision node.
+//
+// Erase pulls an entry left alone in a subtree back into the parent, so a map
+// has one shape per set of keys and every subtree below the root holds at
+// least two entries.
+template <class K, class V, class Hash = std::hash<K>, class RefCount = refcount::Atomic>
+class HamtMap {
+    struct Node;
+
+    static constexpr size_t kNumOfBits = 5;
+    static constexpr size_t kMask = (size_t{1} << kNumOfBits) - 1;
+    static constexpr size_t kHashBits = std::numeric_limits<size_t>::digits;
+    // bitmap levels the hash bits last for, and a collision node under them
+    static constexpr size_t kMaxDepth = (kHashBits + kNumOfBits - 1) / kNumOfBits + 1;
+
+public:
+    using Entry = std::pair<const K, V>;
+
+    explicit HamtMap(Hash hash = Hash()) : root_(nullptr), size_(0), hash_(hash) {
+    }
+
+    HamtMap(const HamtMap& other) : root_(other.root_), size_(other.size_), hash_(other.hash_) {
+    }
+
+    HamtMap& operator=(const HamtMap&) = delete;
+
+    // later pairs with the same key win
+    template <class Iterator>
+    HamtMap(Iterator first, Iterator last, Hash hash = Hash()) : HamtMap(hash) {
+        uint64_t edit = NewEdit();
+        for (; first != last; ++first) {
+            EditSet(first->first, first->second, edit);
+        }
+    }
+
+    HamtMap(std::initializer_list<Entry> l, Hash hash = Hash()) : HamtMap(l.begin(), l.end(), hash) {
+    }
+
+    // the value of key, nullptr when there is none
+    const V* Find(const K& key) const {
+        const Node* node = root_.get();
+        if (!node) {
+            return nullptr;
+        }
+        size_t hash = hash_(key);
+        for (size_t shift = 0; shift < kHashBits; shift += kNumOfBits) {
+            const BitmapNode* bitmap = AsBitmap(node);
+            uint32_t bit = Bit(hash, shift);
+            if (bitmap->datamap & bit) {
+                const Entry& entry = bitmap->Entries()[bitmap->EntryIndex(bit)];
+                return entry.first == key ? &entry.second : nullptr;
+            }
+            if (!(bitmap->nodemap & bit)) {
+                return nullptr;
+            }
+            node = bitmap->Children()[bitmap->ChildIndex(bit)].get();
+        }
+        for (const Entry& entry : AsCollision(node)->entries) {
+            if (entry.first == key) {
+                return &entry.second;
+            }
+        }
+        return nullptr;
+    }
+
+    bool Contains(const K& key) const {
+        return Find(key) != nullptr;
+    }
+
+    // every persistent update is a one-call edit session, as in Vector
+
+    HamtMap Set(const K& key, const V& value) const {
+        HamtMap result(*this);
+        result.EditSet(key, value, NewEdit());
+        return result;
+    }
+
+    // the map itself, shared, when key is not in it
+    HamtMap Erase(const K& key) const {
+        HamtMap result(*this);
+        if (Contains(key)) {
+            result.EditErase(key, NewEdit());
+        }
+        return result;
+    }
+
+    size_t Size() const {
+        return size_;
+    }
+
+    bool Empty() const {
+        return size_ == 0;
+    }
+
+    // Forward iterator over the entries in trie order, which follows the key
+    // hashes. It keeps the path from the root to its entry, at most one node
+    // per 5 hash bits and a collision node.
+    class Iterator {
+        friend class HamtMap;
+
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Entry;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const Entry*;
+        using reference = const Entry&;
+
+        Iterator() : depth_(0) {
+        }
+
+        const Entry& operator*() const {
+            const Frame& frame = path_[depth_ - 1];
+            return EntryAt(frame.node, frame.entry);
+        }
+
+        const Entry* operator->() const {
+            return &**this;
+        }
+
+        Iterator& operator++() {
+            ++path_[depth_ - 1].entry;
+            Settle();
+            return *this;
+        }
+
+        Iterator operator++(int) {
+            Iterator previous = *this;
+            ++*this;
+            return previous;
+        }
+
+        bool operator==(const Iterator& rhs) const {
+            return depth_ == rhs.depth_ &&
+                   (depth_ == 0 || (path_[depth_ - 1].node == rhs.path_[depth_ - 1].node &&
+                                    path_[depth_ - 1].entry == rhs.path_[depth_ - 1].entry));
+        }
+
+    private:
+        // the next entry and child to visit in a node on the path
+        struct Frame {
+            const Node* node;
+            size_t entry;
+            size_t child;
+        };
+
+        explicit Iterator(const Node* root) : depth_(0) {
+            if (root) {
+                path_[depth_++] = {root, 0, 0};
+                Settle();
+            }
+        }
+
+        // moves on to the first entry not visited yet: those of a node come
+        // before its children
+        void Settle() {
+            while (depth_ > 0) {
+                Frame& frame = path_[depth_ - 1];
+                if (frame.entry < EntryCount(frame.node)) {
+                    return;
+                }
+                if (frame.child < ChildCount(frame.node)) {
+                    const Node* child = ChildAt(frame.node, frame.child++);
+                    path_[depth_++] = {child, 0, 0};
+                } else {
+                    --depth_;
+                }
+            }
+        }
+
+        std::array<Frame, kMaxDepth> path_;
+        size_t depth_;
+    };
+
+    Iterator Begin() const {
+        return Iterator(root_.get());
+    }
+
+    Iterator End() const {
+        return Iterator();
+    }
+
+    Iterator begin() const {
+        return Begin();
+    }
+
+    Iterator end() const {
+        return End();
+    }
+
+    // a mutable editor starting from this version, see TransientHamtMap
+    TransientHamtMap<K, V, Hash, RefCount> Transient() const {
+        return TransientHamtMap<K, V, Hash, RefCount>(*this);
+    }
+
+private:
+    friend class TransientHamtMap<K, V, Hash, RefCount>;
+
+    // collision tells the two kinds apart; edit is the session that created the
+    // node and may still change it in place, 0 for nodes no session owns
+    struct Node {
+        explicit Node(bool is_collision) : refs(1), collision(is_collision) {
+        }
+
+        typename RefCount::Counter refs;
+        bool collision;
+        uint64_t edit = 0;
+    };
+
+    // intrusive owning pointer, adopts the reference a new node starts with
+    class NodePtr {
+    public:
+        NodePtr() : node_(nullptr) {
+        }
+
+        explicit NodePtr(Node* node) : node_(node) {
+        }
+
+        NodePtr(const NodePtr& other) : node_(other.node_) {
+            if (node_) {
+                RefCount::Increment(node_->refs);
+            }
+        }
+
+        NodePtr(NodePtr&& other) noexcept : node_(std::exchange(other.node_, nullptr)) {
+        }
+
+        NodePtr& operator=(NodePtr other) noexcept {
+            std::swap(node_, other.node_);
+            return *this;
+        }
+
+        ~NodePtr() {
+            if (node_ && RefCount::Decrement(node_->refs)) {
+                Destroy(node_);
+            }
+        }
+
+        Node* get() const {
+            return node_;
+        }
+
+        Node* operator->() const {
+            return node_;
+        }
+
+        explicit operator bool() const {
+            return node_ != nullptr;
+        }
+
+        void reset() {
+            NodePtr().swap(*this);
+        }
+
+        void swap(NodePtr& other) noexcept {
+            std::swap(node_, other.node_);
+        }
+
+    private:
+        Node* node_;
+    };
+
+    // the entries and then the children follow the node in the same block,
+    // both in digit order, so a node is one allocation of just the slots it
+    // uses
+    struct BitmapNode : Node {
+        BitmapNode(uint32_t data, uint32_t nodes) : Node(false), datamap(data), nodemap(nodes) {
+        }
+
+        static constexpr size_t kEntriesOffset =
+            (sizeof(Node) + 2 * sizeof(uint32_t) + alignof(Entry) - 1) / alignof(Entry) *
+            alignof(Entry);
+        static constexpr size_t kAlign =
+            std::max({alignof(Node), alignof(uint32_t), alignof(Entry), alignof(NodePtr)});
+
+        static size_t ChildrenOffset(size_t entries) {
+            size_t end = kEntriesOffset + entries * sizeof(Entry);
+            return (end + alignof(NodePtr) - 1) / alignof(NodePtr) * alignof(NodePtr);
+        }
+
+        size_t EntryCount() const {
+            return std::popcount(datamap);
+        }
+
+        size_t ChildCount() const {
+            return std::popcount(nodemap);
+        }
+
+        size_t EntryIndex(uint32_t bit) const {
+            return std::popcount(datamap & (bit - 1));
+        }
+
+        size_t ChildIndex(uint32_t bit) const {
+            return std::popcount(nodemap & (bit - 1));
+        }
+
+        Entry* Entries() {
+            return reinterpret_cast<Entry*>(reinterpret_cast<char*>(this) + kEntriesOffset);
+        }
+
+        const Entry* Entries() const {
+            return reinterpret_cast<const Entry*>(reinterpret_cast<const char*>(this) +
+                                                  kEntriesOffset);
+        }
+
+        NodePtr* Children() {
+            return reinterpret_cast<NodePtr*>(reinterpret_cast<char*>(this) +
+                                              ChildrenOffset(EntryCount()));
+        }
+
+        const NodePtr* Children() const {
+            return reinterpret_cast<const NodePtr*>(reinterpret_cast<const char*>(this) +
+                                                    ChildrenOffset(EntryCount()));
+        }
+
+        uint32_t datamap;
+        uint32_t nodemap;
+    };
+
+    // keys with equal hashes, below the last bitmap level
+    struct CollisionNode : Node {
+        explicit CollisionNode(std::vector<Entry> same_hash)
+            : Node(true), entries(std::move(same_hash)) {
+        }
+
+        std::vector<Entry> entries;
+    };
+
+    static void Destroy(Node* node) {
+        if (node->collision) {
+            delete static_cast<CollisionNode*>(node);
+            return;
+        }
+        BitmapNode* bitmap = static_cast<BitmapNode*>(node);
+        std::destroy_n(bitmap->Entries(), bitmap->EntryCount());
+        std::destroy_n(bitmap->Children(), bitmap->ChildCount());
+        bitmap->~BitmapNode();
+        ::operator delete(bitmap, std::align_val_t(BitmapNode::kAlign));
+    }
+
+    NodePtr root_;
+    size_t size_;
+    Hash hash_;
+
+    static BitmapNode* AsBitmap(Node* node) {
+        return static_cast<BitmapNode*>(node);
+    }
+
+    static const BitmapNode* AsBitmap(const Node* node) {
+        return static_cast<const BitmapNode*>(node);
+    }
+
+    static CollisionNode* AsCollision(Node* node) {
+        return static_cast<CollisionNode*>(node);
+    }
+
+    static const CollisionNode* AsCollision(const Node* node) {
+        return static_cast<const CollisionNode*>(node);
+    }
+
+    static uint32_t Bit(size_t hash, size_t shift) {
+        return uint32_t{1} << ((hash >> shift) & kMask);
+    }
+
+    static size_t EntryCount(const Node* node) {
+        return node->collision ? AsCollision(node)->entries.size() : AsBitmap(node)->EntryCount();
+    }
+
+    static const Entry& EntryAt(const Node* node, size_t index) {
+        return node->collision ? AsCollision(node)->entries[index] : AsBitmap(node)->Entries()[index];
+    }
+
+    static size_t ChildCount(const Node* node) {
+        return node->collision ? 0 : AsBitmap(node)->ChildCount();
+    }
+
+    static const Node* ChildAt(const Node* node, size_t index) {
+        return AsBitmap(node)->Children()[index].get();
+    }
+
+    // sessions are never reused, so nodes of a finished session stay frozen
+    static uint64_t NewEdit() {
+        static std::atomic<uint64_t> last_edit{0};
+        return last_edit.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+
+    // a bitmap node whose i-th entry is a copy of entry_at(i) and i-th child
+    // child_at(i)
+    template <class EntryAt, class ChildAt>
+    static NodePtr NewBitmap(uint32_t datamap, uint32_t nodemap, uint64_t edit, EntryAt entry_at,
+                             ChildAt child_at) {
+        size_t entries = std::popcount(datamap);
+        size_t children = std::popcount(nodemap);
+        size_t bytes = BitmapNode::ChildrenOffset(entries) + children * sizeof(NodePtr);
+        void* memory = ::operator new(bytes, std::align_val_t(BitmapNode::kAlign));
+        BitmapNode* node = new (memory) BitmapNode(datamap, nodemap);
+        node->edit = edit;
+        size_t built = 0;
+        try {
+            for (; built < entries; ++built) {
+                new (node->Entries() + built) Entry(entry_at(built));
+            }
+        } catch (...) {
+            std::destroy_n(node->Entries(), built);
+            node->~BitmapNode();
+            ::operator delete(memory, std::align_val_t(BitmapNode::kAlign));
+            throw;
+        }
+        for (size_t i = 0; i < children; ++i) {
+            new (node->Children() + i) NodePtr(child_at(i));
+        }
+        return NodePtr(node);
+    }
+
+    // for nodes without entries or without children, never called
+    static const Entry& NoEntry(size_t) {
+        std::abort();
+    }
+
+    static NodePtr NoChild(size_t) {
+        return NodePtr();
+    }
+
+    // the node in slot, replaced by an owned copy first unless edit owns it
+    static Node* Editable(NodePtr& slot, uint64_t edit) {
+        if (slot->edit == edit) {
+            return slot.get();
+        }
+        if (slot->collision) {
+            CollisionNode* copy = new CollisionNode(AsCollision(slot.get())->entries);
+            NodePtr owner(copy);
+            copy->edit = edit;
+            slot = std::move(owner);
+        } else {
+            const BitmapNode* node = AsBitmap(slot.get());
+            slot = NewBitmap(
+                node->datamap, node->nodemap, edit,
+                [node](size_t i) -> const Entry& { return node->Entries()[i]; },
+                [node](size_t i) { return node->Children()[i]; });
+        }
+        return slot.get();
+    }
+
+    // a subtree at shift holding the two entries, whose keys differ
+    static NodePtr Merge(size_t shift, const Entry& first, size_t first_hash, const Entry& second,
+                         size_t second_hash, uint64_t edit) {
+        if (shift >= kHashBits) {
+            CollisionNode* node = new CollisionNode({first, second});
+            NodePtr result(node);
+            node->edit = edit;
+            return result;
+        }
+        uint32_t first_bit = Bit(first_hash, shift);
+        uint32_t second_bit = Bit(second_hash, shift);
+        if (first_bit == second_bit) {
+            NodePtr child = Merge(shift + kNumOfBits, first, first_hash, second, second_hash, edit);
+            return NewBitmap(0, first_bit, edit, NoEntry, [&](size_t) { return child; });
+        }
+        bool in_order = first_bit < second_bit;
+        return NewBitmap(
+            first_bit | second_bit, 0, edit,
+            [&](size_t i) -> const Entry& { return (i == 0) == in_order ? first : second; },
+            NoChild);
+    }
+
+    void EditSet(const K& key, const V& value, uint64_t edit) {
+        if (!root_) {
+            Entry entry(key, value);
+            root_ = NewBitmap(
+                Bit(hash_(key), 0), 0, edit, [&](size_t) -> const Entry& { return entry; },
+                NoChild);
+            ++size_;
+            return;
+        }
+        if (Insert(root_, 0, hash_(key), key, value, edit)) {
+            ++size_;
+        }
+    }
+
+    // sets key in the subtree in slot at shift; returns whether key is new
+    bool Insert(NodePtr& slot, size_t shift, size_t hash, const K& key, const V& value,
+                uint64_t edit) {
+        if (shift >= kHashBits) {
+            auto& entries = AsCollision(slot.get())->entries;
+            for (size_t i = 0; i < entries.size(); ++i) {
+                if (entries[i].first == key) {
+                    AsCollision(Editable(slot, edit))->entries[i].second = value;
+                    return false;
+                }
+            }
+            AsCollision(Editable(slot, edit))->entries.emplace_back(key, value);
+            return true;
+        }
+
+        const BitmapNode* node = AsBitmap(slot.get());
+        uint32_t bit = Bit(hash, shift);
+        if (node->nodemap & bit) {
+            BitmapNode* owned = AsBitmap(Editable(slot, edit));
+            return Insert(owned->Children()[owned->ChildIndex(bit)], shift + kNumOfBits, hash, key,
+                          value, edit);
+        }
+        if (!(node->datamap & bit)) {
+            Entry entry(key, value);
+            size_t at = node->EntryIndex(bit);
+            slot = NewBitmap(
+                node->datamap | bit, node->nodemap, edit,
+                [&](size_t i) -> const Entry& {
+                    return i < at ? node->Entries()[i] : i == at ? entry : node->Entries()[i - 1];
+                },
+                [node](size_t i) { return node->Children()[i]; });
+            return true;
+        }
+
+        size_t at = node->EntryIndex(bit);
+        const Entry& existing = node->Entries()[at];
+        if (existing.first == key) {
+            AsBitmap(Editable(slot, edit))->Entries()[at].second = value;
+            return false;
+        }
+        // two keys share this digit, both move one level down
+        NodePtr child = Merge(shift + kNumOfBits, existing, hash_(existing.first), Entry(key, value),
+                              hash, edit);
+        size_t child_at = node->ChildIndex(bit);
+        slot = NewBitmap(
+            node->datamap & ~bit, node->nodemap | bit, edit,
+            [&](size_t i) -> const Entry& { return node->Entries()[i < at ? i : i + 1]; },
+            [&](size_t i) {
+                return i < child_at ? node->Children()[i] : i == child_at ? child
+                                                                          : node->Children()[i - 1];
+            });
+        return true;
+    }
+
+    // key must be in the map
+    void EditErase(const K& key, uint64_t edit) {
+        Remove(root_, 0, hash_(key), key, edit);
+        --size_;
+        const BitmapNode* root = AsBitmap(root_.get());
+        if (root->datamap == 0 && root->nodemap == 0) {
+            root_.reset();
+        }
+    }
+
+    static bool HoldsOneEntry(const Node* node) {
+        if (node->collision) {
+            return AsCollision(node)->entries.size() == 1;
+        }
+        return AsBitmap(node)->nodemap == 0 && std::popcount(AsBitmap(node)->datamap) == 1;
+    }
+
+    // drops key, which is there, from the subtree in slot at shift; a child
+    // left with one entry is replaced by that entry
+    static void Remove(NodePtr& slot, size_t shift, size_t hash, const K& key, uint64_t edit) {
+        if (shift >= kHashBits) {
+            // entries have const keys and cannot be shifted down in place
+            std::vector<Entry> rest;
+            for (const Entry& entry : AsCollision(slot.get())->entries) {
+                if (!(entry.first == key)) {
+                    rest.push_back(entry);
+                }
+            }
+            CollisionNode* node = new CollisionNode(std::move(rest));
+            NodePtr owner(node);
+            node->edit = edit;
+            slot = std::move(owner);
+            return;
+        }
+
+        const BitmapNode* node = AsBitmap(slot.get());
+        uint32_t bit = Bit(hash, shift);
+        if (node->datamap & bit) {
+            size_t at = node->EntryIndex(bit);
+            slot = NewBitmap(
+                node->datamap & ~bit, node->nodemap, edit,
+                [&](size_t i) -> const Entry& { return node->Entries()[i < at ? i : i + 1]; },
+                [node](size_t i) { return node->Children()[i]; });
+            return;
+        }
+
+        BitmapNode* owned = AsBitmap(Editable(slot, edit));
+        size_t child_at = owned->ChildIndex(bit);
+        NodePtr& child = owned->Children()[child_at];
+        Remove(child, shift + kNumOfBits, hash, key, edit);
+        if (!HoldsOneEntry(child.get())) {
+            return;
+        }
+        const Entry& last = EntryAt(child.get(), 0);
+        size_t at = owned->EntryIndex(bit);
+        slot = NewBitmap(
+            owned->datamap | bit, owned->nodemap & ~bit, edit,
+            [&](size_t i) -> const Entry& {
+                return i < at ? owned->Entries()[i] : i == at ? last : owned->Entries()[i - 1];
+            },
+            [&](size_t i) { return owned->Children()[i < child_at ? i : i + 1]; });
+    }
+};
+
+// Mutable editor over a HamtMap for batches of updates, like TransientVector:
+// it changes the nodes it created itself in place and copies a shared node
+// only the first time it is touched. Persistent() hands out the current state
+// in O(1) and starts a new session.
+template <class K, class V, class Hash, class RefCount>
+class TransientHamtMap {
+public:
+    explicit TransientHamtMap(const HamtMap<K, V, Hash, RefCount>& map)
+        : map_(map), edit_(HamtMap<K, V, Hash, RefCount>::NewEdit()) {
+    }
+
+    TransientHamtMap(const TransientHamtMap&) = delete;
+    TransientHamtMap& operator=(const TransientHamtMap&) = delete;
+
+    const V* Find(const K& key) const {
+        return map_.Find(key);
+    }
+
+    void Set(const K& key, const V& value) {
+        map_.EditSet(key, value, edit_);
+    }
+
+    void Erase(const K& key) {
+        if (map_.Contains(key)) {
+            map_.EditErase(key, edit_);
+        }
+    }
+
+    size_t Size() const {
+        return map_.size_;
+    }
+
+    HamtMap<K, V, Hash, RefCount> Persistent() {
+        edit_ = HamtMap<K, V, Hash, RefCount>::NewEdit();
+        return HamtMap<K, V, Hash, RefCount>(map_);
+    }
+
+private:
+    HamtMap<K, V, Hash, RefCount> map_;
+    uint64_t edit_;
+};
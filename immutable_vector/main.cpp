@@ -1,264 +1,1850 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <compare>
+#include <cstdint>
+#include <future>
+#include <initializer_list>
 #include <iterator>
+#include <limits>
 #include <memory>
+#include <mutex>
+#include <new>
+#include <numeric>
+#include <optional>
+#include <span>
+#include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
+#if __has_include(<sys/single_threaded.h>)
+#include <sys/single_threaded.h>
+#endif
 
-template <class T>
-class Vector {
+// refcount policies for Vector nodes: Atomic lets versions be shared between
+// threads, Plain is cheaper for vectors that never leave one thread
+namespace refcount {
+
+struct Atomic {
+    using Counter = std::atomic<uint32_t>;
+
+    static void Increment(Counter& count) {
+        if (SingleThreaded()) {
+            count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        } else {
+            count.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    // true when the last reference went away
+    static bool Decrement(Counter& count) {
+        if (SingleThreaded()) {
+            uint32_t left = count.load(std::memory_order_relaxed) - 1;
+            count.store(left, std::memory_order_relaxed);
+            return left == 0;
+        }
+        return count.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+
+    // nothing can race before the first thread starts, the same shortcut
+    // libstdc++ takes for shared_ptr
+    static bool SingleThreaded() {
+#if __has_include(<sys/single_threaded.h>)
+        return __libc_single_threaded;
+#else
+        return false;
+#endif
+    }
+};
+
+struct Plain {
+    using Counter = uint32_t;
+
+    static void Increment(Counter& count) {
+        ++count;
+    }
+
+    static bool Decrement(Counter& count) {
+        return --count == 0;
+    }
+};
+}
+
+// fixed-capacity array constructed in place, the storage of one trie node
+template <class Element, size_t kCapacity>
+class InlineArray {
 public:
-    Vector() : root_(CreateNodePartial(kStartingBit - kNumOfBits, 0)), size_(0) {
+    InlineArray() : size_(0) {
     }
 
-    Vector(const Vector& other) : root_(other.root_), size_(other.size_) {
+    InlineArray(const InlineArray&) = delete;
+
+    InlineArray& operator=(const InlineArray& other) {
+        clear();
+        std::uninitialized_copy(other.begin(), other.end(), data());
+        size_ = other.size_;
+        return *this;
     }
 
-    Vector& operator=(const Vector&) = delete;
+    ~InlineArray() {
+        clear();
+    }
 
-    explicit Vector(size_t count, const T& value = {})
-        : root_(CreateNodePartialWithValue(value, kStartingBit - kNumOfBits, count)), size_(count) {
+    size_t size() const {
+        return size_;
     }
 
-    template <class Iterator>
-    Vector(Iterator first, Iterator last) {
+    bool empty() const {
+        return size_ == 0;
+    }
+
+    Element& operator[](size_t index) {
+        return data()[index];
+    }
+
+    const Element& operator[](size_t index) const {
+        return data()[index];
+    }
+
+    Element& front() {
+        return data()[0];
+    }
+
+    Element& back() {
+        return data()[size_ - 1];
+    }
+
+    const Element& front() const {
+        return data()[0];
+    }
+
+    const Element& back() const {
+        return data()[size_ - 1];
+    }
+
+    Element* begin() {
+        return data();
+    }
+
+    Element* end() {
+        return data() + size_;
+    }
+
+    const Element* begin() const {
+        return data();
+    }
+
+    const Element* end() const {
+        return data() + size_;
+    }
+
+    template <class... Args>
+    void emplace_back(Args&&... args) {
+        new (data() + size_) Element(std::forward<Args>(args)...);
+        ++size_;
+    }
+
+    void push_back(const Element& element) {
+        emplace_back(element);
+    }
+
+    void push_back(Element&& element) {
+        emplace_back(std::move(element));
+    }
+
+    void pop_back() {
+        data()[--size_].~Element();
+    }
+
+    void clear() {
+        std::destroy(data(), data() + size_);
         size_ = 0;
-        auto copy = first;
-        while (copy != last) {
-            ++copy;
-            ++size_;
+    }
+
+private:
+    Element* data() {
+        return std::launder(reinterpret_cast<Element*>(storage_));
+    }
+
+    const Element* data() const {
+        return std::launder(reinterpret_cast<const Element*>(storage_));
+    }
+
+    alignas(Element) unsigned char storage_[kCapacity * sizeof(Element)];
+    size_t size_;
+};
+
+// Fixed-size block allocator for trie nodes, one per size class. Each thread
+// allocates from and frees into its own list and trades blocks with a shared
+// depot kBatch at a time; new blocks are carved kChunk at a time from one
+// allocation. Blocks are reused but never returned to the system.
+template <size_t kSize, size_t kAlign>
+class NodePool {
+public:
+    static void* Allocate() {
+        Cache& cache = LocalCache();
+        if (!cache.head) {
+            Refill(cache);
         }
-        root_ = CreateNodePartial(kStartingBit - kNumOfBits, size_);
-        for (size_t i = 0; i < size_; ++i) {
-            AddValue(root_, kStartingBit - kNumOfBits, i, *first);
-            ++first;
+        Block* block = cache.head;
+        cache.head = block->next;
+        --cache.count;
+        return block;
+    }
+
+    static void Release(void* memory) {
+        Block* block = static_cast<Block*>(memory);
+        Cache& cache = LocalCache();
+        if (cache.flushed) {
+            // the thread is exiting, its list is gone
+            Depot& depot = GetDepot();
+            std::lock_guard<std::mutex> lock(depot.mutex);
+            block->next = depot.head;
+            depot.head = block;
+            return;
+        }
+        block->next = cache.head;
+        cache.head = block;
+        if (++cache.count >= 2 * kBatch) {
+            Spill(cache, kBatch);
         }
     }
 
-    Vector(std::initializer_list<T> l)
-        : root_(CreateNodePartial(kStartingBit - kNumOfBits, l.size())), size_(l.size()) {
-        auto it = l.begin();
-        for (size_t i = 0; i < size_; ++i) {
-            AddValue(root_, kStartingBit - kNumOfBits, i, *it);
-            ++it;
+private:
+    static const size_t kBatch = 64;
+    static const size_t kChunk = 64;
+
+    struct Block {
+        Block* next;
+    };
+
+    static constexpr size_t kAlignment = std::max(kAlign, alignof(Block));
+    static constexpr size_t kBlockSize =
+        (std::max(kSize, sizeof(Block)) + kAlignment - 1) / kAlignment * kAlignment;
+
+    // trivially destructible, so it stays usable after the Flusher ran
+    struct Cache {
+        Block* head;
+        size_t count;
+        bool flushed;
+    };
+
+    struct Flusher {
+        ~Flusher() {
+            Cache& cache = LocalCache();
+            Spill(cache, cache.count);
+            cache.flushed = true;
+        }
+    };
+
+    // never destroyed: nodes of static vectors are released during exit
+    struct Depot {
+        std::mutex mutex;
+        Block* head = nullptr;
+        std::vector<void*> chunks;
+    };
+
+    static Depot& GetDepot() {
+        static Depot* depot = new Depot;
+        return *depot;
+    }
+
+    static Cache& LocalCache() {
+        thread_local Cache cache{nullptr, 0, false};
+        thread_local Flusher flusher;
+        return cache;
+    }
+
+    // moves count blocks from the head of the thread list to the depot
+    static void Spill(Cache& cache, size_t count) {
+        if (count == 0) {
+            return;
+        }
+        Block* first = cache.head;
+        Block* last = first;
+        for (size_t i = 1; i < count; ++i) {
+            last = last->next;
+        }
+        cache.head = last->next;
+        cache.count -= count;
+
+        Depot& depot = GetDepot();
+        std::lock_guard<std::mutex> lock(depot.mutex);
+        last->next = depot.head;
+        depot.head = first;
+    }
+
+    static void Refill(Cache& cache) {
+        Depot& depot = GetDepot();
+        {
+            std::lock_guard<std::mutex> lock(depot.mutex);
+            while (depot.head && cache.count < kBatch) {
+                Block* block = depot.head;
+                depot.head = block->next;
+                block->next = cache.head;
+                cache.head = block;
+                ++cache.count;
+            }
+        }
+        if (cache.head) {
+            return;
         }
+
+        char* chunk = static_cast<char*>(
+            ::operator new(kBlockSize * kChunk, std::align_val_t(kAlignment)));
+        {
+            std::lock_guard<std::mutex> lock(depot.mutex);
+            depot.chunks.push_back(chunk);
+        }
+        for (size_t i = kChunk; i-- > 0;) {
+            Block* block = reinterpret_cast<Block*>(chunk + i * kBlockSize);
+            block->next = cache.head;
+            cache.head = block;
+        }
+        cache.count += kChunk;
+    }
+};
+
+template <class T, class RefCount = refcount::Atomic, size_t Width = 32>
+class TransientVector;
+
+template <class T, class RefCount, size_t Width>
+class VectorStore;
+
+// Width is the branching factor: wider nodes make the trie shallower for reads
+// and make every path copy larger for updates
+template <class T, class RefCount = refcount::Atomic, size_t Width = 32>
+class Vector {
+    static_assert(Width >= 2 && std::has_single_bit(Width), "Width must be a power of two");
+
+public:
+    Vector() : root_(nullptr), tail_(nullptr), shift_(0), size_(0) {
+    }
+
+    Vector(const Vector& other)
+        : root_(other.root_), tail_(other.tail_), shift_(other.shift_), size_(other.size_) {
+    }
+
+    Vector& operator=(const Vector&) = delete;
+
+    // O(log n) time and memory: the trie is one full subtree per level
+    // referenced as many times as it fits, updates copy their path out of it
+    explicit Vector(size_t count, const T& value = {}) : Vector() {
+        if (count == 0) {
+            return;
+        }
+        size_ = count;
+        ValueNode* tail = new ValueNode;
+        tail_ = NodePtr(tail);
+        while (tail->value.size() < ((count - 1) & kMask) + 1) {
+            tail->value.push_back(value);
+        }
+        size_t trie_size = count - tail->value.size();
+        if (trie_size == 0) {
+            return;
+        }
+        while (Capacity(shift_) < trie_size) {
+            shift_ += kNumOfBits;
+        }
+
+        std::vector<NodePtr> full;
+        if (tail->value.size() == kWidth) {
+            full.push_back(tail_);
+        } else {
+            ValueNode* leaf = new ValueNode;
+            full.emplace_back(leaf);
+            while (leaf->value.size() < kWidth) {
+                leaf->value.push_back(value);
+            }
+        }
+        while (full.size() <= shift_ / kNumOfBits) {
+            PtrNode* node = new PtrNode;
+            NodePtr owner(node);
+            while (node->children.size() < kWidth) {
+                node->children.push_back(full.back());
+            }
+            full.push_back(std::move(owner));
+        }
+        root_ = Fill(full, shift_, trie_size);
+    }
+
+    template <class Iterator>
+    Vector(Iterator first, Iterator last) : Vector() {
+        Build([&first, &last](auto& values) {
+            if (first == last) {
+                return false;
+            }
+            values.push_back(*first);
+            ++first;
+            return true;
+        });
+    }
+
+    Vector(std::initializer_list<T> l) : Vector(l.begin(), l.end()) {
     }
 
+    // every persistent update is a one-call edit session: a fresh session owns
+    // no node yet, so it copies exactly the path it touches
+
     Vector Set(size_t index, const T& value) const {
-        return Vector(Change(root_, kStartingBit - kNumOfBits, index, value), size_);
+        Vector result(*this);
+        result.EditSet(index, value, NewEdit());
+        return result;
+    }
+
+    // applies (index, value) updates in index order as one edit session, the
+    // last of several updates to an index winning: updates that share a node
+    // copy it once, and every node is entered once from its parent instead
+    // of once per update from the root
+    Vector SetMany(std::span<const std::pair<size_t, T>> updates) const {
+        // (index, position in updates), so equal indices keep their order
+        std::vector<std::pair<size_t, size_t>> order(updates.size());
+        for (size_t i = 0; i < updates.size(); ++i) {
+            order[i] = {updates[i].first, i};
+        }
+        std::sort(order.begin(), order.end());
+
+        uint64_t edit = NewEdit();
+        Vector result(*this);
+        size_t tail_offset = TailOffset();
+        auto trie_end = std::partition_point(order.begin(), order.end(), [&](const auto& update) {
+            return update.first < tail_offset;
+        });
+        if (trie_end != order.begin()) {
+            SetRun(result.root_, shift_, 0, updates, order.begin(), trie_end, edit);
+        }
+        if (trie_end != order.end()) {
+            ValueNode* tail = AsValue(Editable(result.tail_, 0, edit));
+            for (auto it = trie_end; it != order.end(); ++it) {
+                tail->value[it->first - tail_offset] = updates[it->second].second;
+            }
+        }
+        return result;
     }
 
     const T& Get(size_t index) const {
-        std::shared_ptr<Node> result = root_;
-        for (size_t i = kStartingBit - kNumOfBits; i > 0; i -= kNumOfBits) {
-            size_t count_bits = CountBits(index, i, i + kNumOfBits);
-            result = dynamic_cast<PtrNode*>(result.get())->children[count_bits];
+        size_t tail_offset = TailOffset();
+        if (index >= tail_offset) {
+            return AsValue(tail_.get())->value[index - tail_offset];
         }
-        size_t count_bits = CountBits(index, 0, kNumOfBits);
-        return dynamic_cast<ValueNode*>(result.get())->value[count_bits];
+        if (!root_->relaxed) {
+            return Descend(root_.get(), index, shift_ / kNumOfBits)->value[Digit(index, 0)];
+        }
+        size_t first;
+        const ValueNode* leaf = FindLeaf(index, first);
+        return leaf->value[index - first];
     }
 
+    // copies only the tail, except once every kWidth calls when the full
+    // tail moves into the trie
     Vector PushBack(const T& value) const {
-        return Vector(AddNewValue(root_, kStartingBit - kNumOfBits, size_, value), size_ + 1);
+        Vector result(*this);
+        result.EditPushBack(value, NewEdit());
+        return result;
     }
 
+    // copies only the tail, except when the last value of the tail goes and
+    // the last leaf of the trie becomes the tail, shared
     Vector PopBack() const {
-        return Vector(PopValue(root_, kStartingBit - kNumOfBits, size_ - 1), size_ - 1);
+        Vector result(*this);
+        result.EditPopBack(NewEdit());
+        return result;
+    }
+
+    // left followed by right in O(log n): the two tries are zipped together
+    // along the seam, which is rebalanced level by level; a right vector that
+    // fits in its tail is appended to the tail instead
+    static Vector Concat(const Vector& left, const Vector& right) {
+        if (left.size_ == 0) {
+            return right;
+        }
+        if (right.size_ == 0) {
+            return left;
+        }
+        uint64_t edit = NewEdit();
+        Vector result(left);
+        if (!right.root_) {
+            for (const T& value : AsValue(right.tail_.get())->value) {
+                result.EditPushBack(value, edit);
+            }
+            return result;
+        }
+
+        result.PushTail(edit);
+        size_t shift = std::max(result.shift_, right.shift_) + kNumOfBits;
+        result.root_ = Merge(result.root_, result.shift_, right.root_, right.shift_, edit);
+        result.shift_ = shift;
+        result.DropSingleChildRoots();
+        result.tail_ = right.tail_;
+        result.size_ += right.size_;
+        return result;
+    }
+
+    // the values in [from, to), sharing every node the range covers whole
+    Vector Slice(size_t from, size_t to) const {
+        if (from >= to) {
+            return Vector();
+        }
+        if (from == 0 && to == size_) {
+            return *this;
+        }
+        uint64_t edit = NewEdit();
+        Vector result;
+        result.size_ = to - from;
+        size_t tail_offset = TailOffset();
+        if (from >= tail_offset) {
+            result.tail_ =
+                SliceTrie(tail_, 0, from - tail_offset, to - tail_offset, size_ - tail_offset, edit);
+            return result;
+        }
+
+        size_t trie_to = std::min(to, tail_offset);
+        result.root_ = SliceTrie(root_, shift_, from, trie_to, tail_offset, edit);
+        result.shift_ = shift_;
+        result.DropSingleChildRoots();
+        if (to > tail_offset) {
+            result.tail_ = SliceTrie(tail_, 0, 0, to - tail_offset, size_ - tail_offset, edit);
+        } else {
+            result.TakeLastLeaf(edit);
+        }
+        return result;
+    }
+
+    // a slice and two concatenations, O(log n)
+    Vector Insert(size_t index, const T& value) const {
+        if (index == size_) {
+            return PushBack(value);
+        }
+        return Concat(Slice(0, index).PushBack(value), Slice(index, size_));
+    }
+
+    Vector Erase(size_t index) const {
+        if (index + 1 == size_) {
+            return PopBack();
+        }
+        return Concat(Slice(0, index), Slice(index + 1, size_));
+    }
+
+    // calls callback(index, before_value, after_value) for every index whose
+    // value differs between the two versions, in index order; the values are
+    // const T*, null past the end of the shorter one. Subtrees the versions
+    // share are skipped whole, so versions a few updates apart are compared
+    // in O(changes * log n); where concatenation or slicing moved the node
+    // boundaries apart the values are compared one by one
+    template <class Callback>
+    static void Diff(const Vector& before, const Vector& after, Callback callback) {
+        size_t end = 0;
+        if (before.root_ && after.root_) {
+            end = std::min(before.TailOffset(), after.TailOffset());
+            size_t shift = std::min(before.shift_, after.shift_);
+            const Node* old_node = FirstAt(before.root_.get(), before.shift_, shift, end);
+            const Node* new_node = FirstAt(after.root_.get(), after.shift_, shift, end);
+            DiffNodes(before, after, old_node, new_node, shift, 0, end, callback);
+        }
+        DiffValues(before, after, end, std::max(before.size_, after.size_), callback);
     }
 
     size_t Size() const {
         return size_;
     }
 
+    // Const random-access iterator. It keeps a pointer to the values of the
+    // leaf it is in and finds a leaf again only when it crosses into another
+    // one, so a sequential scan is O(1) per element.
+    class Iterator {
+        friend class Vector;
+
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T*;
+        using reference = const T&;
+
+        Iterator() : vector_(nullptr), values_(nullptr), first_(0), last_(0), index_(0) {
+        }
+
+        const T& operator*() const {
+            return values_[index_ - first_];
+        }
+
+        const T* operator->() const {
+            return &**this;
+        }
+
+        const T& operator[](difference_type offset) const {
+            return *(*this + offset);
+        }
+
+        Iterator& operator++() {
+            MoveTo(index_ + 1);
+            return *this;
+        }
+
+        Iterator operator++(int) {
+            Iterator previous = *this;
+            ++*this;
+            return previous;
+        }
+
+        Iterator& operator--() {
+            MoveTo(index_ - 1);
+            return *this;
+        }
+
+        Iterator operator--(int) {
+            Iterator previous = *this;
+            --*this;
+            return previous;
+        }
+
+        Iterator& operator+=(difference_type offset) {
+            MoveTo(index_ + offset);
+            return *this;
+        }
+
+        Iterator& operator-=(difference_type offset) {
+            MoveTo(index_ - offset);
+            return *this;
+        }
+
+        Iterator operator+(difference_type offset) const {
+            Iterator result = *this;
+            return result += offset;
+        }
+
+        friend Iterator operator+(difference_type offset, const Iterator& it) {
+            return it + offset;
+        }
+
+        Iterator operator-(difference_type offset) const {
+            Iterator result = *this;
+            return result -= offset;
+        }
+
+        difference_type operator-(const Iterator& rhs) const {
+            return static_cast<difference_type>(index_) - static_cast<difference_type>(rhs.index_);
+        }
+
+        bool operator==(const Iterator& rhs) const {
+            return index_ == rhs.index_;
+        }
+
+        std::strong_ordering operator<=>(const Iterator& rhs) const {
+            return index_ <=> rhs.index_;
+        }
+
+    private:
+        Iterator(const Vector* vector, size_t index)
+            : vector_(vector), values_(nullptr), first_(0), last_(0), index_(0) {
+            MoveTo(index);
+        }
+
+        // the past-the-end position loads nothing
+        void MoveTo(size_t index) {
+            index_ = index;
+            if ((index < first_ || index >= last_) && index < vector_->size_) {
+                const ValueNode* leaf = vector_->FindLeaf(index, first_);
+                values_ = leaf->value.begin();
+                last_ = first_ + leaf->value.size();
+            }
+        }
+
+        // values_ holds the values with indices [first_, last_)
+        const Vector* vector_;
+        const T* values_;
+        size_t first_;
+        size_t last_;
+        size_t index_;
+    };
+
+    Iterator Begin() const {
+        return Iterator(this, 0);
+    }
+
+    Iterator End() const {
+        return Iterator(this, size_);
+    }
+
+    Iterator begin() const {
+        return Begin();
+    }
+
+    Iterator end() const {
+        return End();
+    }
+
+    // calls callback(std::span<const T>) on every leaf in index order, each
+    // span a contiguous run of up to kWidth values
+    template <class Callback>
+    void ForEachChunk(Callback callback) const {
+        if (root_) {
+            VisitLeaves(root_.get(), shift_, callback);
+        }
+        if (tail_) {
+            const ValueNode* tail = AsValue(tail_.get());
+            callback(std::span<const T>(tail->value.begin(), tail->value.size()));
+        }
+    }
+
+    // Reduce, Map and Filter cut the trie into subtrees at the first level with
+    // kPartsPerThread of them per thread and hand contiguous runs of subtrees
+    // to std::async tasks, one per thread; threads == 0 means one per core.
+    // The callbacks are called concurrently from several threads.
+
+    // op(acc, value) folded over every value, partial results of the runs are
+    // combined with op(acc, acc) as in std::reduce, so op must be associative
+    template <class U, class BinaryOp>
+    U Reduce(U init, BinaryOp op, size_t threads = 0) const {
+        std::vector<std::optional<U>> partials;
+        if (root_) {
+            std::vector<const Node*> parts;
+            size_t shift = SplitTrie(parts, threads);
+            partials.resize(Runs(parts.size(), threads));
+            RunSplit(parts.size(), partials.size(), [&](size_t run, size_t begin, size_t end) {
+                auto reduce = [&partials, &op, run](std::span<const T> values) {
+                    ReduceChunk(partials[run], values, op);
+                };
+                for (size_t i = begin; i < end; ++i) {
+                    VisitLeaves(parts[i], shift, reduce);
+                }
+            });
+        }
+        for (auto& partial : partials) {
+            if (partial) {
+                init = op(std::move(init), std::move(*partial));
+            }
+        }
+        if (tail_) {
+            for (const T& value : AsValue(tail_.get())->value) {
+                init = op(std::move(init), value);
+            }
+        }
+        return init;
+    }
+
+    // func(value) for every value, in a Vector of the same shape built node by
+    // node with no path copies
+    template <class Func>
+    auto Map(Func func, size_t threads = 0) const {
+        using U = std::decay_t<std::invoke_result_t<Func&, const T&>>;
+        using Result = Vector<U, RefCount, Width>;
+        Result result;
+        result.size_ = size_;
+        if (root_) {
+            std::vector<const Node*> parts;
+            size_t shift = SplitTrie(parts, threads);
+            std::vector<typename Result::NodePtr> mapped(parts.size());
+            RunSplit(parts.size(), Runs(parts.size(), threads),
+                     [&](size_t, size_t begin, size_t end) {
+                         for (size_t i = begin; i < end; ++i) {
+                             mapped[i] = MapNode<U>(parts[i], shift, func);
+                         }
+                     });
+            size_t next = 0;
+            result.root_ = MapTop<U>(root_.get(), shift_, shift, mapped, next);
+            result.shift_ = shift_;
+        }
+        if (tail_) {
+            result.tail_ = MapNode<U>(tail_.get(), 0, func);
+        }
+        return result;
+    }
+
+    // the values pred accepts, in order: every run is filtered into a Vector
+    // of its own and the pieces are concatenated
+    template <class Pred>
+    Vector Filter(Pred pred, size_t threads = 0) const {
+        std::vector<std::optional<Vector>> pieces;
+        auto keep = [&pred](std::vector<T>& kept, std::span<const T> values) {
+            for (const T& value : values) {
+                if (pred(value)) {
+                    kept.push_back(value);
+                }
+            }
+        };
+        if (root_) {
+            std::vector<const Node*> parts;
+            size_t shift = SplitTrie(parts, threads);
+            pieces.resize(Runs(parts.size(), threads));
+            RunSplit(parts.size(), pieces.size(), [&](size_t run, size_t begin, size_t end) {
+                std::vector<T> kept;
+                auto filter = [&keep, &kept](std::span<const T> values) {
+                    keep(kept, values);
+                };
+                for (size_t i = begin; i < end; ++i) {
+                    VisitLeaves(parts[i], shift, filter);
+                }
+                pieces[run].emplace(kept.begin(), kept.end());
+            });
+        }
+        if (tail_) {
+            std::vector<T> kept;
+            const ValueNode* tail = AsValue(tail_.get());
+            keep(kept, std::span<const T>(tail->value.begin(), tail->value.size()));
+            pieces.emplace_back(std::in_place, kept.begin(), kept.end());
+        }
+        if (pieces.empty()) {
+            return Vector();
+        }
+        return ConcatPieces(pieces, 0, pieces.size());
+    }
+
+    // a mutable editor starting from this version, see TransientVector
+    TransientVector<T, RefCount, Width> Transient() const {
+        return TransientVector<T, RefCount, Width>(*this);
+    }
+
 private:
-    static const size_t kWidth = 32;
-    static const size_t kNumOfBits = 5;
-    static const size_t kStartingBit = 30;
+    friend class TransientVector<T, RefCount, Width>;
+    friend class VectorStore<T, RefCount, Width>;
+    template <class, class, size_t>
+    friend class Vector;
+
+    static constexpr size_t kWidth = Width;
+    static constexpr size_t kNumOfBits = std::countr_zero(Width);
+    static constexpr size_t kMask = kWidth - 1;
+    // levels above the leaves in the deepest trie a size_t index can address
+    static constexpr size_t kMaxLevels = (std::numeric_limits<size_t>::digits - 1) / kNumOfBits;
+    // nodes a rebalanced concatenation may keep above the minimum
+    static constexpr size_t kExtraNodes = 2;
+    // subtrees per thread the parallel operations split the trie into, so
+    // that the runs come out about even
+    static constexpr size_t kPartsPerThread = 4;
 
+    // the level alone tells leaves, which hold values, from inner nodes, which
+    // hold children; leaf is kept only to delete a node through its real type.
+    // An inner node is either balanced, every child but the last complete and
+    // the last balanced, so radix digits index it; or relaxed, a RelaxedNode
+    // whose size table is searched instead. Only concatenation and slicing
+    // make relaxed nodes and leaves that are not full. The last 1..kWidth
+    // values live in the tail.
+    // edit is the session that created the node and may still change it in
+    // place, 0 for nodes no session owns.
     struct Node {
-        virtual ~Node() = default;
+        explicit Node(bool is_leaf, bool is_relaxed = false)
+            : refs(1), leaf(is_leaf), relaxed(is_relaxed) {
+        }
+
+        typename RefCount::Counter refs;
+        bool leaf;
+        bool relaxed;
+        uint64_t edit = 0;
+    };
+
+    // intrusive owning pointer, adopts the reference a new node starts with
+    class NodePtr {
+    public:
+        NodePtr() : node_(nullptr) {
+        }
+
+        explicit NodePtr(Node* node) : node_(node) {
+        }
+
+        NodePtr(const NodePtr& other) : node_(other.node_) {
+            if (node_) {
+                RefCount::Increment(node_->refs);
+            }
+        }
+
+        NodePtr(NodePtr&& other) noexcept : node_(std::exchange(other.node_, nullptr)) {
+        }
+
+        NodePtr& operator=(NodePtr other) noexcept {
+            std::swap(node_, other.node_);
+            return *this;
+        }
+
+        ~NodePtr() {
+            if (node_ && RefCount::Decrement(node_->refs)) {
+                Destroy(node_);
+            }
+        }
+
+        Node* get() const {
+            return node_;
+        }
+
+        Node* operator->() const {
+            return node_;
+        }
+
+        explicit operator bool() const {
+            return node_ != nullptr;
+        }
+
+        void reset() {
+            NodePtr().swap(*this);
+        }
+
+        void swap(NodePtr& other) noexcept {
+            std::swap(node_, other.node_);
+        }
+
+    private:
+        Node* node_;
     };
 
     struct ValueNode : Node {
-        std::vector<T> value;
+        ValueNode() : Node(true) {
+        }
+
+        static void* operator new(size_t) {
+            return NodePool<sizeof(ValueNode), alignof(ValueNode)>::Allocate();
+        }
+
+        static void operator delete(void* memory) {
+            NodePool<sizeof(ValueNode), alignof(ValueNode)>::Release(memory);
+        }
+
+        InlineArray<T, kWidth> value;
     };
 
     struct PtrNode : Node {
-        std::vector<std::shared_ptr<Node>> children;
+        explicit PtrNode(bool is_relaxed = false) : Node(false, is_relaxed) {
+        }
+
+        static void* operator new(size_t) {
+            return NodePool<sizeof(PtrNode), alignof(PtrNode)>::Allocate();
+        }
+
+        static void operator delete(void* memory) {
+            NodePool<sizeof(PtrNode), alignof(PtrNode)>::Release(memory);
+        }
+
+        InlineArray<NodePtr, kWidth> children;
+    };
+
+    struct RelaxedNode : PtrNode {
+        RelaxedNode() : PtrNode(true) {
+        }
+
+        static void* operator new(size_t) {
+            return NodePool<sizeof(RelaxedNode), alignof(RelaxedNode)>::Allocate();
+        }
+
+        static void operator delete(void* memory) {
+            NodePool<sizeof(RelaxedNode), alignof(RelaxedNode)>::Release(memory);
+        }
+
+        // sizes[i] is the number of values in children 0..i
+        InlineArray<size_t, kWidth> sizes;
     };
 
-    std::shared_ptr<Node> root_;
+    static void Destroy(Node* node) {
+        if (node->leaf) {
+            delete static_cast<ValueNode*>(node);
+        } else if (node->relaxed) {
+            delete static_cast<RelaxedNode*>(node);
+        } else {
+            delete static_cast<PtrNode*>(node);
+        }
+    }
+
+    // the trie holds the first TailOffset() values, its root is shift_ bits above
+    // the leaves and is null while everything fits in the tail
+    NodePtr root_;
+    NodePtr tail_;
+    size_t shift_;
     size_t size_;
 
-    static size_t CountBits(size_t number, size_t left, size_t right) {
-        size_t result = 0;
-        for (; left < right; --right) {
-            size_t current = ((number >> (right - 1)) & 1);
-            result = result * 2 + current;
+    static PtrNode* AsPtr(Node* node) {
+        return static_cast<PtrNode*>(node);
+    }
+
+    static const PtrNode* AsPtr(const Node* node) {
+        return static_cast<const PtrNode*>(node);
+    }
+
+    static RelaxedNode* AsRelaxed(Node* node) {
+        return static_cast<RelaxedNode*>(node);
+    }
+
+    static const RelaxedNode* AsRelaxed(const Node* node) {
+        return static_cast<const RelaxedNode*>(node);
+    }
+
+    static ValueNode* AsValue(Node* node) {
+        return static_cast<ValueNode*>(node);
+    }
+
+    static const ValueNode* AsValue(const Node* node) {
+        return static_cast<const ValueNode*>(node);
+    }
+
+    static size_t Digit(size_t index, size_t shift) {
+        return (index >> shift) & kMask;
+    }
+
+    // walks kLevel levels down from node to the leaf holding index, every
+    // shift a constant
+    template <size_t kLevel>
+    static const ValueNode* DescendFrom(const Node* node, size_t index) {
+        if constexpr (kLevel == 0) {
+            return AsValue(node);
+        } else {
+            node = AsPtr(node)->children[(index >> (kLevel * kNumOfBits)) & kMask].get();
+            return DescendFrom<kLevel - 1>(node, index);
         }
-        return result;
     }
 
-    static std::shared_ptr<Node> CreateNodeWithValue(const T& value, size_t left) {
-        if (left == 0) {
-            ValueNode* result = new ValueNode;
-            result->value = std::vector<T>(kWidth, value);
-            return std::shared_ptr<Node>(result);
+    // picks the unrolled walk for a root levels above the leaves; shallow tries
+    // are tested first
+    template <size_t kLevel = 0>
+    static const ValueNode* Descend(const Node* node, size_t index, size_t levels) {
+        if constexpr (kLevel < kMaxLevels) {
+            if (levels != kLevel) {
+                return Descend<kLevel + 1>(node, index, levels);
+            }
         }
-        PtrNode* node = new PtrNode;
-        for (size_t i = 0; i < kWidth; ++i) {
-            node->children.push_back(CreateNodeWithValue(value, left - kNumOfBits));
+        return DescendFrom<kLevel>(node, index);
+    }
+
+    // elements held by a full node at shift
+    static size_t Capacity(size_t shift) {
+        return size_t{1} << (shift + kNumOfBits);
+    }
+
+    // sessions are never reused, so nodes of a finished session stay frozen
+    static uint64_t NewEdit() {
+        static std::atomic<uint64_t> last_edit{0};
+        return last_edit.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+
+    size_t TailOffset() const {
+        return tail_ ? size_ - AsValue(tail_.get())->value.size() : size_;
+    }
+
+    // the slot of the child of an inner node at shift that holds index, which
+    // becomes relative to that child; a relaxed node is searched from the
+    // radix guess, which is never past the answer
+    static size_t ChildSlot(const Node* node, size_t shift, size_t& index) {
+        size_t slot = index >> shift;
+        if (!node->relaxed) {
+            index -= slot << shift;
+            return slot;
+        }
+        const auto& sizes = AsRelaxed(node)->sizes;
+        while (sizes[slot] <= index) {
+            ++slot;
+        }
+        if (slot > 0) {
+            index -= sizes[slot - 1];
+        }
+        return slot;
+    }
+
+    // values under a node at shift, O(log n) for a balanced node
+    static size_t NodeSize(const Node* node, size_t shift) {
+        if (shift == 0) {
+            return AsValue(node)->value.size();
         }
-        return std::shared_ptr<Node>(node);
+        if (node->relaxed) {
+            return AsRelaxed(node)->sizes.back();
+        }
+        const auto& children = AsPtr(node)->children;
+        return ((children.size() - 1) << shift) + NodeSize(children.back().get(), shift - kNumOfBits);
     }
 
-    static std::shared_ptr<Node> CreateNodePartialWithValue(const T& value, size_t left,
-                                                            size_t number) {
-        size_t count_bits = CountBits(number, left, left + kNumOfBits);
-        if (left == 0) {
-            ValueNode* result = new ValueNode;
-            result->value = std::vector<T>(count_bits, value);
-            return std::shared_ptr<Node>(result);
+    // values under child slot of an inner node at shift
+    static size_t ChildSize(const Node* node, size_t shift, size_t slot) {
+        if (node->relaxed) {
+            const auto& sizes = AsRelaxed(node)->sizes;
+            return sizes[slot] - (slot > 0 ? sizes[slot - 1] : 0);
+        }
+        const auto& children = AsPtr(node)->children;
+        if (slot + 1 < children.size()) {
+            return Capacity(shift - kNumOfBits);
         }
+        return NodeSize(children[slot].get(), shift - kNumOfBits);
+    }
 
-        PtrNode* node = new PtrNode;
-        for (size_t i = 0; i < count_bits; ++i) {
-            node->children.push_back(CreateNodeWithValue(value, left - kNumOfBits));
+    // the leaf or the tail holding index, first is the index of its first value;
+    // relaxed levels are searched until the first balanced node, from which the
+    // walk is the unrolled radix one
+    const ValueNode* FindLeaf(size_t index, size_t& first) const {
+        size_t tail_offset = TailOffset();
+        if (index >= tail_offset) {
+            first = tail_offset;
+            return AsValue(tail_.get());
         }
+        const Node* node = root_.get();
+        size_t shift = shift_;
+        size_t rest = index;
+        while (shift > 0 && node->relaxed) {
+            node = AsPtr(node)->children[ChildSlot(node, shift, rest)].get();
+            shift -= kNumOfBits;
+        }
+        first = index - Digit(rest, 0);
+        return Descend(node, rest, shift / kNumOfBits);
+    }
 
-        node->children.push_back(CreateNodePartialWithValue(value, left - kNumOfBits, number));
-        return std::shared_ptr<Node>(node);
+    template <class Callback>
+    static void VisitLeaves(const Node* node, size_t shift, Callback& callback) {
+        if (shift == 0) {
+            const ValueNode* leaf = AsValue(node);
+            callback(std::span<const T>(leaf->value.begin(), leaf->value.size()));
+            return;
+        }
+        for (const NodePtr& child : AsPtr(node)->children) {
+            VisitLeaves(child.get(), shift - kNumOfBits, callback);
+        }
     }
-    static std::shared_ptr<Node> CreateNode(size_t left) {
-        if (left == 0) {
-            auto node = std::shared_ptr<Node>(new ValueNode);
-            dynamic_cast<ValueNode*>(node.get())->value.reserve(kWidth);
-            return node;
+
+    // a subtree at shift holding size values, a multiple of kWidth, made of
+    // full[k], the full subtree k levels above the leaves, shared wherever
+    // it fits
+    static NodePtr Fill(const std::vector<NodePtr>& full, size_t shift, size_t size) {
+        if (size == Capacity(shift)) {
+            return full[shift / kNumOfBits];
         }
         PtrNode* node = new PtrNode;
-        for (size_t i = 0; i < kWidth; ++i) {
-            node->children.push_back(CreateNode(left - kNumOfBits));
+        NodePtr result(node);
+        size_t child_size = Capacity(shift - kNumOfBits);
+        for (size_t i = 0; i < size / child_size; ++i) {
+            node->children.push_back(full[shift / kNumOfBits - 1]);
         }
-        return std::shared_ptr<Node>(node);
+        if (size % child_size != 0) {
+            node->children.push_back(Fill(full, shift - kNumOfBits, size % child_size));
+        }
+        return result;
     }
 
-    static std::shared_ptr<Node> CreateNodePartial(size_t left, size_t number) {
-        size_t count_bits = CountBits(number, left, left + kNumOfBits);
-        if (left == 0) {
-            auto node = std::shared_ptr<Node>(new ValueNode);
-            dynamic_cast<ValueNode*>(node.get())->value.reserve(count_bits);
-            return node;
+    // fills leaves with next(values), which appends one value or returns false
+    // at the end, then stacks full levels of parents on them: O(n) without
+    // knowing the count up front
+    template <class Next>
+    void Build(Next next) {
+        std::vector<NodePtr> level;
+        bool more = true;
+        while (more) {
+            ValueNode* leaf = new ValueNode;
+            NodePtr owner(leaf);
+            while (leaf->value.size() < kWidth && (more = next(leaf->value))) {
+            }
+            if (leaf->value.empty()) {
+                break;
+            }
+            size_ += leaf->value.size();
+            level.push_back(std::move(owner));
+        }
+        if (level.empty()) {
+            return;
+        }
+        tail_ = std::move(level.back());
+        level.pop_back();
+        if (level.empty()) {
+            return;
         }
 
+        while (level.size() > 1) {
+            std::vector<NodePtr> parents;
+            for (size_t i = 0; i < level.size(); i += kWidth) {
+                PtrNode* parent = new PtrNode;
+                parents.emplace_back(parent);
+                size_t end = std::min(level.size(), i + kWidth);
+                for (size_t j = i; j < end; ++j) {
+                    parent->children.push_back(std::move(level[j]));
+                }
+            }
+            level = std::move(parents);
+            shift_ += kNumOfBits;
+        }
+        root_ = std::move(level.front());
+    }
+
+    // the node in slot, replaced by an owned copy first unless edit owns it
+    static Node* Editable(NodePtr& slot, size_t shift, uint64_t edit) {
+        if (slot->edit == edit) {
+            return slot.get();
+        }
+        if (shift == 0) {
+            ValueNode* copy = new ValueNode;
+            NodePtr owner(copy);
+            copy->edit = edit;
+            copy->value = AsValue(slot.get())->value;
+            slot = std::move(owner);
+        } else if (slot->relaxed) {
+            RelaxedNode* copy = new RelaxedNode;
+            NodePtr owner(copy);
+            copy->edit = edit;
+            copy->children = AsRelaxed(slot.get())->children;
+            copy->sizes = AsRelaxed(slot.get())->sizes;
+            slot = std::move(owner);
+        } else {
+            PtrNode* copy = new PtrNode;
+            NodePtr owner(copy);
+            copy->edit = edit;
+            copy->children = AsPtr(slot.get())->children;
+            slot = std::move(owner);
+        }
+        return slot.get();
+    }
+
+    static NodePtr NewTail(const T& value, uint64_t edit) {
+        ValueNode* tail = new ValueNode;
+        NodePtr result(tail);
+        tail->edit = edit;
+        tail->value.push_back(value);
+        return result;
+    }
+
+    // a chain of single-child nodes from shift down to leaf
+    static NodePtr NewPath(size_t shift, NodePtr leaf, uint64_t edit) {
+        if (shift == 0) {
+            return leaf;
+        }
         PtrNode* node = new PtrNode;
-        for (size_t i = 0; i < count_bits; ++i) {
-            node->children.push_back(CreateNode(left - kNumOfBits));
+        NodePtr result(node);
+        node->edit = edit;
+        node->children.push_back(NewPath(shift - kNumOfBits, std::move(leaf), edit));
+        return result;
+    }
+
+    // the last leaf of the trie
+    NodePtr LastLeaf() const {
+        const NodePtr* node = &root_;
+        for (size_t shift = shift_; shift > 0; shift -= kNumOfBits) {
+            node = &AsPtr(node->get())->children.back();
+        }
+        return *node;
+    }
+
+    // values in the children before slot of an inner node at shift
+    static size_t ChildStart(const Node* node, size_t shift, size_t slot) {
+        if (node->relaxed) {
+            return slot > 0 ? AsRelaxed(node)->sizes[slot - 1] : 0;
+        }
+        return slot << shift;
+    }
+
+    // an inner node at shift over children holding sizes[i] values each,
+    // balanced whenever radix digits can index it
+    static NodePtr NewInner(size_t shift, std::span<NodePtr> children,
+                            std::span<const size_t> sizes, uint64_t edit) {
+        bool balanced = !children.back()->relaxed;
+        for (size_t i = 0; i + 1 < children.size(); ++i) {
+            balanced = balanced && sizes[i] == Capacity(shift - kNumOfBits);
+        }
+        if (balanced) {
+            PtrNode* node = new PtrNode;
+            NodePtr result(node);
+            node->edit = edit;
+            for (NodePtr& child : children) {
+                node->children.push_back(std::move(child));
+            }
+            return result;
+        }
+        RelaxedNode* node = new RelaxedNode;
+        NodePtr result(node);
+        node->edit = edit;
+        size_t total = 0;
+        for (size_t i = 0; i < children.size(); ++i) {
+            node->children.push_back(std::move(children[i]));
+            total += sizes[i];
+            node->sizes.push_back(total);
+        }
+        return result;
+    }
+
+    // replaces the balanced inner node in slot, holding size values, by a
+    // relaxed copy owned by edit
+    static void MakeRelaxed(NodePtr& slot, size_t shift, size_t size, uint64_t edit) {
+        RelaxedNode* copy = new RelaxedNode;
+        NodePtr owner(copy);
+        copy->edit = edit;
+        copy->children = AsPtr(slot.get())->children;
+        for (size_t i = 1; i < copy->children.size(); ++i) {
+            copy->sizes.push_back(i * Capacity(shift - kNumOfBits));
+        }
+        copy->sizes.push_back(size);
+        slot = std::move(owner);
+    }
+
+    void EditSet(size_t index, const T& value, uint64_t edit) {
+        size_t tail_offset = TailOffset();
+        NodePtr* slot = &tail_;
+        size_t rest = index - tail_offset;
+        if (index < tail_offset) {
+            slot = &root_;
+            rest = index;
+            for (size_t shift = shift_; shift > 0; shift -= kNumOfBits) {
+                PtrNode* node = AsPtr(Editable(*slot, shift, edit));
+                slot = &node->children[ChildSlot(node, shift, rest)];
+            }
+        }
+        AsValue(Editable(*slot, 0, edit))->value[rest] = value;
+    }
+
+    // applies the updates listed in [first, last), (index, position in
+    // updates) pairs sorted by index and all inside the subtree in slot at
+    // shift whose first value has index offset
+    template <class Order>
+    static void SetRun(NodePtr& slot, size_t shift, size_t offset,
+                       std::span<const std::pair<size_t, T>> updates, Order first, Order last,
+                       uint64_t edit) {
+        Node* node = Editable(slot, shift, edit);
+        if (shift == 0) {
+            for (; first != last; ++first) {
+                AsValue(node)->value[first->first - offset] = updates[first->second].second;
+            }
+            return;
+        }
+        while (first != last) {
+            size_t rest = first->first - offset;
+            size_t child = ChildSlot(node, shift, rest);
+            size_t child_end = offset + ChildStart(node, shift, child + 1);
+            Order run_end = std::partition_point(first, last, [&](const auto& update) {
+                return update.first < child_end;
+            });
+            SetRun(AsPtr(node)->children[child], shift - kNumOfBits, first->first - rest, updates,
+                   first, run_end, edit);
+            first = run_end;
         }
-        node->children.push_back(CreateNodePartial(left - kNumOfBits, number));
-        return std::shared_ptr<Node>(node);
     }
 
-    Vector(std::shared_ptr<Node> node, size_t size) : root_(node), size_(size) {
+    // the first subtree at shift under node, a root at root_shift; end is
+    // lowered to the values that subtree holds
+    static const Node* FirstAt(const Node* node, size_t root_shift, size_t shift, size_t& end) {
+        for (; root_shift > shift; root_shift -= kNumOfBits) {
+            end = std::min(end, ChildSize(node, root_shift, 0));
+            node = AsPtr(node)->children.front().get();
+        }
+        return node;
     }
 
-    static std::shared_ptr<Node> Change(std::shared_ptr<Node> node, size_t left, size_t number,
-                                        const T& value) {
-        size_t count_bits = CountBits(number, left, left + kNumOfBits);
-        if (left == 0) {
-            ValueNode* new_node = new ValueNode;
-            ValueNode* value_node = dynamic_cast<ValueNode*>(node.get());
-            new_node->value.reserve(value_node->value.size());
-            for (size_t i = 0; i < value_node->value.size(); ++i) {
-                if (i != count_bits) {
-                    new_node->value.push_back(value_node->value[i]);
-                } else {
-                    new_node->value.push_back(value);
+    // the differences in [offset, end) between subtrees at shift of before and
+    // after that both start at index offset and hold at least that range
+    template <class Callback>
+    static void DiffNodes(const Vector& before, const Vector& after, const Node* old_node,
+                          const Node* new_node, size_t shift, size_t offset, size_t end,
+                          Callback& callback) {
+        if (old_node == new_node) {
+            return;
+        }
+        if (shift == 0) {
+            const auto& old_values = AsValue(old_node)->value;
+            const auto& new_values = AsValue(new_node)->value;
+            for (size_t index = offset; index < end; ++index) {
+                if (!(old_values[index - offset] == new_values[index - offset])) {
+                    callback(index, &old_values[index - offset], &new_values[index - offset]);
                 }
             }
-            return std::shared_ptr<Node>(new_node);
+            return;
         }
-        PtrNode* new_node = new PtrNode;
-        PtrNode* ptr_node = dynamic_cast<PtrNode*>(node.get());
-        for (size_t i = 0; i < ptr_node->children.size(); ++i) {
-            if (i != count_bits) {
-                new_node->children.push_back(ptr_node->children[i]);
+        for (size_t slot = 0; offset + ChildStart(old_node, shift, slot) < end; ++slot) {
+            size_t from = offset + ChildStart(old_node, shift, slot);
+            size_t to = std::min(end, from + ChildSize(old_node, shift, slot));
+            size_t rest = from - offset;
+            size_t new_slot = ChildSlot(new_node, shift, rest);
+            if (rest == 0 && std::min(end, from + ChildSize(new_node, shift, new_slot)) == to) {
+                DiffNodes(before, after, AsPtr(old_node)->children[slot].get(),
+                          AsPtr(new_node)->children[new_slot].get(), shift - kNumOfBits, from, to,
+                          callback);
             } else {
-                new_node->children.push_back(
-                    Change(ptr_node->children[i], left - kNumOfBits, number, value));
+                DiffValues(before, after, from, to, callback);
             }
         }
-        return std::shared_ptr<Node>(new_node);
     }
 
-    static void AddValue(std::shared_ptr<Node> node, size_t left, size_t pos, const T& value) {
-        if (left == 0) {
-            dynamic_cast<ValueNode*>(node.get())->value.push_back(value);
+    // the differences in [from, to) found value by value
+    template <class Callback>
+    static void DiffValues(const Vector& before, const Vector& after, size_t from, size_t to,
+                           Callback& callback) {
+        size_t common = std::max(from, std::min({to, before.size_, after.size_}));
+        Iterator old_value(&before, from);
+        Iterator new_value(&after, from);
+        for (size_t index = from; index < common; ++index, ++old_value, ++new_value) {
+            if (!(*old_value == *new_value)) {
+                callback(index, &*old_value, &*new_value);
+            }
+        }
+        for (size_t index = common; index < to; ++index) {
+            callback(index, index < before.size_ ? &before.Get(index) : nullptr,
+                     index < after.size_ ? &after.Get(index) : nullptr);
+        }
+    }
+
+    void EditPushBack(const T& value, uint64_t edit) {
+        if (tail_ && AsValue(tail_.get())->value.size() < kWidth) {
+            AsValue(Editable(tail_, 0, edit))->value.push_back(value);
+            ++size_;
             return;
         }
-        size_t count_bits = CountBits(pos, left, left + kNumOfBits);
-        PtrNode* ptr_node = dynamic_cast<PtrNode*>(node.get());
-        if (ptr_node->children.size() == count_bits) {
-            if (left == kNumOfBits) {
-                ptr_node->children.emplace_back(new ValueNode);
-            } else {
-                ptr_node->children.emplace_back(new PtrNode);
+        if (tail_) {
+            PushTail(edit);
+        }
+        tail_ = NewTail(value, edit);
+        ++size_;
+    }
+
+    // moves the tail, full or not, behind the last leaf of the trie
+    void PushTail(uint64_t edit) {
+        size_t count = AsValue(tail_.get())->value.size();
+        size_t trie_size = size_ - count;
+        if (!root_) {
+            root_ = std::move(tail_);
+            return;
+        }
+        if (shift_ > 0 && AppendLeaf(root_, shift_, trie_size, tail_, count, edit)) {
+            return;
+        }
+        // no room left under the root, grow a new root on top
+        NodePtr children[] = {std::move(root_), NewPath(shift_, std::move(tail_), edit)};
+        size_t sizes[] = {trie_size, count};
+        shift_ += kNumOfBits;
+        root_ = NewInner(shift_, children, sizes, edit);
+    }
+
+    // appends leaf, holding count values, behind the last leaf under slot, an
+    // inner node at shift holding size values; returns false, leaving leaf
+    // alone, when that would take a node wider than kWidth
+    static bool AppendLeaf(NodePtr& slot, size_t shift, size_t size, NodePtr& leaf, size_t count,
+                           uint64_t edit) {
+        size_t last = AsPtr(slot.get())->children.size() - 1;
+        size_t last_size = size - ChildStart(slot.get(), shift, last);
+        if (shift > kNumOfBits) {
+            PtrNode* node = AsPtr(Editable(slot, shift, edit));
+            if (AppendLeaf(node->children[last], shift - kNumOfBits, last_size, leaf, count, edit)) {
+                if (node->relaxed) {
+                    AsRelaxed(node)->sizes[last] += count;
+                } else if (node->children[last]->relaxed) {
+                    MakeRelaxed(slot, shift, size + count, edit);
+                }
+                return true;
             }
-            AddValue(ptr_node->children[count_bits], left - kNumOfBits, pos, value);
+        }
+        if (last + 1 == kWidth) {
+            return false;
+        }
+        // a new last child keeps a balanced node balanced only behind a complete one
+        if (!slot->relaxed && last_size != Capacity(shift - kNumOfBits)) {
+            MakeRelaxed(slot, shift, size, edit);
+        }
+        PtrNode* node = AsPtr(Editable(slot, shift, edit));
+        node->children.push_back(NewPath(shift - kNumOfBits, std::move(leaf), edit));
+        if (node->relaxed) {
+            AsRelaxed(node)->sizes.push_back(size + count);
+        }
+        return true;
+    }
+
+    void EditPopBack(uint64_t edit) {
+        if (AsValue(tail_.get())->value.size() > 1) {
+            AsValue(Editable(tail_, 0, edit))->value.pop_back();
+            --size_;
+            return;
+        }
+        tail_.reset();
+        --size_;
+        if (root_) {
+            TakeLastLeaf(edit);
+        }
+    }
+
+    // moves the last leaf of the trie into the empty tail
+    void TakeLastLeaf(uint64_t edit) {
+        tail_ = LastLeaf();
+        size_t count = AsValue(tail_.get())->value.size();
+        if (TailOffset() == 0) {
+            root_.reset();
+            shift_ = 0;
             return;
         }
-        AddValue(dynamic_cast<PtrNode*>(node.get())->children[count_bits], left - kNumOfBits, pos,
-                 value);
-    }
-    static std::shared_ptr<Node> AddNewValue(std::shared_ptr<Node> node, size_t left, size_t pos,
-                                             const T& value) {
-        if (left == 0) {
-            ValueNode* value_node = new ValueNode;
-            value_node->value = dynamic_cast<ValueNode*>(node.get())->value;
-            value_node->value.push_back(value);
-            return std::shared_ptr<Node>(value_node);
-        }
-        size_t current_bits = CountBits(pos, left, left + kNumOfBits);
-        PtrNode* current_node = dynamic_cast<PtrNode*>(node.get());
-        PtrNode* ptr_node = new PtrNode;
-        ptr_node->children = current_node->children;
-        if (current_node->children.size() == current_bits) {
-            if (left == kNumOfBits) {
-                ptr_node->children.emplace_back(new ValueNode);
+        PopLeaf(root_, shift_, count, edit);
+        DropSingleChildRoots();
+    }
+
+    void DropSingleChildRoots() {
+        while (shift_ > 0 && AsPtr(root_.get())->children.size() == 1) {
+            NodePtr child = AsPtr(root_.get())->children.front();
+            root_ = std::move(child);
+            shift_ -= kNumOfBits;
+        }
+    }
+
+    // drops the last leaf, holding count values, below slot; returns true when
+    // the whole subtree would go, leaving slot for the caller to remove
+    static bool PopLeaf(NodePtr& slot, size_t shift, size_t count, uint64_t edit) {
+        if (HoldsOneLeaf(slot.get(), shift)) {
+            return true;
+        }
+        PtrNode* node = AsPtr(Editable(slot, shift, edit));
+        if (PopLeaf(node->children.back(), shift - kNumOfBits, count, edit)) {
+            node->children.pop_back();
+            if (node->relaxed) {
+                AsRelaxed(node)->sizes.pop_back();
+            }
+        } else if (node->relaxed) {
+            AsRelaxed(node)->sizes.back() -= count;
+        }
+        return false;
+    }
+
+    static bool HoldsOneLeaf(const Node* node, size_t shift) {
+        for (; shift > 0; shift -= kNumOfBits) {
+            if (AsPtr(node)->children.size() != 1) {
+                return false;
+            }
+            node = AsPtr(node)->children.front().get();
+        }
+        return true;
+    }
+
+    // the values [from, to) of the subtree in slot, which is at shift and holds
+    // size values; children inside the range are shared, the two at its ends
+    // are sliced in turn
+    static NodePtr SliceTrie(const NodePtr& slot, size_t shift, size_t from, size_t to, size_t size,
+                             uint64_t edit) {
+        if (from == 0 && to == size) {
+            return slot;
+        }
+        if (shift == 0) {
+            ValueNode* leaf = new ValueNode;
+            NodePtr result(leaf);
+            leaf->edit = edit;
+            const auto& values = AsValue(slot.get())->value;
+            for (size_t i = from; i < to; ++i) {
+                leaf->value.push_back(values[i]);
+            }
+            return result;
+        }
+
+        const Node* node = slot.get();
+        size_t count = AsPtr(node)->children.size();
+        size_t from_rest = from;
+        size_t to_rest = to - 1;
+        size_t first = ChildSlot(node, shift, from_rest);
+        size_t last = ChildSlot(node, shift, to_rest);
+        NodePtr children[kWidth];
+        size_t sizes[kWidth];
+        for (size_t i = first; i <= last; ++i) {
+            size_t start = ChildStart(node, shift, i);
+            size_t child_size = (i + 1 < count ? ChildStart(node, shift, i + 1) : size) - start;
+            size_t child_from = i == first ? from_rest : 0;
+            size_t child_to = i == last ? to_rest + 1 : child_size;
+            children[i - first] = SliceTrie(AsPtr(node)->children[i], shift - kNumOfBits,
+                                            child_from, child_to, child_size, edit);
+            sizes[i - first] = child_to - child_from;
+        }
+        size_t slots = last - first + 1;
+        return NewInner(shift, std::span(children, slots), std::span<const size_t>(sizes, slots),
+                        edit);
+    }
+
+    // joins the tries left, at left_shift, and right, at right_shift, into a
+    // node one level above the taller one holding one or two children; only
+    // the right edge of left and the left edge of right are rebuilt
+    static NodePtr Merge(const NodePtr& left, size_t left_shift, const NodePtr& right,
+                         size_t right_shift, uint64_t edit) {
+        if (left_shift > right_shift) {
+            NodePtr middle = Merge(AsPtr(left.get())->children.back(), left_shift - kNumOfBits,
+                                   right, right_shift, edit);
+            return Rebalance(left.get(), middle.get(), nullptr, left_shift, edit);
+        }
+        if (left_shift < right_shift) {
+            NodePtr middle = Merge(left, left_shift, AsPtr(right.get())->children.front(),
+                                   right_shift - kNumOfBits, edit);
+            return Rebalance(nullptr, middle.get(), right.get(), right_shift, edit);
+        }
+        if (left_shift == 0) {
+            NodePtr children[] = {left, right};
+            size_t sizes[] = {AsValue(left.get())->value.size(), AsValue(right.get())->value.size()};
+            return NewInner(kNumOfBits, children, sizes, edit);
+        }
+        NodePtr middle =
+            Merge(AsPtr(left.get())->children.back(), left_shift - kNumOfBits,
+                  AsPtr(right.get())->children.front(), right_shift - kNumOfBits, edit);
+        return Rebalance(left.get(), middle.get(), right.get(), left_shift, edit);
+    }
+
+    // repacks the children of left but its last, of middle and of right but
+    // its first, all three inner nodes at shift, as PlanMerge says, then puts
+    // them in one or two nodes at shift under a new node
+    static NodePtr Rebalance(const Node* left, const Node* middle, const Node* right, size_t shift,
+                             uint64_t edit) {
+        std::vector<NodePtr> items;
+        std::vector<size_t> sizes;
+        auto take = [&items, &sizes, shift](const Node* node, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                items.push_back(AsPtr(node)->children[i]);
+                sizes.push_back(ChildSize(node, shift, i));
+            }
+        };
+        if (left) {
+            take(left, 0, AsPtr(left)->children.size() - 1);
+        }
+        take(middle, 0, AsPtr(middle)->children.size());
+        if (right) {
+            take(right, 1, AsPtr(right)->children.size());
+        }
+
+        size_t child_shift = shift - kNumOfBits;
+        std::vector<size_t> units(items.size());
+        for (size_t i = 0; i < items.size(); ++i) {
+            units[i] = child_shift == 0 ? sizes[i] : AsPtr(items[i].get())->children.size();
+        }
+
+        // a node that already has its planned size is shared as it is
+        std::vector<NodePtr> packed;
+        std::vector<size_t> packed_sizes;
+        size_t item = 0;
+        size_t offset = 0;
+        for (size_t target : PlanMerge(units)) {
+            if (offset == 0 && units[item] == target) {
+                packed.push_back(std::move(items[item]));
+                packed_sizes.push_back(sizes[item]);
+                ++item;
+                continue;
+            }
+            if (child_shift == 0) {
+                ValueNode* leaf = new ValueNode;
+                packed.emplace_back(leaf);
+                leaf->edit = edit;
+                while (leaf->value.size() < target) {
+                    leaf->value.push_back(AsValue(items[item].get())->value[offset]);
+                    if (++offset == units[item]) {
+                        ++item;
+                        offset = 0;
+                    }
+                }
+                packed_sizes.push_back(target);
             } else {
-                ptr_node->children.emplace_back(new PtrNode);
+                NodePtr children[kWidth];
+                size_t child_sizes[kWidth];
+                size_t total = 0;
+                for (size_t i = 0; i < target; ++i) {
+                    const Node* source = items[item].get();
+                    children[i] = AsPtr(source)->children[offset];
+                    child_sizes[i] = ChildSize(source, child_shift, offset);
+                    total += child_sizes[i];
+                    if (++offset == units[item]) {
+                        ++item;
+                        offset = 0;
+                    }
+                }
+                packed.push_back(NewInner(child_shift, std::span(children, target),
+                                          std::span<const size_t>(child_sizes, target), edit));
+                packed_sizes.push_back(total);
+            }
+        }
+
+        NodePtr halves[2];
+        size_t half_sizes[2] = {0, 0};
+        size_t split = std::min(packed.size(), kWidth);
+        size_t count = split < packed.size() ? 2 : 1;
+        for (size_t half = 0; half < count; ++half) {
+            size_t begin = half == 0 ? 0 : split;
+            size_t end = half == 0 ? split : packed.size();
+            for (size_t i = begin; i < end; ++i) {
+                half_sizes[half] += packed_sizes[i];
             }
-            AddValue(ptr_node->children[current_bits], left - kNumOfBits, pos, value);
-            return std::shared_ptr<Node>(ptr_node);
+            halves[half] =
+                NewInner(shift, std::span(packed.data() + begin, end - begin),
+                         std::span<const size_t>(packed_sizes.data() + begin, end - begin), edit);
         }
-        ptr_node->children.back() =
-            AddNewValue(ptr_node->children.back(), left - kNumOfBits, pos, value);
-        return std::shared_ptr<Node>(ptr_node);
+        return NewInner(shift + kNumOfBits, std::span(halves, count),
+                        std::span<const size_t>(half_sizes, count), edit);
+    }
+
+    static size_t Threads(size_t threads) {
+        return threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency());
     }
-    static std::shared_ptr<Node> PopValue(std::shared_ptr<Node> node, size_t left, size_t pos) {
-        if (left == 0) {
-            ValueNode* value_node = dynamic_cast<ValueNode*>(node.get());
-            if (value_node->value.size() == 1 && pos != 0) {
-                return nullptr;
+
+    static size_t Runs(size_t parts, size_t threads) {
+        return std::min(parts, Threads(threads));
+    }
+
+    // the nodes of the first trie level with kPartsPerThread nodes per thread,
+    // or the leaves, in index order; returns their shift
+    size_t SplitTrie(std::vector<const Node*>& parts, size_t threads) const {
+        size_t wanted = kPartsPerThread * Threads(threads);
+        parts.assign(1, root_.get());
+        size_t shift = shift_;
+        while (shift > 0 && parts.size() < wanted) {
+            std::vector<const Node*> children;
+            for (const Node* part : parts) {
+                for (const NodePtr& child : AsPtr(part)->children) {
+                    children.push_back(child.get());
+                }
             }
-            ValueNode* new_node = new ValueNode;
-            for (size_t i = 0; i + 1 < value_node->value.size(); ++i) {
-                new_node->value.push_back(value_node->value[i]);
+            parts = std::move(children);
+            shift -= kNumOfBits;
+        }
+        return shift;
+    }
+
+    // calls task(run, begin, end) for runs contiguous, even runs of count
+    // items, the first on this thread and the others on std::async tasks
+    template <class Task>
+    static void RunSplit(size_t count, size_t runs, Task task) {
+        std::vector<std::future<void>> forked;
+        for (size_t run = 1; run < runs; ++run) {
+            forked.push_back(std::async(std::launch::async, [&task, run, runs, count] {
+                task(run, count * run / runs, count * (run + 1) / runs);
+            }));
+        }
+        task(0, 0, count / runs);
+        for (auto& future : forked) {
+            future.get();
+        }
+    }
+
+    // the leaf kernel of Reduce, a plain loop over contiguous values that the
+    // compiler can vectorize for simple operations
+    template <class U, class BinaryOp>
+    static void ReduceChunk(std::optional<U>& acc, std::span<const T> values, BinaryOp& op) {
+        auto it = values.begin();
+        if (!acc) {
+            acc.emplace(*it);
+            ++it;
+        }
+        U local = std::move(*acc);
+        for (; it != values.end(); ++it) {
+            local = op(std::move(local), *it);
+        }
+        *acc = std::move(local);
+    }
+
+    // an empty inner node of Vector<U> of the same kind as node, with its size
+    // table if it is relaxed
+    template <class U>
+    static typename Vector<U, RefCount, Width>::NodePtr NewLike(const Node* node) {
+        using Result = Vector<U, RefCount, Width>;
+        if (node->relaxed) {
+            auto* copy = new typename Result::RelaxedNode;
+            typename Result::NodePtr owner(copy);
+            copy->sizes = AsRelaxed(node)->sizes;
+            return owner;
+        }
+        return typename Result::NodePtr(new typename Result::PtrNode);
+    }
+
+    // the subtree at shift with func applied to every value
+    template <class U, class Func>
+    static typename Vector<U, RefCount, Width>::NodePtr MapNode(const Node* node, size_t shift,
+                                                                 Func& func) {
+        using Result = Vector<U, RefCount, Width>;
+        if (shift == 0) {
+            auto* leaf = new typename Result::ValueNode;
+            typename Result::NodePtr owner(leaf);
+            for (const T& value : AsValue(node)->value) {
+                leaf->value.push_back(func(value));
             }
-            return std::shared_ptr<Node>(new_node);
+            return owner;
+        }
+        auto owner = NewLike<U>(node);
+        auto& children = Result::AsPtr(owner.get())->children;
+        for (const NodePtr& child : AsPtr(node)->children) {
+            children.push_back(MapNode<U>(child.get(), shift - kNumOfBits, func));
         }
-        PtrNode* ptr_node = dynamic_cast<PtrNode*>(node.get());
-        PtrNode* new_node = new PtrNode;
-        new_node->children = ptr_node->children;
-        new_node->children.back() = PopValue(new_node->children.back(), left - kNumOfBits, pos);
-        if (new_node->children.back() == nullptr) {
-            if (new_node->children.size() == 1) {
-                delete new_node;
-                return nullptr;
+        return owner;
+    }
+
+    // the levels above the mapped subtrees at part_shift, taking them in order
+    template <class U>
+    static typename Vector<U, RefCount, Width>::NodePtr MapTop(
+        const Node* node, size_t shift, size_t part_shift,
+        std::vector<typename Vector<U, RefCount, Width>::NodePtr>& mapped, size_t& next) {
+        if (shift == part_shift) {
+            return std::move(mapped[next++]);
+        }
+        auto owner = NewLike<U>(node);
+        auto& children = Vector<U, RefCount, Width>::AsPtr(owner.get())->children;
+        for (const NodePtr& child : AsPtr(node)->children) {
+            children.push_back(MapTop<U>(child.get(), shift - kNumOfBits, part_shift, mapped, next));
+        }
+        return owner;
+    }
+
+    static Vector ConcatPieces(const std::vector<std::optional<Vector>>& pieces, size_t begin,
+                               size_t end) {
+        if (end - begin == 1) {
+            return *pieces[begin];
+        }
+        size_t middle = begin + (end - begin) / 2;
+        return Concat(ConcatPieces(pieces, begin, middle), ConcatPieces(pieces, middle, end));
+    }
+
+    // The sizes, in values for leaves and in children otherwise, of the nodes
+    // that repack nodes of the given sizes. Going left to right, a node that is
+    // not full is spread over the nodes after it until no more than
+    // kExtraNodes nodes above the minimum remain, which bounds how far the
+    // search in a relaxed node walks past its radix guess.
+    static std::vector<size_t> PlanMerge(std::vector<size_t> plan) {
+        size_t total = std::accumulate(plan.begin(), plan.end(), size_t{0});
+        size_t minimum = (total + kWidth - 1) / kWidth;
+        size_t count = plan.size();
+        size_t i = 0;
+        while (count > minimum + kExtraNodes) {
+            while (plan[i] == kWidth) {
+                ++i;
+            }
+            size_t remaining = plan[i];
+            do {
+                size_t merged = std::min(remaining + plan[i + 1], kWidth);
+                remaining = remaining + plan[i + 1] - merged;
+                plan[i] = merged;
+                ++i;
+            } while (remaining > 0);
+            // node i was emptied into the ones before it
+            for (size_t j = i; j + 1 < count; ++j) {
+                plan[j] = plan[j + 1];
             }
-            new_node->children.pop_back();
+            --count;
+            --i;
         }
-        return std::shared_ptr<Node>(new_node);
+        plan.resize(count);
+        return plan;
     }
 };
 
 template <class Iterator>
 Vector(Iterator, Iterator) -> Vector<std::iter_value_t<Iterator>>;
+
+// Mutable editor over a Vector for batches of updates. It changes the nodes it
+// created itself in place and copies a shared node only the first time it is
+// touched, so k updates cost about k value writes rather than k path copies.
+// Persistent() hands out the current state in O(1) and starts a new session,
+// after which the returned Vector is never modified.
+template <class T, class RefCount, size_t Width>
+class TransientVector {
+public:
+    explicit TransientVector(const Vector<T, RefCount, Width>& vector)
+        : vector_(vector), edit_(Vector<T, RefCount, Width>::NewEdit()) {
+    }
+
+    TransientVector(const TransientVector&) = delete;
+    TransientVector& operator=(const TransientVector&) = delete;
+
+    const T& Get(size_t index) const {
+        return vector_.Get(index);
+    }
+
+    void Set(size_t index, const T& value) {
+        vector_.EditSet(index, value, edit_);
+    }
+
+    void PushBack(const T& value) {
+        vector_.EditPushBack(value, edit_);
+    }
+
+    void PopBack() {
+        vector_.EditPopBack(edit_);
+    }
+
+    size_t Size() const {
+        return vector_.size_;
+    }
+
+    Vector<T, RefCount, Width> Persistent() {
+        edit_ = Vector<T, RefCount, Width>::NewEdit();
+        return Vector<T, RefCount, Width>(vector_);
+    }
+
+private:
+    Vector<T, RefCount, Width> vector_;
+    uint64_t edit_;
+};
@@ -0,0 +1,1015 @@
+#include "main.cpp"
+#include "hamt_map.h"
+#include "vector_store.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <numeric>
+#include <optional>
+#include <span>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+void fail(const char *message) {
+    std::cerr << "Fail:\n";
+    std::cerr << message << "\n";
+    std::cout << "-1 bad output\n"; // to get WA
+    exit(0);
+}
+
+namespace internal_tests {
+
+// xorshift, so every run replays the same operation sequences
+struct Random {
+    uint64_t state;
+
+    uint64_t Next() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    }
+
+    size_t Below(size_t bound) {
+        return bound == 0 ? 0 : Next() % bound;
+    }
+};
+
+/* compares every way of reading a vector
+ * against the expected values */
+template <size_t Width>
+void check_equal(const Vector<int, refcount::Atomic, Width>& vector,
+                 const std::vector<int>& expected) {
+    if (vector.Size() != expected.size())
+        fail("incorrect Size");
+    for (size_t i = 0; i < expected.size(); ++i) {
+        if (vector.Get(i) != expected[i])
+            fail("incorrect Get");
+    }
+    size_t index = 0;
+    for (int value : vector) {
+        if (index >= expected.size() || value != expected[index])
+            fail("incorrect iteration");
+        ++index;
+    }
+    if (index != expected.size() || vector.End() - vector.Begin() != static_cast<ptrdiff_t>(index))
+        fail("incorrect iteration length");
+    if (!expected.empty()) {
+        auto it = vector.End();
+        for (size_t i = expected.size(); i-- > 0;) {
+            if (*--it != expected[i])
+                fail("incorrect reverse iteration");
+        }
+        size_t middle = expected.size() / 2;
+        if (vector.Begin()[middle] != expected[middle] || *(vector.End() - 1) != expected.back())
+            fail("incorrect iterator arithmetic");
+    }
+    std::vector<int> chunks;
+    vector.ForEachChunk([&chunks](std::span<const int> chunk) {
+        if (chunk.empty() || chunk.size() > Width)
+            fail("incorrect ForEachChunk chunk size");
+        chunks.insert(chunks.end(), chunk.begin(), chunk.end());
+    });
+    if (chunks != expected)
+        fail("incorrect ForEachChunk");
+}
+
+/* values with their own heap memory: nodes must be
+ * destroyed through their real type, or the sanitizers
+ * report the strings leaked */
+void check_value_types() {
+    std::cerr << "check value types... ";
+    using V = Vector<std::string, refcount::Atomic, 4>;
+    std::optional<V> vector(std::in_place);
+    std::vector<std::string> expected;
+    for (int i = 0; i < 200; ++i) {
+        std::string value(40, static_cast<char>('a' + i % 26));
+        vector.emplace(vector->PushBack(value));
+        expected.push_back(value);
+    }
+    V snapshot(*vector);
+    for (size_t i = 0; i < expected.size(); i += 7) {
+        vector.emplace(vector->Set(i, std::to_string(i)));
+        expected[i] = std::to_string(i);
+    }
+    for (int i = 0; i < 50; ++i) {
+        vector.emplace(vector->PopBack());
+        expected.pop_back();
+    }
+    if (vector->Size() != expected.size())
+        fail("incorrect Size of a string vector");
+    for (size_t i = 0; i < expected.size(); ++i) {
+        if (vector->Get(i) != expected[i])
+            fail("incorrect Get of a string vector");
+    }
+    if (snapshot.Size() != 200 || snapshot.Get(7) != std::string(40, 'h'))
+        fail("string vector update changed an old version");
+    std::cerr << "ok!\n";
+}
+
+/* the trie grows a level when it is full and drops
+ * a level when its root is left with one child */
+template <size_t Width>
+void check_depth_for() {
+    using V = Vector<int, refcount::Atomic, Width>;
+    size_t limit = std::max<size_t>(Width * Width * Width, 1024);
+    for (size_t size = Width; size <= limit; size *= Width) {
+        for (size_t count : {size - 1, size, size + 1, size + Width + 1}) {
+            std::vector<int> values(count);
+            std::iota(values.begin(), values.end(), 0);
+            V vector(values.begin(), values.end());
+            check_equal(vector, values);
+            std::optional<V> resized(std::in_place, vector);
+            for (size_t i = 0; i < 2 * Width + 2 && !values.empty(); ++i) {
+                resized.emplace(resized->PopBack());
+                values.pop_back();
+            }
+            check_equal(*resized, values);
+            for (size_t i = 0; i < 4 * Width + 4; ++i) {
+                resized.emplace(resized->PushBack(-1));
+                values.push_back(-1);
+            }
+            check_equal(*resized, values);
+        }
+    }
+}
+
+void check_depth() {
+    std::cerr << "check depth... ";
+    check_depth_for<2>();
+    check_depth_for<4>();
+    check_depth_for<32>();
+    std::cerr << "ok!\n";
+}
+
+/* the tail takes the last 1..Width values: check the
+ * sizes around every boundary where it moves to the trie */
+template <size_t Width>
+void check_tail_for() {
+    using V = Vector<int, refcount::Atomic, Width>;
+    std::optional<V> vector(std::in_place);
+    std::vector<int> expected;
+    for (int i = 0; i < static_cast<int>(Width * Width * 3 + 5); ++i) {
+        vector.emplace(vector->PushBack(i));
+        expected.push_back(i);
+        check_equal(*vector, expected);
+    }
+    while (!expected.empty()) {
+        vector.emplace(vector->PopBack());
+        expected.pop_back();
+        check_equal(*vector, expected);
+    }
+}
+
+void check_tail() {
+    std::cerr << "check tail... ";
+    check_tail_for<2>();
+    check_tail_for<4>();
+    check_tail_for<32>();
+    std::cerr << "ok!\n";
+}
+
+/* the Plain policy in one thread, and Atomic versions
+ * copied and dropped by several threads at once */
+void check_refcount() {
+    std::cerr << "check refcount... ";
+    {
+        using V = Vector<std::string, refcount::Plain, 4>;
+        std::optional<V> vector(std::in_place);
+        std::vector<V> versions;
+        for (int i = 0; i < 300; ++i) {
+            vector.emplace(vector->PushBack(std::to_string(i)));
+            if (i % 10 == 0) {
+                versions.push_back(*vector);
+            }
+        }
+        for (size_t i = 0; i < versions.size(); ++i) {
+            if (versions[i].Size() != 10 * i + 1 || versions[i].Get(10 * i) != std::to_string(10 * i))
+                fail("incorrect version with Plain refcounts");
+        }
+    }
+
+    using V = Vector<int>;
+    std::vector<int> values(5000);
+    std::iota(values.begin(), values.end(), 0);
+    V shared(values.begin(), values.end());
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < 4; ++t) {
+        threads.emplace_back([&shared, t] {
+            for (size_t i = 0; i < 200; ++i) {
+                size_t index = (t * 1237 + i * 31) % shared.Size();
+                V copy = shared.Set(index, -1).PushBack(-2);
+                if (copy.Get(index) != -1 || copy.Get(shared.Size()) != -2)
+                    fail("incorrect update of a shared vector");
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    check_equal(shared, values);
+    std::cerr << "ok!\n";
+}
+
+/* nodes freed by a thread other than the one that
+ * allocated them, also after that thread exited */
+void check_pool() {
+    std::cerr << "check node pool... ";
+    using V = Vector<std::string, refcount::Atomic, 4>;
+    std::optional<V> built;
+    std::thread([&built] {
+        std::optional<V> vector(std::in_place);
+        for (int i = 0; i < 2000; ++i) {
+            vector.emplace(vector->PushBack(std::to_string(i)));
+        }
+        built.emplace(*vector);
+    }).join();
+    for (int i = 0; i < 2000; ++i) {
+        if (built->Get(i) != std::to_string(i))
+            fail("incorrect vector built by an exited thread");
+    }
+
+    std::optional<V> edited(std::in_place, *built);
+    for (size_t i = 0; i < 2000; i += 3) {
+        edited.emplace(edited->Set(i, "x"));
+    }
+    built.reset();
+    std::thread([&edited] { edited.reset(); }).join();
+
+    // the blocks released above are handed out again
+    std::optional<V> vector(std::in_place);
+    for (int i = 0; i < 2000; ++i) {
+        vector.emplace(vector->PushBack(std::to_string(-i)));
+    }
+    for (int i = 0; i < 2000; ++i) {
+        if (vector->Get(i) != std::to_string(-i))
+            fail("incorrect vector built from reused blocks");
+    }
+    std::cerr << "ok!\n";
+}
+
+template <size_t Width>
+void check_width_for() {
+    using V = Vector<int, refcount::Atomic, Width>;
+    for (size_t count : {size_t{0}, size_t{1}, Width - 1, Width, Width * Width + 1, size_t{5000}}) {
+        std::vector<int> values(count);
+        std::iota(values.begin(), values.end(), 0);
+        V vector(values.begin(), values.end());
+        check_equal(vector, values);
+        if (count > 0) {
+            values[count / 2] = -1;
+            check_equal(vector.Set(count / 2, -1), values);
+        }
+    }
+}
+
+void check_widths() {
+    std::cerr << "check widths... ";
+    check_width_for<2>();
+    check_width_for<8>();
+    check_width_for<16>();
+    check_width_for<64>();
+    check_width_for<128>();
+    std::cerr << "ok!\n";
+}
+
+/* the iterator is random access for the standard algorithms */
+void check_iterator() {
+    std::cerr << "check iterator... ";
+    using V = Vector<int, refcount::Atomic, 4>;
+    static_assert(std::random_access_iterator<V::Iterator>);
+    std::vector<int> values(1000);
+    for (size_t i = 0; i < values.size(); ++i) {
+        values[i] = 2 * static_cast<int>(i);
+    }
+    V vector(values.begin(), values.end());
+    for (int probe = -1; probe <= 2001; probe += 3) {
+        auto it = std::lower_bound(vector.begin(), vector.end(), probe);
+        auto expected = std::lower_bound(values.begin(), values.end(), probe);
+        if (it - vector.begin() != expected - values.begin())
+            fail("incorrect lower_bound over the iterator");
+    }
+    std::vector<int> reversed(std::make_reverse_iterator(vector.end()),
+                              std::make_reverse_iterator(vector.begin()));
+    if (!std::equal(reversed.begin(), reversed.end(), values.rbegin(), values.rend()))
+        fail("incorrect reverse_iterator over the iterator");
+    std::cerr << "ok!\n";
+}
+
+/* the fill constructor shares one full subtree per level:
+ * writing through one reference must not show up in the others */
+template <size_t Width>
+void check_fill_for() {
+    using V = Vector<int, refcount::Atomic, Width>;
+    for (size_t count : {size_t{0}, size_t{1}, Width, Width + 1, Width * Width, Width * Width + 1,
+                         Width * Width * Width + 7}) {
+        V vector(count, 7);
+        std::vector<int> expected(count, 7);
+        check_equal(vector, expected);
+        if (count == 0) {
+            continue;
+        }
+        std::optional<V> edited(std::in_place, vector);
+        for (size_t index : {size_t{0}, count / 3, count / 2, count - 1}) {
+            edited.emplace(edited->Set(index, static_cast<int>(index)));
+            expected[index] = static_cast<int>(index);
+        }
+        edited.emplace(edited->PushBack(8));
+        expected.push_back(8);
+        check_equal(*edited, expected);
+        check_equal(vector, std::vector<int>(count, 7));
+    }
+}
+
+void check_fill() {
+    std::cerr << "check fill... ";
+    check_fill_for<2>();
+    check_fill_for<4>();
+    check_fill_for<32>();
+    std::cerr << "ok!\n";
+}
+
+/* Diff reports exactly the indices whose values differ,
+ * with null on the side where the index is past the end */
+template <size_t Width>
+void check_diff_between(const Vector<int, refcount::Atomic, Width>& before,
+                        const std::vector<int>& before_values,
+                        const Vector<int, refcount::Atomic, Width>& after,
+                        const std::vector<int>& after_values) {
+    size_t end = std::max(before_values.size(), after_values.size());
+    std::vector<size_t> expected;
+    for (size_t i = 0; i < end; ++i) {
+        if (i >= before_values.size() || i >= after_values.size() ||
+            before_values[i] != after_values[i]) {
+            expected.push_back(i);
+        }
+    }
+    std::vector<size_t> reported;
+    Vector<int, refcount::Atomic, Width>::Diff(
+        before, after, [&](size_t index, const int* old_value, const int* new_value) {
+            if (!reported.empty() && index <= reported.back())
+                fail("Diff out of order");
+            reported.push_back(index);
+            if ((old_value == nullptr) != (index >= before_values.size()) ||
+                (new_value == nullptr) != (index >= after_values.size()))
+                fail("incorrect Diff null past the end");
+            if (old_value && *old_value != before_values[index])
+                fail("incorrect Diff before value");
+            if (new_value && *new_value != after_values[index])
+                fail("incorrect Diff after value");
+        });
+    if (reported != expected)
+        fail("incorrect Diff indices");
+}
+
+/* concatenating many small pieces makes relaxed nodes
+ * at every level, slicing them cuts through the relaxed
+ * size tables */
+template <size_t Width>
+void check_relaxed_for() {
+    using V = Vector<int, refcount::Atomic, Width>;
+    Random random{Width};
+    std::optional<V> vector(std::in_place);
+    std::vector<int> expected;
+    while (expected.size() < 40 * Width * Width) {
+        size_t count = 1 + random.Below(Width + Width / 2);
+        std::vector<int> piece(count);
+        std::iota(piece.begin(), piece.end(), static_cast<int>(expected.size()));
+        vector.emplace(V::Concat(*vector, V(piece.begin(), piece.end())));
+        expected.insert(expected.end(), piece.begin(), piece.end());
+    }
+    check_equal(*vector, expected);
+    for (int i = 0; i < 40; ++i) {
+        size_t a = random.Below(expected.size() + 1);
+        size_t b = random.Below(expected.size() + 1);
+        V slice = vector->Slice(std::min(a, b), std::max(a, b));
+        check_equal(slice, std::vector<int>(expected.begin() + std::min(a, b),
+                                            expected.begin() + std::max(a, b)));
+        V joined = V::Concat(slice, *vector);
+        std::vector<int> joined_expected(expected.begin() + std::min(a, b),
+                                         expected.begin() + std::max(a, b));
+        joined_expected.insert(joined_expected.end(), expected.begin(), expected.end());
+        check_equal(joined, joined_expected);
+    }
+    for (int i = 0; i < 40; ++i) {
+        size_t index = random.Below(expected.size());
+        vector.emplace(vector->Set(index, -i));
+        expected[index] = -i;
+    }
+    check_equal(*vector, expected);
+}
+
+void check_relaxed() {
+    std::cerr << "check relaxed nodes... ";
+    check_relaxed_for<2>();
+    check_relaxed_for<4>();
+    check_relaxed_for<32>();
+    std::cerr << "ok!\n";
+}
+
+/* random persistent edits on a pool of versions, every
+ * version checked after each edit: an edit must leave
+ * the version it started from as it was */
+template <size_t Width>
+void check_random_edits_for(uint64_t seed) {
+    using V = Vector<int, refcount::Atomic, Width>;
+    Random random{seed};
+    std::vector<std::optional<V>> versions;
+    std::vector<std::vector<int>> expected;
+    versions.emplace_back(std::in_place);
+    expected.emplace_back();
+    int next_value = 0;
+
+    for (int step = 0; step < 600; ++step) {
+        size_t from = random.Below(versions.size());
+        const V& vector = *versions[from];
+        std::vector<int> values = expected[from];
+        std::optional<V> result;
+        switch (random.Below(9)) {
+            case 0: {
+                size_t count = 1 + random.Below(3 * Width);
+                result.emplace(vector);
+                for (size_t i = 0; i < count; ++i) {
+                    result.emplace(result->PushBack(next_value));
+                    values.push_back(next_value++);
+                }
+                break;
+            }
+            case 1:
+                if (values.empty()) {
+                    continue;
+                }
+                result.emplace(vector.PopBack());
+                values.pop_back();
+                break;
+            case 2: {
+                if (values.empty()) {
+                    continue;
+                }
+                size_t index = random.Below(values.size());
+                result.emplace(vector.Set(index, next_value));
+                values[index] = next_value++;
+                break;
+            }
+            case 3: {
+                size_t other = random.Below(versions.size());
+                result.emplace(V::Concat(vector, *versions[other]));
+                values.insert(values.end(), expected[other].begin(), expected[other].end());
+                break;
+            }
+            case 4: {
+                size_t a = random.Below(values.size() + 1);
+                size_t b = random.Below(values.size() + 1);
+                result.emplace(vector.Slice(std::min(a, b), std::max(a, b)));
+                values = std::vector<int>(values.begin() + std::min(a, b),
+                                          values.begin() + std::max(a, b));
+                break;
+            }
+            case 5: {
+                size_t index = random.Below(values.size() + 1);
+                result.emplace(vector.Insert(index, next_value));
+                values.insert(values.begin() + index, next_value++);
+                break;
+            }
+            case 6: {
+                if (values.empty()) {
+                    continue;
+                }
+                size_t index = random.Below(values.size());
+                result.emplace(vector.Erase(index));
+                values.erase(values.begin() + index);
+                break;
+            }
+            case 7: {
+                auto transient = vector.Transient();
+                size_t count = 1 + random.Below(4 * Width);
+                for (size_t i = 0; i < count; ++i) {
+                    size_t op = random.Below(3);
+                    if (op == 0 || values.empty()) {
+                        transient.PushBack(next_value);
+                        values.push_back(next_value++);
+                    } else if (op == 1) {
+                        transient.PopBack();
+                        values.pop_back();
+                    } else {
+                        size_t index = random.Below(values.size());
+                        transient.Set(index, next_value);
+                        values[index] = next_value++;
+                    }
+                    if (transient.Size() != values.size() ||
+                        (!values.empty() && transient.Get(values.size() - 1) != values.back()))
+                        fail("incorrect transient");
+                }
+                result.emplace(transient.Persistent());
+                // the session after Persistent() must not write into the result
+                transient.PushBack(-1);
+                if (!values.empty()) {
+                    transient.Set(0, -1);
+                }
+                break;
+            }
+            case 8: {
+                std::vector<std::pair<size_t, int>> updates;
+                size_t count = values.empty() ? 0 : random.Below(2 * Width);
+                for (size_t i = 0; i < count; ++i) {
+                    size_t index = random.Below(values.size());
+                    updates.emplace_back(index, next_value);
+                    values[index] = next_value++;
+                }
+                result.emplace(vector.SetMany(updates));
+                break;
+            }
+        }
+        check_equal(*result, values);
+        check_equal(*versions[from], expected[from]);
+        check_diff_between(*versions[from], expected[from], *result, values);
+        if (versions.size() < 16) {
+            versions.push_back(std::move(result));
+            expected.push_back(std::move(values));
+        } else {
+            size_t slot = random.Below(versions.size());
+            versions[slot].emplace(*result);
+            expected[slot] = std::move(values);
+        }
+    }
+    for (size_t i = 0; i < versions.size(); ++i) {
+        check_equal(*versions[i], expected[i]);
+    }
+}
+
+void check_random_edits() {
+    std::cerr << "check random edits... ";
+    for (uint64_t seed = 1; seed <= 6; ++seed) {
+        check_random_edits_for<2>(seed);
+        check_random_edits_for<4>(seed);
+        check_random_edits_for<32>(seed);
+    }
+    std::cerr << "ok!\n";
+}
+
+template <size_t Width>
+void check_parallel_for(size_t count) {
+    using V = Vector<int, refcount::Atomic, Width>;
+    std::vector<int> values(count);
+    std::iota(values.begin(), values.end(), 0);
+    // a relaxed vector too, so the split also cuts relaxed nodes
+    V balanced(values.begin(), values.end());
+    V relaxed = V::Concat(balanced.Slice(count / 3, count), balanced.Slice(0, count / 3));
+    std::vector<int> rotated(values.begin() + count / 3, values.end());
+    rotated.insert(rotated.end(), values.begin(), values.begin() + count / 3);
+
+    for (size_t threads : {size_t{1}, size_t{3}, size_t{8}}) {
+        for (const auto& [vector, expected] : {std::pair{&balanced, &values},
+                                               std::pair{&relaxed, &rotated}}) {
+            int64_t sum = vector->Reduce(int64_t{0}, [](int64_t acc, int64_t value) {
+                return acc + value;
+            }, threads);
+            if (sum != std::accumulate(expected->begin(), expected->end(), int64_t{0}))
+                fail("incorrect Reduce");
+
+            auto mapped = vector->Map([](int value) { return std::to_string(value); }, threads);
+            if (mapped.Size() != expected->size())
+                fail("incorrect Map size");
+            for (size_t i = 0; i < expected->size(); ++i) {
+                if (mapped.Get(i) != std::to_string((*expected)[i]))
+                    fail("incorrect Map");
+            }
+
+            V filtered = vector->Filter([](int value) { return value % 3 != 1; }, threads);
+            std::vector<int> kept;
+            for (int value : *expected) {
+                if (value % 3 != 1) {
+                    kept.push_back(value);
+                }
+            }
+            check_equal(filtered, kept);
+            kept.push_back(-1);
+            check_equal(filtered.PushBack(-1), kept);
+        }
+    }
+}
+
+void check_parallel() {
+    std::cerr << "check parallel... ";
+    for (size_t count : {size_t{0}, size_t{1}, size_t{5}, size_t{100}, size_t{5000}}) {
+        check_parallel_for<2>(count);
+        check_parallel_for<4>(count);
+        check_parallel_for<32>(count);
+    }
+    std::cerr << "ok!\n";
+}
+
+template <size_t Width>
+void check_diff_for() {
+    using V = Vector<int, refcount::Atomic, Width>;
+    Random random{Width * 7};
+    std::vector<int> values(Width * Width * Width + 3);
+    std::iota(values.begin(), values.end(), 0);
+    V base(values.begin(), values.end());
+
+    check_diff_between(base, values, base, values);
+    check_diff_between(V(), {}, base, values);
+    check_diff_between(base, values, V(), {});
+
+    for (int round = 0; round < 30; ++round) {
+        std::optional<V> after(std::in_place, base);
+        std::vector<int> after_values = values;
+        size_t edits = random.Below(6);
+        for (size_t i = 0; i < edits; ++i) {
+            size_t index = random.Below(after_values.size());
+            after.emplace(after->Set(index, -1 - static_cast<int>(i)));
+            after_values[index] = -1 - static_cast<int>(i);
+        }
+        // setting a value to what it was is not a change
+        after.emplace(after->Set(0, after_values[0]));
+        size_t cut = random.Below(after_values.size() + 1);
+        V shorter = after->Slice(0, cut);
+        std::vector<int> shorter_values(after_values.begin(), after_values.begin() + cut);
+        V longer = after->PushBack(100).PushBack(101);
+        std::vector<int> longer_values = after_values;
+        longer_values.push_back(100);
+        longer_values.push_back(101);
+
+        check_diff_between(base, values, *after, after_values);
+        check_diff_between(*after, after_values, base, values);
+        check_diff_between(base, values, shorter, shorter_values);
+        check_diff_between(shorter, shorter_values, base, values);
+        check_diff_between(base, values, longer, longer_values);
+        check_diff_between(longer, longer_values, shorter, shorter_values);
+        // moved node boundaries: the values are compared one by one
+        if (cut < values.size()) {
+            V shifted = V::Concat(base.Slice(0, cut), base.Slice(cut + 1, values.size()));
+            std::vector<int> shifted_values = values;
+            shifted_values.erase(shifted_values.begin() + cut);
+            check_diff_between(base, values, shifted, shifted_values);
+        }
+    }
+}
+
+void check_diff() {
+    std::cerr << "check diff... ";
+    check_diff_for<2>();
+    check_diff_for<4>();
+    check_diff_for<32>();
+    std::cerr << "ok!\n";
+}
+
+template <class View>
+void check_view(const View& view, const std::vector<int>& expected) {
+    if (view.Size() != expected.size())
+        fail("incorrect stored Size");
+    for (size_t i = 0; i < expected.size(); ++i) {
+        if (view.Get(i) != expected[i])
+            fail("incorrect stored Get");
+    }
+    std::vector<int> chunks;
+    view.ForEachChunk([&chunks](std::span<const int> chunk) {
+        chunks.insert(chunks.end(), chunk.begin(), chunk.end());
+    });
+    if (chunks != expected)
+        fail("incorrect stored ForEachChunk");
+}
+
+/* versions saved, compacted and read back
+ * by a store opened again on the same files */
+void check_store() {
+    std::cerr << "check store... ";
+    using V = Vector<int, refcount::Atomic, 4>;
+    using Store = VectorStore<int, refcount::Atomic, 4>;
+    std::string path = (std::filesystem::temp_directory_path() / "vector_store_test.bin").string();
+    auto remove_files = [&path] {
+        for (const char* suffix : {"", ".versions", ".compact", ".versions.compact"}) {
+            std::filesystem::remove(path + suffix);
+        }
+    };
+    remove_files();
+
+    Random random{99};
+    std::vector<std::vector<int>> expected;
+    {
+        Store store(path);
+        if (store.Versions() != 0)
+            fail("new store is not empty");
+        std::optional<V> vector(std::in_place);
+        std::vector<int> values;
+        for (int i = 0; i < 12; ++i) {
+            // relaxed nodes too, they are stored with their size tables
+            size_t count = 1 + random.Below(50);
+            std::vector<int> piece(count);
+            std::iota(piece.begin(), piece.end(), static_cast<int>(values.size()));
+            vector.emplace(V::Concat(*vector, V(piece.begin(), piece.end())));
+            values.insert(values.end(), piece.begin(), piece.end());
+            size_t index = random.Below(values.size());
+            vector.emplace(vector->Set(index, -i));
+            values[index] = -i;
+            if (store.Save(*vector) != expected.size())
+                fail("incorrect Save version number");
+            expected.push_back(values);
+        }
+        for (size_t i = 0; i < expected.size(); ++i) {
+            check_view(store.Version(i), expected[i]);
+            check_equal(store.Load(i), expected[i]);
+        }
+        // a save after a load appends to the version loaded
+        V loaded = store.Load(3);
+        std::vector<int> values3 = expected[3];
+        values3[0] = 1000;
+        store.Save(loaded.Set(0, 1000));
+        expected.push_back(values3);
+        check_view(store.Version(expected.size() - 1), values3);
+    }
+    {
+        Store store(path);
+        if (store.Versions() != expected.size())
+            fail("incorrect Versions after reopen");
+        for (size_t i = 0; i < expected.size(); ++i) {
+            check_view(store.Version(i), expected[i]);
+        }
+        std::vector<size_t> keep = {12, 0, 7};
+        store.Compact(keep);
+        std::vector<std::vector<int>> kept = {expected[12], expected[0], expected[7]};
+        expected = kept;
+        if (store.Versions() != 3)
+            fail("incorrect Versions after Compact");
+        for (size_t i = 0; i < expected.size(); ++i) {
+            check_view(store.Version(i), expected[i]);
+        }
+        // the compacted store is saved to as before
+        store.Save(store.Load(1).PushBack(5));
+        expected.push_back(expected[1]);
+        expected.back().push_back(5);
+    }
+    {
+        Store store(path);
+        if (store.Versions() != expected.size())
+            fail("incorrect Versions after reopening a compacted store");
+        for (size_t i = 0; i < expected.size(); ++i) {
+            check_view(store.Version(i), expected[i]);
+        }
+        store.Compact({});
+        if (store.Versions() != 0)
+            fail("incorrect Versions after compacting to nothing");
+        store.Save(V{1, 2, 3});
+    }
+    {
+        Store store(path);
+        if (store.Versions() != 1)
+            fail("incorrect Versions after reopening an emptied store");
+        check_view(store.Version(0), {1, 2, 3});
+    }
+    remove_files();
+    std::cerr << "ok!\n";
+}
+
+/* a crash leaves .compact files behind: before the node
+ * file rename they are thrown away, after it the index
+ * is renamed into place */
+void check_store_recovery() {
+    std::cerr << "check store recovery... ";
+    using V = Vector<int, refcount::Atomic, 4>;
+    using Store = VectorStore<int, refcount::Atomic, 4>;
+    std::string path =
+        (std::filesystem::temp_directory_path() / "vector_store_recovery_test.bin").string();
+    std::string versions_path = path + ".versions";
+    auto remove_files = [&] {
+        for (const char* suffix : {"", ".versions", ".compact", ".versions.compact"}) {
+            std::filesystem::remove(path + suffix);
+        }
+    };
+    remove_files();
+    std::vector<std::vector<int>> expected;
+    {
+        Store store(path);
+        std::optional<V> vector(std::in_place);
+        for (int i = 0; i < 5; ++i) {
+            std::vector<int> values(20 * (i + 1));
+            std::iota(values.begin(), values.end(), i);
+            vector.emplace(values.begin(), values.end());
+            store.Save(*vector);
+            expected.push_back(values);
+        }
+    }
+    auto copy = [](const std::string& from, const std::string& to) {
+        std::filesystem::copy_file(from, to, std::filesystem::copy_options::overwrite_existing);
+    };
+
+    // crash before the commit point: both compacted files are left over
+    copy(path, path + ".compact");
+    copy(versions_path, versions_path + ".compact");
+    {
+        std::ofstream(path + ".compact", std::ios::app) << "torn";
+        Store store(path);
+        if (store.Versions() != expected.size())
+            fail("incorrect Versions after an interrupted compaction");
+        for (size_t i = 0; i < expected.size(); ++i) {
+            check_view(store.Version(i), expected[i]);
+        }
+    }
+    if (std::filesystem::exists(path + ".compact") ||
+        std::filesystem::exists(versions_path + ".compact"))
+        fail("compacted files left after recovery");
+
+    // crash after the commit point: the node file is compacted, the index
+    // still the old one next to the compacted one
+    copy(versions_path, versions_path + ".old");
+    {
+        Store store(path);
+        std::vector<size_t> keep = {4, 1};
+        store.Compact(keep);
+    }
+    std::filesystem::rename(versions_path, versions_path + ".compact");
+    std::filesystem::rename(versions_path + ".old", versions_path);
+    {
+        Store store(path);
+        if (store.Versions() != 2)
+            fail("incorrect Versions after finishing a compaction");
+        check_view(store.Version(0), expected[4]);
+        check_view(store.Version(1), expected[1]);
+    }
+    if (std::filesystem::exists(versions_path + ".compact"))
+        fail("compacted index left after recovery");
+    remove_files();
+    std::cerr << "ok!\n";
+}
+
+// every key in one collision node
+struct ConstantHash {
+    size_t operator()(int) const {
+        return 42;
+    }
+};
+
+// three hashes that agree on all but the top digit, so every pair of keys
+// with different hashes is merged down twelve levels of one-child nodes, and
+// keys with equal hashes end up in collision nodes under them
+struct TopBitsHash {
+    size_t operator()(int key) const {
+        return static_cast<size_t>(key % 3) << 60;
+    }
+};
+
+template <class Map>
+void check_map_equal(const Map& map, const std::unordered_map<int, int>& expected, int key_range) {
+    if (map.Size() != expected.size() || map.Empty() != expected.empty())
+        fail("incorrect HamtMap Size");
+    for (int key = -1; key <= key_range; ++key) {
+        const int* value = map.Find(key);
+        auto it = expected.find(key);
+        if ((value == nullptr) != (it == expected.end()) || map.Contains(key) != (value != nullptr))
+            fail("incorrect HamtMap Find");
+        if (value && *value != it->second)
+            fail("incorrect HamtMap value");
+    }
+    std::unordered_map<int, int> seen;
+    for (const auto& [key, value] : map) {
+        auto it = expected.find(key);
+        if (it == expected.end() || it->second != value)
+            fail("HamtMap iteration gives an entry not in the map");
+        if (!seen.emplace(key, value).second)
+            fail("HamtMap iteration gives an entry twice");
+    }
+    if (seen.size() != expected.size())
+        fail("HamtMap iteration misses entries");
+}
+
+/* random Set and Erase, persistent and through transients,
+ * on a pool of versions: an update must leave the version
+ * it started from as it was */
+template <class Hash>
+void check_hamt_for(uint64_t seed, int key_range) {
+    using Map = HamtMap<int, int, Hash>;
+    Random random{seed};
+    std::vector<std::optional<Map>> versions;
+    std::vector<std::unordered_map<int, int>> expected;
+    versions.emplace_back(std::in_place);
+    expected.emplace_back();
+    int next_value = 0;
+
+    for (int step = 0; step < 400; ++step) {
+        size_t from = random.Below(versions.size());
+        const Map& map = *versions[from];
+        std::unordered_map<int, int> values = expected[from];
+        std::optional<Map> result;
+        switch (random.Below(4)) {
+            case 0: {
+                int key = static_cast<int>(random.Below(key_range));
+                result.emplace(map.Set(key, next_value));
+                values[key] = next_value++;
+                break;
+            }
+            case 1: {
+                int key = static_cast<int>(random.Below(key_range));
+                result.emplace(map.Erase(key));
+                if (!values.erase(key) && !map.Empty() && !(result->Begin() == map.Begin()))
+                    fail("Erase of a missing key copied the map");
+                break;
+            }
+            case 2: {
+                auto transient = map.Transient();
+                size_t count = 1 + random.Below(3 * key_range);
+                for (size_t i = 0; i < count; ++i) {
+                    int key = static_cast<int>(random.Below(key_range));
+                    if (random.Below(3) == 0) {
+                        transient.Erase(key);
+                        values.erase(key);
+                    } else {
+                        transient.Set(key, next_value);
+                        values[key] = next_value++;
+                    }
+                    const int* value = transient.Find(key);
+                    if (transient.Size() != values.size() ||
+                        (value == nullptr) != !values.count(key) || (value && *value != values[key]))
+                        fail("incorrect transient HamtMap");
+                }
+                result.emplace(transient.Persistent());
+                // the session after Persistent() must not write into the result
+                transient.Set(0, -1);
+                transient.Erase(1);
+                break;
+            }
+            case 3: {
+                // a bulk build, later pairs winning
+                std::vector<std::pair<int, int>> pairs;
+                values.clear();
+                size_t count = random.Below(2 * key_range);
+                for (size_t i = 0; i < count; ++i) {
+                    int key = static_cast<int>(random.Below(key_range));
+                    pairs.emplace_back(key, next_value);
+                    values[key] = next_value++;
+                }
+                result.emplace(pairs.begin(), pairs.end());
+                break;
+            }
+        }
+        check_map_equal(*result, values, key_range);
+        check_map_equal(*versions[from], expected[from], key_range);
+        if (versions.size() < 12) {
+            versions.push_back(std::move(result));
+            expected.push_back(std::move(values));
+        } else {
+            size_t slot = random.Below(versions.size());
+            versions[slot].emplace(*result);
+            expected[slot] = std::move(values);
+        }
+    }
+    for (size_t i = 0; i < versions.size(); ++i) {
+        check_map_equal(*versions[i], expected[i], key_range);
+    }
+}
+
+void check_hamt() {
+    std::cerr << "check hamt map... ";
+    for (uint64_t seed = 1; seed <= 4; ++seed) {
+        check_hamt_for<std::hash<int>>(seed, 20);
+        check_hamt_for<std::hash<int>>(seed, 500);
+        check_hamt_for<ConstantHash>(seed, 12);
+        check_hamt_for<TopBitsHash>(seed, 30);
+    }
+    // erasing down to nothing and building again, all in collision nodes
+    std::optional<HamtMap<int, int, TopBitsHash>> map(std::in_place);
+    std::unordered_map<int, int> expected;
+    for (int key = 0; key < 9; ++key) {
+        map.emplace(map->Set(key, key));
+        expected[key] = key;
+    }
+    check_map_equal(*map, expected, 9);
+    for (int key = 0; key < 9; ++key) {
+        map.emplace(map->Erase(key));
+        expected.erase(key);
+        check_map_equal(*map, expected, 9);
+    }
+    map.emplace(map->Set(4, 4));
+    check_map_equal(*map, {{4, 4}}, 9);
+    std::cerr << "ok!\n";
+}
+
+void run_all() {
+    check_value_types();
+    check_depth();
+    check_tail();
+    check_refcount();
+    check_pool();
+    check_widths();
+    check_iterator();
+    check_fill();
+    check_relaxed();
+    check_random_edits();
+    check_parallel();
+    check_diff();
+    check_store();
+    check_store_recovery();
+    check_hamt();
+}
+}
+
+int main() {
+    internal_tests::run_all();
+    return 0;
+}
@@ -0,0 +1,713 @@
+#pragma once
+
+#include "main.cpp"
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <type_traits>
+#include <unistd.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Versions of a Vector of trivially copyable values kept in an append-only
+// file. A node is written once and referenced by its file offset, so versions
+// share nodes on disk as they do in memory, and saving a version a few updates
+// away from the last one saved appends only the paths those updates copied.
+// A version is a root recorded in a small index file next to the nodes. Reads
+// go straight to an mmap of the node file, with no parsing and no copy.
+//
+// path holds the nodes and path + ".versions" the index. A save appends its
+// nodes and syncs them before it appends its version record, so a crash loses
+// at most the save in progress; its unreferenced nodes are cut off on open.
+// Compact() rewrites both files with only the versions asked for, and renames
+// them over the old ones. A store is used from one thread at a time.
+
+namespace vector_store_internal {
+
+struct FileHeader {
+    char magic[8];
+    uint64_t value_size;
+    uint64_t width;
+    uint64_t reserved;
+};
+
+// root and tail are node offsets, 0 for none; end is the length of the node
+// file once the version was written
+struct VersionRecord {
+    uint64_t root;
+    uint64_t tail;
+    uint64_t shift;
+    uint64_t size;
+    uint64_t end;
+};
+
+// every node starts 8-byte aligned with a header, followed by count values
+// for a leaf, or by count child offsets for an inner node, and for a relaxed
+// one by count cumulative sizes after those
+struct NodeHeader {
+    uint32_t kind;
+    uint32_t count;
+};
+
+enum NodeKind : uint32_t { kLeaf, kBalanced, kRelaxed };
+
+constexpr char kNodesMagic[8] = {'I', 'V', 'N', 'O', 'D', 'E', 'S', '1'};
+constexpr char kVersionsMagic[8] = {'I', 'V', 'V', 'E', 'R', 'S', '1', '\0'};
+
+inline size_t Align(size_t bytes) {
+    return (bytes + 7) & ~size_t{7};
+}
+
+inline void WriteAt(int fd, const void* data, size_t bytes, uint64_t offset,
+                    const std::string& path) {
+    const char* next = static_cast<const char*>(data);
+    while (bytes > 0) {
+        ssize_t written = pwrite(fd, next, bytes, static_cast<off_t>(offset));
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            throw std::runtime_error("cannot write " + path);
+        }
+        next += written;
+        bytes -= static_cast<size_t>(written);
+        offset += static_cast<uint64_t>(written);
+    }
+}
+
+inline void ReadAt(int fd, void* data, size_t bytes, uint64_t offset, const std::string& path) {
+    char* next = static_cast<char*>(data);
+    while (bytes > 0) {
+        ssize_t read = pread(fd, next, bytes, static_cast<off_t>(offset));
+        if (read < 0 && errno == EINTR) {
+            continue;
+        }
+        if (read <= 0) {
+            throw std::runtime_error("cannot read " + path);
+        }
+        next += read;
+        bytes -= static_cast<size_t>(read);
+        offset += static_cast<uint64_t>(read);
+    }
+}
+
+inline void Sync(int fd, const std::string& path) {
+    if (fdatasync(fd) != 0) {
+        throw std::runtime_error("cannot sync " + path);
+    }
+}
+
+// makes the renames in the directory holding path durable
+inline void SyncDirectory(const std::string& path) {
+    size_t slash = path.rfind('/');
+    std::string directory = slash == std::string::npos ? "." : path.substr(0, slash + 1);
+    int fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        throw std::runtime_error("cannot sync " + directory);
+    }
+    int result = fsync(fd);
+    close(fd);
+    if (result != 0) {
+        throw std::runtime_error("cannot sync " + directory);
+    }
+}
+
+inline bool Exists(const std::string& path) {
+    return access(path.c_str(), F_OK) == 0;
+}
+
+// buffered writes to a file from offset on
+class Appender {
+public:
+    static constexpr size_t kFlushBytes = size_t{1} << 20;
+
+    Appender(int fd, uint64_t offset, const std::string& path)
+        : fd_(fd), offset_(offset), path_(path) {
+    }
+
+    // where the next Append lands in the file
+    uint64_t Offset() const {
+        return offset_ + buffer_.size();
+    }
+
+    // room for bytes more, zeroed
+    char* Append(size_t bytes) {
+        if (buffer_.size() + bytes > kFlushBytes) {
+            Flush();
+        }
+        buffer_.resize(buffer_.size() + bytes);
+        return buffer_.data() + buffer_.size() - bytes;
+    }
+
+    void Flush() {
+        WriteAt(fd_, buffer_.data(), buffer_.size(), offset_, path_);
+        offset_ += buffer_.size();
+        buffer_.clear();
+    }
+
+private:
+    int fd_;
+    uint64_t offset_;
+    const std::string& path_;
+    std::vector<char> buffer_;
+};
+}
+
+template <class T, class RefCount = refcount::Atomic, size_t Width = 32>
+class VectorStore {
+    static_assert(std::is_trivially_copyable_v<T>, "only trivially copyable values can be stored");
+    static_assert(alignof(T) <= 8, "values would be misaligned after a node header");
+
+    using Stored = Vector<T, RefCount, Width>;
+    using Node = typename Stored::Node;
+    using NodePtr = typename Stored::NodePtr;
+    using ValueNode = typename Stored::ValueNode;
+    using PtrNode = typename Stored::PtrNode;
+    using RelaxedNode = typename Stored::RelaxedNode;
+    using FileHeader = vector_store_internal::FileHeader;
+    using VersionRecord = vector_store_internal::VersionRecord;
+    using NodeHeader = vector_store_internal::NodeHeader;
+
+public:
+    // A version read in place from the mapped file. It stays valid as long as
+    // the store, Compact() aside; the spans ForEachChunk hands out only until
+    // the next Save().
+    class View {
+        friend class VectorStore;
+
+    public:
+        const T& Get(size_t index) const {
+            size_t tail_offset = record_.size - store_->Header(record_.tail)->count;
+            if (index >= tail_offset) {
+                return store_->Values(record_.tail)[index - tail_offset];
+            }
+            uint64_t offset = record_.root;
+            for (size_t shift = record_.shift; shift > 0; shift -= Stored::kNumOfBits) {
+                const NodeHeader* header = store_->Header(offset);
+                const uint64_t* children = store_->Children(offset);
+                size_t slot = index >> shift;
+                if (header->kind == vector_store_internal::kRelaxed) {
+                    const uint64_t* sizes = children + header->count;
+                    while (sizes[slot] <= index) {
+                        ++slot;
+                    }
+                    index -= slot > 0 ? sizes[slot - 1] : 0;
+                } else {
+                    index -= slot << shift;
+                }
+                offset = children[slot];
+            }
+            return store_->Values(offset)[index];
+        }
+
+        size_t Size() const {
+            return record_.size;
+        }
+
+        // calls callback(std::span<const T>) on every leaf in index order
+        template <class Callback>
+        void ForEachChunk(Callback callback) const {
+            if (record_.root) {
+                store_->VisitLeaves(record_.root, record_.shift, callback);
+            }
+            if (record_.tail) {
+                callback(std::span<const T>(store_->Values(record_.tail),
+                                            store_->Header(record_.tail)->count));
+            }
+        }
+
+    private:
+        View(const VectorStore* store, const VersionRecord& record)
+            : store_(store), record_(record) {
+        }
+
+        const VectorStore* store_;
+        VersionRecord record_;
+    };
+
+    // opens the store at path, creating it if there is none, and finishes or
+    // undoes a compaction a crash interrupted
+    explicit VectorStore(std::string path)
+        : path_(std::move(path)), nodes_fd_(-1), versions_fd_(-1), size_(0), mapping_(nullptr),
+          mapping_size_(0), saves_(0) {
+        Recover();
+        Open();
+    }
+
+    VectorStore(const VectorStore&) = delete;
+    VectorStore& operator=(const VectorStore&) = delete;
+
+    ~VectorStore() {
+        Close();
+    }
+
+    size_t Versions() const {
+        return versions_.size();
+    }
+
+    View Version(size_t version) const {
+        return View(this, versions_.at(version));
+    }
+
+    // writes the nodes of vector the file does not hold yet and records it as
+    // the next version. Nodes are recognized across saves only against the
+    // last version saved or loaded, so saves of one line of versions append
+    // O(changes * log n) bytes; anything else is written whole
+    size_t Save(const Stored& vector) {
+        vector_store_internal::Appender out(nodes_fd_, size_, path_);
+        VersionRecord record{};
+        ++saves_;
+        try {
+            if (vector.root_) {
+                record.root = Write(vector.root_.get(), vector.shift_, out);
+            }
+            if (vector.tail_) {
+                record.tail = Write(vector.tail_.get(), 0, out);
+            }
+            record.shift = vector.shift_;
+            record.size = vector.size_;
+            out.Flush();
+            vector_store_internal::Sync(nodes_fd_, path_);
+            record.end = out.Offset();
+            AppendVersion(record);
+        } catch (...) {
+            // offsets_ may name nodes that never made it to the file
+            offsets_.clear();
+            last_.reset();
+            throw;
+        }
+        size_ = record.end;
+        Remap();
+
+        if (last_) {
+            Forget(last_->root_.get(), last_->shift_);
+            Forget(last_->tail_.get(), 0);
+        }
+        last_.emplace(vector);
+        return versions_.size() - 1;
+    }
+
+    // the version rebuilt in memory for further updates, O(n); nodes shared
+    // on disk stay shared, and the next Save() appends only what changes
+    Stored Load(size_t version) {
+        const VersionRecord& record = versions_.at(version);
+        std::unordered_map<uint64_t, NodePtr> loaded;
+        Stored result;
+        if (record.root) {
+            result.root_ = Read(record.root, record.shift, loaded);
+        }
+        if (record.tail) {
+            result.tail_ = Read(record.tail, 0, loaded);
+        }
+        result.shift_ = record.shift;
+        result.size_ = record.size;
+
+        offsets_.clear();
+        for (const auto& [offset, node] : loaded) {
+            offsets_.emplace(node.get(), Written{offset, saves_});
+        }
+        last_.emplace(result);
+        return result;
+    }
+
+    // rewrites the store with only the listed versions, renumbered 0, 1, ...
+    // in the order given, and only the nodes they reach; views taken before
+    // are invalid afterwards
+    void Compact(std::span<const size_t> keep) {
+        std::vector<VersionRecord> kept;
+        for (size_t version : keep) {
+            kept.push_back(versions_.at(version));
+        }
+        std::string nodes_path = path_ + ".compact";
+        std::string versions_path = VersionsPath() + ".compact";
+        WriteFile(nodes_path, vector_store_internal::kNodesMagic,
+                  [&](vector_store_internal::Appender& out) {
+                      std::unordered_map<uint64_t, uint64_t> moved;
+                      for (VersionRecord& record : kept) {
+                          if (record.root) {
+                              record.root = Copy(record.root, record.shift, out, moved);
+                          }
+                          if (record.tail) {
+                              record.tail = Copy(record.tail, 0, out, moved);
+                          }
+                          record.end = out.Offset();
+                      }
+                  });
+        WriteFile(versions_path, vector_store_internal::kVersionsMagic,
+                  [&](vector_store_internal::Appender& out) {
+                      if (!kept.empty()) {
+                          std::memcpy(out.Append(kept.size() * sizeof(VersionRecord)),
+                                      kept.data(), kept.size() * sizeof(VersionRecord));
+                      }
+                  });
+
+        // the node file rename is the commit point, see Recover(); it is made
+        // durable before the index follows it. The old files stay open until
+        // the new ones are, so a failure keeps the store readable as it was,
+        // and once the commit point is passed the next open finishes the job
+        if (std::rename(nodes_path.c_str(), path_.c_str()) != 0) {
+            std::remove(nodes_path.c_str());
+            std::remove(versions_path.c_str());
+            throw std::runtime_error("cannot replace " + path_);
+        }
+        vector_store_internal::SyncDirectory(path_);
+        if (std::rename(versions_path.c_str(), VersionsPath().c_str()) != 0) {
+            throw std::runtime_error("cannot replace " + VersionsPath());
+        }
+        vector_store_internal::SyncDirectory(path_);
+        Open();
+        offsets_.clear();
+        last_.reset();
+    }
+
+private:
+    std::string VersionsPath() const {
+        return path_ + ".versions";
+    }
+
+    // a crash after the compacted node file was renamed into place leaves
+    // only the compacted index to rename; before that, the old files stand
+    void Recover() {
+        std::string nodes_path = path_ + ".compact";
+        std::string versions_path = VersionsPath() + ".compact";
+        if (vector_store_internal::Exists(versions_path) &&
+            !vector_store_internal::Exists(nodes_path)) {
+            if (std::rename(versions_path.c_str(), VersionsPath().c_str()) != 0) {
+                throw std::runtime_error("cannot replace " + VersionsPath());
+            }
+            vector_store_internal::SyncDirectory(path_);
+            return;
+        }
+        std::remove(nodes_path.c_str());
+        std::remove(versions_path.c_str());
+    }
+
+    // opens the files at path_ and only then closes the ones open before
+    void Open() {
+        int nodes_fd = OpenFile(path_, vector_store_internal::kNodesMagic);
+        int versions_fd;
+        try {
+            versions_fd = OpenFile(VersionsPath(), vector_store_internal::kVersionsMagic);
+        } catch (...) {
+            close(nodes_fd);
+            throw;
+        }
+        Close();
+        nodes_fd_ = nodes_fd;
+        versions_fd_ = versions_fd;
+
+        // a record cut short by a crash is dropped
+        size_t bytes = FileSize(versions_fd_, VersionsPath()) - sizeof(FileHeader);
+        versions_.resize(bytes / sizeof(VersionRecord));
+        vector_store_internal::ReadAt(versions_fd_, versions_.data(),
+                                      versions_.size() * sizeof(VersionRecord),
+                                      sizeof(FileHeader), VersionsPath());
+        size_t versions_end = sizeof(FileHeader) + versions_.size() * sizeof(VersionRecord);
+        if (versions_end < sizeof(FileHeader) + bytes &&
+            ftruncate(versions_fd_, static_cast<off_t>(versions_end)) != 0) {
+            throw std::runtime_error("cannot write " + VersionsPath());
+        }
+
+        // so are the nodes of a save that never got its record
+        size_ = sizeof(FileHeader);
+        for (const VersionRecord& record : versions_) {
+            size_ = std::max<size_t>(size_, record.end);
+        }
+        if (size_ > FileSize(nodes_fd_, path_)) {
+            throw std::runtime_error("bad vector store file " + path_);
+        }
+        if (size_ < FileSize(nodes_fd_, path_) && ftruncate(nodes_fd_, static_cast<off_t>(size_)) != 0) {
+            throw std::runtime_error("cannot write " + path_);
+        }
+        Remap();
+    }
+
+    void Close() {
+        if (mapping_) {
+            munmap(mapping_, mapping_size_);
+            mapping_ = nullptr;
+            mapping_size_ = 0;
+        }
+        if (nodes_fd_ >= 0) {
+            close(nodes_fd_);
+            nodes_fd_ = -1;
+        }
+        if (versions_fd_ >= 0) {
+            close(versions_fd_);
+            versions_fd_ = -1;
+        }
+    }
+
+    // opens or creates one of the two files and checks its header
+    int OpenFile(const std::string& path, const char (&magic)[8]) const {
+        int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0) {
+            throw std::runtime_error("cannot open " + path);
+        }
+        try {
+            if (FileSize(fd, path) == 0) {
+                FileHeader header = NewHeader(magic);
+                vector_store_internal::WriteAt(fd, &header, sizeof(header), 0, path);
+                vector_store_internal::Sync(fd, path);
+            }
+            FileHeader header;
+            if (FileSize(fd, path) < sizeof(header)) {
+                throw std::runtime_error("bad vector store file " + path);
+            }
+            vector_store_internal::ReadAt(fd, &header, sizeof(header), 0, path);
+            if (std::memcmp(header.magic, magic, sizeof(header.magic)) != 0 ||
+                header.value_size != sizeof(T) || header.width != Width) {
+                throw std::runtime_error("bad vector store file " + path);
+            }
+        } catch (...) {
+            close(fd);
+            throw;
+        }
+        return fd;
+    }
+
+    static size_t FileSize(int fd, const std::string& path) {
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            throw std::runtime_error("cannot open " + path);
+        }
+        return static_cast<size_t>(info.st_size);
+    }
+
+    static FileHeader NewHeader(const char (&magic)[8]) {
+        FileHeader header{};
+        std::memcpy(header.magic, magic, sizeof(header.magic));
+        header.value_size = sizeof(T);
+        header.width = Width;
+        return header;
+    }
+
+    // writes a new file at path, its header and then what fill appends, and
+    // syncs it
+    template <class Fill>
+    static void WriteFile(const std::string& path, const char (&magic)[8], Fill fill) {
+        int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            throw std::runtime_error("cannot write " + path);
+        }
+        try {
+            vector_store_internal::Appender out(fd, 0, path);
+            FileHeader header = NewHeader(magic);
+            std::memcpy(out.Append(sizeof(header)), &header, sizeof(header));
+            fill(out);
+            out.Flush();
+            vector_store_internal::Sync(fd, path);
+        } catch (...) {
+            close(fd);
+            throw;
+        }
+        close(fd);
+    }
+
+    void AppendVersion(const VersionRecord& record) {
+        uint64_t offset = sizeof(FileHeader) + versions_.size() * sizeof(VersionRecord);
+        vector_store_internal::WriteAt(versions_fd_, &record, sizeof(record), offset,
+                                       VersionsPath());
+        vector_store_internal::Sync(versions_fd_, VersionsPath());
+        versions_.push_back(record);
+    }
+
+    // maps the node file again once it outgrew the mapping, which is doubled
+    // so that appends remap O(log n) times; the pages past the end of the
+    // file are never touched
+    void Remap() {
+        if (size_ <= mapping_size_) {
+            return;
+        }
+        size_t length = std::max(size_, 2 * mapping_size_);
+        void* mapping = mmap(nullptr, length, PROT_READ, MAP_SHARED, nodes_fd_, 0);
+        if (mapping == MAP_FAILED) {
+            throw std::runtime_error("cannot map " + path_);
+        }
+        if (mapping_) {
+            munmap(mapping_, mapping_size_);
+        }
+        mapping_ = mapping;
+        mapping_size_ = length;
+    }
+
+    const NodeHeader* Header(uint64_t offset) const {
+        return reinterpret_cast<const NodeHeader*>(static_cast<const char*>(mapping_) + offset);
+    }
+
+    const T* Values(uint64_t offset) const {
+        return reinterpret_cast<const T*>(Header(offset) + 1);
+    }
+
+    const uint64_t* Children(uint64_t offset) const {
+        return reinterpret_cast<const uint64_t*>(Header(offset) + 1);
+    }
+
+    // bytes of a node with count entries
+    static size_t NodeBytes(uint32_t kind, size_t count) {
+        if (kind == vector_store_internal::kLeaf) {
+            return vector_store_internal::Align(sizeof(NodeHeader) + count * sizeof(T));
+        }
+        size_t words = kind == vector_store_internal::kRelaxed ? 2 * count : count;
+        return sizeof(NodeHeader) + words * sizeof(uint64_t);
+    }
+
+    template <class Callback>
+    void VisitLeaves(uint64_t offset, size_t shift, Callback& callback) const {
+        const NodeHeader* header = Header(offset);
+        if (shift == 0) {
+            callback(std::span<const T>(Values(offset), header->count));
+            return;
+        }
+        const uint64_t* children = Children(offset);
+        for (size_t i = 0; i < header->count; ++i) {
+            VisitLeaves(children[i], shift - Stored::kNumOfBits, callback);
+        }
+    }
+
+    // appends the nodes under node at shift the file lacks, children before
+    // parents, and returns the offset of node; the nodes found already
+    // written are stamped with this save
+    uint64_t Write(const Node* node, size_t shift, vector_store_internal::Appender& out) {
+        if (auto it = offsets_.find(node); it != offsets_.end()) {
+            it->second.save = saves_;
+            return it->second.offset;
+        }
+        NodeHeader header{};
+        uint64_t words[2 * Width];
+        const void* payload = words;
+        size_t payload_bytes = 0;
+        if (shift == 0) {
+            const auto& values = Stored::AsValue(node)->value;
+            header = {vector_store_internal::kLeaf, static_cast<uint32_t>(values.size())};
+            payload = values.begin();
+            payload_bytes = values.size() * sizeof(T);
+        } else {
+            const auto& children = Stored::AsPtr(node)->children;
+            header.count = static_cast<uint32_t>(children.size());
+            for (size_t i = 0; i < children.size(); ++i) {
+                words[i] = Write(children[i].get(), shift - Stored::kNumOfBits, out);
+            }
+            header.kind = vector_store_internal::kBalanced;
+            payload_bytes = children.size() * sizeof(uint64_t);
+            if (node->relaxed) {
+                header.kind = vector_store_internal::kRelaxed;
+                const auto& sizes = Stored::AsRelaxed(node)->sizes;
+                std::copy(sizes.begin(), sizes.end(), words + children.size());
+                payload_bytes *= 2;
+            }
+        }
+
+        uint64_t offset = out.Offset();
+        char* bytes = out.Append(NodeBytes(header.kind, header.count));
+        std::memcpy(bytes, &header, sizeof(header));
+        std::memcpy(bytes + sizeof(header), payload, payload_bytes);
+        offsets_.emplace(node, Written{offset, saves_});
+        return offset;
+    }
+
+    // drops the offsets of the nodes under node, part of the version saved
+    // before, that the save just made did not stamp; offsets_ must not
+    // outlive its nodes, whose addresses may be reused
+    void Forget(const Node* node, size_t shift) {
+        if (!node) {
+            return;
+        }
+        auto it = offsets_.find(node);
+        if (it == offsets_.end() || it->second.save == saves_) {
+            return;
+        }
+        offsets_.erase(it);
+        for (size_t i = 0; shift > 0 && i < Stored::AsPtr(node)->children.size(); ++i) {
+            Forget(Stored::AsPtr(node)->children[i].get(), shift - Stored::kNumOfBits);
+        }
+    }
+
+    // the node at offset and shift rebuilt in memory, each offset once
+    NodePtr Read(uint64_t offset, size_t shift, std::unordered_map<uint64_t, NodePtr>& loaded) const {
+        if (auto it = loaded.find(offset); it != loaded.end()) {
+            return it->second;
+        }
+        const NodeHeader* header = Header(offset);
+        NodePtr result;
+        if (shift == 0) {
+            ValueNode* leaf = new ValueNode;
+            result = NodePtr(leaf);
+            const T* values = Values(offset);
+            for (size_t i = 0; i < header->count; ++i) {
+                leaf->value.push_back(values[i]);
+            }
+        } else {
+            const uint64_t* children = Children(offset);
+            PtrNode* node;
+            if (header->kind == vector_store_internal::kRelaxed) {
+                RelaxedNode* relaxed = new RelaxedNode;
+                result = NodePtr(relaxed);
+                for (size_t i = 0; i < header->count; ++i) {
+                    relaxed->sizes.push_back(children[header->count + i]);
+                }
+                node = relaxed;
+            } else {
+                node = new PtrNode;
+                result = NodePtr(node);
+            }
+            for (size_t i = 0; i < header->count; ++i) {
+                node->children.push_back(Read(children[i], shift - Stored::kNumOfBits, loaded));
+            }
+        }
+        loaded.emplace(offset, result);
+        return result;
+    }
+
+    // appends the node at offset and the nodes under it to out, a new node
+    // file, each once; returns its offset there
+    uint64_t Copy(uint64_t offset, size_t shift, vector_store_internal::Appender& out,
+                  std::unordered_map<uint64_t, uint64_t>& moved) const {
+        if (auto it = moved.find(offset); it != moved.end()) {
+            return it->second;
+        }
+        const NodeHeader* header = Header(offset);
+        uint64_t children[Width];
+        for (size_t i = 0; shift > 0 && i < header->count; ++i) {
+            children[i] = Copy(Children(offset)[i], shift - Stored::kNumOfBits, out, moved);
+        }
+        uint64_t result = out.Offset();
+        size_t bytes = NodeBytes(header->kind, header->count);
+        char* copy = out.Append(bytes);
+        std::memcpy(copy, header, bytes);
+        if (shift > 0) {
+            std::memcpy(copy + sizeof(NodeHeader), children, header->count * sizeof(uint64_t));
+        }
+        moved.emplace(offset, result);
+        return result;
+    }
+
+    std::string path_;
+    int nodes_fd_;
+    int versions_fd_;
+    // length of the node file, the offset the next node is written at
+    size_t size_;
+    void* mapping_;
+    size_t mapping_size_;
+    std::vector<VersionRecord> versions_;
+    struct Written {
+        uint64_t offset;
+        // the last save that wrote or found the node
+        uint64_t save;
+    };
+
+    // file offsets of the nodes of last_, the version saved or loaded last,
+    // which keeps them alive
+    std::unordered_map<const Node*, Written> offsets_;
+    std::optional<Stored> last_;
+    uint64_t saves_;
+};
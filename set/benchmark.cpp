@@ -0,0 +1,368 @@
+#include "set.h"
+#include "bulk_load.h"
+#include "concurrent_set.h"
+#include "frozen_set.h"
+#include "integer_set.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <malloc.h>
+#include <mutex>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace benchmarks {
+
+constexpr size_t kElements = 1'000'000;
+
+// keeps results of timed lookups from being optimized away
+volatile size_t sink;
+
+template <typename Func>
+double measure_ns_per_op(size_t ops, Func func) {
+    auto start = std::chrono::steady_clock::now();
+    func();
+    auto finish = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(finish - start).count() / ops;
+}
+
+void report(const std::string& name, const std::string& order, double ns_per_op) {
+    std::cout << name << " [" << order << "]: " << ns_per_op << " ns/op\n";
+}
+
+void report_memory(const std::string& name, const std::string& order, double bytes_per_key) {
+    std::cout << name << " [" << order << "]: " << bytes_per_key << " bytes/key\n";
+}
+
+// bytes handed out by malloc, chunk headers and rounding included
+size_t heap_bytes() {
+    return mallinfo2().uordblks;
+}
+
+std::vector<int> make_keys(const std::string& order) {
+    std::vector<int> keys(kElements);
+    for (size_t i = 0; i < kElements; ++i) {
+        keys[i] = static_cast<int>(i);
+    }
+    if (order == "reverse") {
+        std::reverse(keys.begin(), keys.end());
+    } else if (order == "random") {
+        std::shuffle(keys.begin(), keys.end(), std::mt19937(42));
+    }
+    return keys;
+}
+
+/* insertion in sorted, reverse-sorted and random order,
+ * plain insert versus hinted insert versus std::set */
+void bench_insert() {
+    for (const std::string order : {"sorted", "reverse", "random"}) {
+        std::vector<int> keys = make_keys(order);
+
+        report("Set::insert(value)", order, measure_ns_per_op(kElements, [&keys] {
+            Set<int> s;
+            for (int key : keys) {
+                s.insert(key);
+            }
+        }));
+
+        report("Set::insert(hint, value)", order, measure_ns_per_op(kElements, [&keys] {
+            Set<int> s;
+            auto hint = s.end();
+            for (int key : keys) {
+                hint = s.insert(hint, key);
+            }
+        }));
+
+        report("std::set::insert(value)", order, measure_ns_per_op(kElements, [&keys] {
+            std::set<int> s;
+            for (int key : keys) {
+                s.insert(key);
+            }
+        }));
+
+        report("std::set::insert(hint, value)", order, measure_ns_per_op(kElements, [&keys] {
+            std::set<int> s;
+            auto hint = s.end();
+            for (int key : keys) {
+                hint = s.insert(hint, key);
+            }
+        }));
+    }
+}
+
+/* join-based set algebra versus inserting one set into the other,
+ * only the operation itself is timed */
+void bench_set_algebra() {
+    std::vector<int> lhs = make_keys("random");
+    std::vector<int> rhs(lhs.size());
+    for (size_t i = 0; i < rhs.size(); ++i) {
+        rhs[i] = lhs[i] + static_cast<int>(kElements / 2);
+    }
+
+    for (const std::string op : {"union_with", "intersect_with", "difference_with", "insert loop"}) {
+        Set<int> tree(lhs.begin(), lhs.end());
+        Set<int> other(rhs.begin(), rhs.end());
+        report("Set::" + op, "half overlap", measure_ns_per_op(kElements, [&] {
+            if (op == "union_with") {
+                tree.union_with(std::move(other));
+            } else if (op == "intersect_with") {
+                tree.intersect_with(std::move(other));
+            } else if (op == "difference_with") {
+                tree.difference_with(std::move(other));
+            } else {
+                for (auto it = other.begin(); it != other.end(); ++it) {
+                    tree.insert(*it);
+                }
+            }
+        }));
+    }
+}
+
+/* mixed lookups and updates from several threads,
+ * lock-free skip list versus Set behind one mutex */
+template <typename Lookup, typename Update>
+double run_threads(size_t threads, size_t ops_per_thread, int read_percent,
+                   Lookup lookup, Update update) {
+    return measure_ns_per_op(threads * ops_per_thread, [&] {
+        std::vector<std::thread> workers;
+        for (size_t t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t] {
+                std::mt19937 rng(static_cast<unsigned>(t));
+                for (size_t i = 0; i < ops_per_thread; ++i) {
+                    int key = static_cast<int>(rng() % (2 * kElements / 10));
+                    if (static_cast<int>(rng() % 100) < read_percent) {
+                        lookup(key);
+                    } else {
+                        update(key, i % 2 == 0);
+                    }
+                }
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    });
+}
+
+void bench_concurrent() {
+    const size_t total_ops = kElements;
+    std::vector<int> keys = make_keys("random");
+    keys.resize(kElements / 10);
+
+    for (int read_percent : {100, 90, 50, 0}) {
+        for (size_t threads = 1; threads <= 64; threads *= 2) {
+            std::string order = std::to_string(read_percent) + "% reads, " +
+                                std::to_string(threads) + " threads";
+            size_t ops_per_thread = total_ops / threads;
+
+            ConcurrentSet<int> concurrent(keys.begin(), keys.end());
+            report("ConcurrentSet", order, run_threads(threads, ops_per_thread, read_percent,
+                [&concurrent](int key) {
+                    return concurrent.find(key) != concurrent.end();
+                },
+                [&concurrent](int key, bool insert) {
+                    return insert ? concurrent.insert(key) : concurrent.erase(key);
+                }));
+
+            Set<int> locked(keys.begin(), keys.end());
+            std::mutex mutex;
+            report("Set + std::mutex", order, run_threads(threads, ops_per_thread, read_percent,
+                [&locked, &mutex](int key) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    return locked.find(key) != locked.end();
+                },
+                [&locked, &mutex](int key, bool insert) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (insert) {
+                        locked.insert(key);
+                    } else {
+                        locked.erase(key);
+                    }
+                    return true;
+                }));
+        }
+    }
+}
+
+/* lower_bound on the Eytzinger array versus the pointer-based tree;
+ * Set is skipped above 16M keys, 1B keys would need more than the
+ * ~5 GB of memory this is usually run with */
+void bench_frozen() {
+    const size_t kQueries = 1'000'000;
+    for (size_t size : {size_t{1'000}, size_t{1'000'000}, size_t{16'000'000},
+                        size_t{256'000'000}}) {
+        std::string order = std::to_string(size) + " keys";
+        std::mt19937 rng(7);
+        std::vector<int> queries(kQueries);
+        for (auto& query : queries) {
+            query = static_cast<int>(rng() % (2 * size));
+        }
+
+        size_t checksum = 0;
+        {
+            std::vector<int> keys(size);
+            for (size_t i = 0; i < size; ++i) {
+                keys[i] = static_cast<int>(2 * i);
+            }
+            FrozenSet<int> frozen(keys.begin(), keys.end());
+            keys = std::vector<int>();
+            report("FrozenSet::lower_bound", order, measure_ns_per_op(kQueries, [&] {
+                for (int query : queries) {
+                    checksum += frozen.lower_bound(query) != frozen.end();
+                }
+            }));
+        }
+
+        if (size <= 16'000'000) {
+            Set<int> tree;
+            for (size_t i = 0; i < size; ++i) {
+                tree.insert(tree.end(), static_cast<int>(2 * i));
+            }
+            report("Set::lower_bound", order, measure_ns_per_op(kQueries, [&] {
+                for (int query : queries) {
+                    checksum += tree.lower_bound(query) != tree.end();
+                }
+            }));
+        }
+        sink = checksum;
+    }
+}
+
+/* bitmap trie versus comparison tree for 32-bit keys, time per operation
+ * and heap bytes per stored key for sparse and dense key sets */
+void bench_integer() {
+    std::mt19937 rng(11);
+    std::vector<uint32_t> random_keys(kElements);
+    for (auto& key : random_keys) {
+        key = static_cast<uint32_t>(rng());
+    }
+    std::vector<uint32_t> dense_keys(kElements);
+    for (size_t i = 0; i < kElements; ++i) {
+        dense_keys[i] = static_cast<uint32_t>(i);
+    }
+    std::shuffle(dense_keys.begin(), dense_keys.end(), std::mt19937(12));
+    size_t checksum = 0;
+
+    for (const std::string order : {"random uint32", "dense uint32"}) {
+        const std::vector<uint32_t>& keys = order == "random uint32" ? random_keys : dense_keys;
+
+        size_t heap_before = heap_bytes();
+        IntegerSet<uint32_t> bitmap;
+        report("IntegerSet::insert", order, measure_ns_per_op(kElements, [&] {
+            for (uint32_t key : keys) {
+                bitmap.insert(key);
+            }
+        }));
+        report_memory("IntegerSet", order,
+                      static_cast<double>(heap_bytes() - heap_before) / bitmap.size());
+        report("IntegerSet::lower_bound", order, measure_ns_per_op(kElements, [&] {
+            for (uint32_t key : keys) {
+                checksum += bitmap.lower_bound(key ^ 1) != bitmap.end();
+            }
+        }));
+
+        heap_before = heap_bytes();
+        Set<uint32_t> tree;
+        report("Set<uint32_t>::insert", order, measure_ns_per_op(kElements, [&] {
+            for (uint32_t key : keys) {
+                tree.insert(key);
+            }
+        }));
+        report_memory("Set<uint32_t>", order,
+                      static_cast<double>(heap_bytes() - heap_before) / tree.size());
+        report("Set<uint32_t>::lower_bound", order, measure_ns_per_op(kElements, [&] {
+            for (uint32_t key : keys) {
+                checksum += tree.lower_bound(key ^ 1) != tree.end();
+            }
+        }));
+    }
+    sink = checksum;
+}
+
+/* range sums from cached subtree aggregates versus scanning the range */
+void bench_aggregate() {
+    const size_t kQueries = 10'000;
+    std::vector<int> keys = make_keys("random");
+    Set<long long, augment::Sum<long long>> tree(keys.begin(), keys.end());
+    std::mt19937 rng(13);
+    std::vector<std::pair<int, int>> ranges(kQueries);
+    for (auto& range : ranges) {
+        range.first = static_cast<int>(rng() % kElements);
+        range.second = range.first + static_cast<int>(rng() % (kElements / 100));
+    }
+    long long checksum = 0;
+
+    report("Set::aggregate(lo, hi)", "random ranges", measure_ns_per_op(kQueries, [&] {
+        for (const auto& range : ranges) {
+            checksum += tree.aggregate(range.first, range.second);
+        }
+    }));
+    report("Set range scan", "random ranges", measure_ns_per_op(kQueries, [&] {
+        for (const auto& range : ranges) {
+            for (auto it = tree.lower_bound(range.first); it != tree.end() && *it < range.second;
+                 ++it) {
+                checksum += *it;
+            }
+        }
+    }));
+    sink = static_cast<size_t>(checksum);
+}
+
+/* external sort plus bottom-up build from a key file four times the
+ * memory budget, versus reading the file and inserting every key */
+void bench_bulk_load() {
+    const size_t kKeys = 8 * kElements;
+    std::mt19937_64 rng(17);
+    std::string path = "/tmp/set_bench_keys.bin";
+    {
+        std::ofstream out(path, std::ios::binary);
+        for (size_t i = 0; i < kKeys; ++i) {
+            uint64_t key = rng() % (kKeys / 2);
+            out.write(reinterpret_cast<const char*>(&key), sizeof(key));
+        }
+    }
+    BulkLoadOptions options;
+    options.memory_budget = kKeys * sizeof(uint64_t) / 4;
+
+    BulkLoadStats stats;
+    double ns_per_key = measure_ns_per_op(kKeys, [&] {
+        sink = bulk_load<uint64_t>(path, options, &stats).size();
+    });
+    report("bulk_load", std::to_string(stats.runs) + " runs, " +
+                            std::to_string(stats.merge_passes) + " merge passes", ns_per_key);
+    std::cout << "bulk_load throughput: " << stats.megabytes_per_second() << " MB/s\n";
+
+    report("Set::insert from file", "unsorted", measure_ns_per_op(kKeys, [&] {
+        Set<uint64_t> tree;
+        std::ifstream in(path, std::ios::binary);
+        uint64_t key;
+        while (in.read(reinterpret_cast<char*>(&key), sizeof(key))) {
+            tree.insert(key);
+        }
+        sink = tree.size();
+    }));
+    std::remove(path.c_str());
+}
+
+void run_all() {
+    bench_insert();
+    bench_set_algebra();
+    bench_concurrent();
+    bench_frozen();
+    bench_integer();
+    bench_aggregate();
+    bench_bulk_load();
+}
+}
+
+int main() {
+    benchmarks::run_all();
+    return 0;
+}
@@ -0,0 +1,348 @@
+#pragma once
+
+#include "set.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <sys/resource.h>
+#include <type_traits>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+// Builds ordered indexes from key dumps larger than memory. The input is a raw
+// array of trivially copyable keys; it is cut into sorted, deduplicated runs that
+// fit the memory budget, the runs are merged into a sorted unique file, in several
+// passes when they do not fit the budget or the file descriptor limit at once, and
+// that file is streamed into an O(n) bottom-up Set build.
+
+struct BulkLoadOptions {
+    // bytes of keys held in memory while sorting runs and merging them
+    size_t memory_budget = size_t{256} << 20;
+    std::string temp_dir = "/tmp";
+};
+
+struct BulkLoadStats {
+    size_t input_bytes = 0;
+    size_t keys = 0;
+    size_t unique_keys = 0;
+    size_t runs = 0;
+    size_t merge_passes = 0;
+    double seconds = 0;
+
+    double megabytes_per_second() const {
+        return seconds > 0 ? input_bytes / seconds / (1 << 20) : 0;
+    }
+};
+
+namespace bulk_load_internal {
+
+// smallest read buffer per run during the merge, even over budget
+const size_t kMinBufferBytes = size_t{64} << 10;
+
+template <typename ValueType>
+bool Equivalent(const ValueType& lhs, const ValueType& rhs) {
+    return !(lhs < rhs) && !(rhs < lhs);
+}
+
+// buffered sequential reader of a raw value file
+template <typename ValueType>
+class ValueReader {
+public:
+    ValueReader(const std::string& path, size_t buffer_values)
+        : in_(path, std::ios::binary), path_{path},
+          buffer_(std::max<size_t>(buffer_values, 1)), position_{0}, end_{0} {
+        if (!in_) {
+            throw std::runtime_error("cannot open " + path);
+        }
+    }
+
+    bool next(ValueType& value) {
+        if (position_ == end_ && !Refill()) {
+            return false;
+        }
+        value = buffer_[position_++];
+        return true;
+    }
+
+private:
+    bool Refill() {
+        in_.read(reinterpret_cast<char*>(buffer_.data()), buffer_.size() * sizeof(ValueType));
+        size_t bytes = static_cast<size_t>(in_.gcount());
+        if (bytes % sizeof(ValueType) != 0) {
+            throw std::runtime_error("truncated key file " + path_);
+        }
+        position_ = 0;
+        end_ = bytes / sizeof(ValueType);
+        return end_ > 0;
+    }
+
+    std::ifstream in_;
+    std::string path_;
+    std::vector<ValueType> buffer_;
+    size_t position_;
+    size_t end_;
+};
+
+template <typename ValueType>
+class ValueWriter {
+public:
+    ValueWriter(const std::string& path, size_t buffer_values)
+        : out_(path, std::ios::binary | std::ios::trunc), path_{path} {
+        if (!out_) {
+            throw std::runtime_error("cannot write " + path);
+        }
+        buffer_.reserve(std::max<size_t>(buffer_values, 1));
+    }
+
+    void push(const ValueType& value) {
+        buffer_.push_back(value);
+        if (buffer_.size() == buffer_.capacity()) {
+            Flush();
+        }
+    }
+
+    void finish() {
+        Flush();
+        out_.close();
+        if (!out_) {
+            throw std::runtime_error("cannot write " + path_);
+        }
+    }
+
+private:
+    void Flush() {
+        out_.write(reinterpret_cast<const char*>(buffer_.data()),
+                   buffer_.size() * sizeof(ValueType));
+        if (!out_) {
+            throw std::runtime_error("cannot write " + path_);
+        }
+        buffer_.clear();
+    }
+
+    std::ofstream out_;
+    std::string path_;
+    std::vector<ValueType> buffer_;
+};
+
+// input iterator over a reader, for Set::from_sorted
+template <typename ValueType>
+class ReaderIterator {
+public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = ValueType;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const ValueType*;
+    using reference = const ValueType&;
+
+    explicit ReaderIterator(ValueReader<ValueType>& reader): reader_{&reader} {
+        ++*this;
+    }
+
+    const ValueType& operator*() const {
+        if (!valid_) {
+            throw std::runtime_error("sorted key file ended early");
+        }
+        return value_;
+    }
+
+    ReaderIterator& operator++() {
+        valid_ = reader_->next(value_);
+        return *this;
+    }
+
+private:
+    ValueReader<ValueType>* reader_;
+    ValueType value_{};
+    bool valid_ = false;
+};
+
+// runs merged at once: every run and the output get a buffer of at least
+// kMinBufferBytes within the budget, and at most half of the file descriptors
+// allowed to the process are used for runs
+inline size_t MergeFanIn(size_t memory_budget) {
+    size_t buffers = memory_budget / kMinBufferBytes;
+    size_t fan_in = buffers > 1 ? buffers - 1 : 0;
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY) {
+        fan_in = std::min<size_t>(fan_in, limit.rlim_cur / 2);
+    }
+    return std::max<size_t>(fan_in, 2);
+}
+
+// k-way merge of runs[first, last) into output_path, returns the unique keys written
+template <typename ValueType>
+size_t MergeRuns(const std::vector<std::string>& runs, size_t first, size_t last,
+                 const std::string& output_path, size_t memory_budget) {
+    size_t buffer_bytes = std::max(memory_budget / (last - first + 1), kMinBufferBytes);
+    size_t buffer_values = buffer_bytes / sizeof(ValueType);
+    std::vector<ValueReader<ValueType>> readers;
+    readers.reserve(last - first);
+    using Head = std::pair<ValueType, size_t>;
+    auto later = [](const Head& lhs, const Head& rhs) {
+        return rhs.first < lhs.first;
+    };
+    std::priority_queue<Head, std::vector<Head>, decltype(later)> heads(later);
+    for (size_t i = first; i < last; ++i) {
+        readers.emplace_back(runs[i], buffer_values);
+        ValueType value;
+        if (readers.back().next(value)) {
+            heads.emplace(value, readers.size() - 1);
+        }
+    }
+
+    ValueWriter<ValueType> writer(output_path, buffer_values);
+    size_t unique_keys = 0;
+    ValueType previous{};
+    while (!heads.empty()) {
+        Head head = heads.top();
+        heads.pop();
+        if (unique_keys == 0 || previous < head.first) {
+            writer.push(head.first);
+            previous = head.first;
+            ++unique_keys;
+        }
+        ValueType value;
+        if (readers[head.second].next(value)) {
+            heads.emplace(value, head.second);
+        }
+    }
+    writer.finish();
+    return unique_keys;
+}
+
+// owns the temporary files and removes them on scope exit
+class TempFiles {
+public:
+    explicit TempFiles(std::string dir): dir_{std::move(dir)} {
+    }
+
+    TempFiles(const TempFiles&) = delete;
+    TempFiles& operator=(const TempFiles&) = delete;
+
+    ~TempFiles() {
+        for (const auto& path : paths_) {
+            std::remove(path.c_str());
+        }
+    }
+
+    const std::string& make() {
+        static std::atomic<size_t> counter{0};
+        paths_.push_back(dir_ + "/set_bulk_load_" + std::to_string(getpid()) + "_" +
+                         std::to_string(counter++) + ".tmp");
+        return paths_.back();
+    }
+
+private:
+    std::string dir_;
+    std::vector<std::string> paths_;
+};
+}
+
+// sorts and deduplicates the raw key file at input_path into output_path,
+// holding about options.memory_budget bytes of keys at a time
+template <typename ValueType>
+BulkLoadStats sort_unique_file(const std::string& input_path, const std::string& output_path,
+                               const BulkLoadOptions& options = {}) {
+    static_assert(std::is_trivially_copyable_v<ValueType>,
+                  "only trivially copyable keys can be loaded");
+    using namespace bulk_load_internal;
+    auto start = std::chrono::steady_clock::now();
+    BulkLoadStats stats;
+    TempFiles temp_files(options.temp_dir);
+    std::vector<std::string> runs;
+
+    // phase 1: sorted, deduplicated runs that fit the budget next to the input
+    // and output buffers
+    {
+        size_t run_bytes = options.memory_budget > 4 * kMinBufferBytes
+                               ? options.memory_budget - 2 * kMinBufferBytes
+                               : options.memory_budget;
+        size_t run_values = std::max<size_t>(run_bytes / sizeof(ValueType), 1);
+        ValueReader<ValueType> reader(input_path, kMinBufferBytes / sizeof(ValueType));
+        std::vector<ValueType> run;
+        run.reserve(run_values);
+        bool done = false;
+        while (!done) {
+            run.clear();
+            ValueType value;
+            while (run.size() < run_values && !(done = !reader.next(value))) {
+                run.push_back(value);
+            }
+            if (run.empty()) {
+                break;
+            }
+            stats.keys += run.size();
+            std::sort(run.begin(), run.end());
+            run.erase(std::unique(run.begin(), run.end(), Equivalent<ValueType>), run.end());
+
+            runs.push_back(temp_files.make());
+            ValueWriter<ValueType> writer(runs.back(), kMinBufferBytes / sizeof(ValueType));
+            for (const auto& key : run) {
+                writer.push(key);
+            }
+            writer.finish();
+        }
+    }
+    stats.input_bytes = stats.keys * sizeof(ValueType);
+    stats.runs = runs.size();
+
+    // phase 2: merge groups of fan_in runs into longer runs until a single merge
+    // can produce the output, the budget is split evenly between the buffers
+    size_t fan_in = MergeFanIn(options.memory_budget);
+    while (runs.size() > fan_in) {
+        std::vector<std::string> merged;
+        for (size_t first = 0; first < runs.size(); first += fan_in) {
+            size_t last = std::min(first + fan_in, runs.size());
+            if (last - first == 1) {
+                merged.push_back(runs[first]);
+                continue;
+            }
+            merged.push_back(temp_files.make());
+            MergeRuns<ValueType>(runs, first, last, merged.back(), options.memory_budget);
+            for (size_t i = first; i < last; ++i) {
+                std::remove(runs[i].c_str());
+            }
+        }
+        runs = std::move(merged);
+        ++stats.merge_passes;
+    }
+    stats.unique_keys = MergeRuns<ValueType>(runs, 0, runs.size(), output_path,
+                                             options.memory_budget);
+    ++stats.merge_passes;
+
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return stats;
+}
+
+// builds a Set from the raw key file at input_path with bounded sort memory,
+// the resulting tree itself still lives in memory
+template <typename ValueType>
+Set<ValueType> bulk_load(const std::string& input_path, const BulkLoadOptions& options = {},
+                         BulkLoadStats* stats = nullptr) {
+    using namespace bulk_load_internal;
+    auto start = std::chrono::steady_clock::now();
+    TempFiles temp_files(options.temp_dir);
+    const std::string& sorted_path = temp_files.make();
+    BulkLoadStats sort_stats = sort_unique_file<ValueType>(input_path, sorted_path, options);
+
+    Set<ValueType> result;
+    if (sort_stats.unique_keys > 0) {
+        ValueReader<ValueType> reader(sorted_path, kMinBufferBytes / sizeof(ValueType));
+        result = Set<ValueType>::from_sorted(ReaderIterator<ValueType>(reader),
+                                             sort_stats.unique_keys);
+    }
+
+    if (stats) {
+        *stats = sort_stats;
+        stats->seconds =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    return result;
+}
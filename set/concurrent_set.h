@@ -0,0 +1,528 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace concurrent_set_internal {
+
+constexpr size_t kMaxThreads = 256;
+
+// small process-wide thread ids, the id is given back when its thread exits
+class ThreadSlot {
+public:
+    static size_t Id() {
+        thread_local ThreadSlot slot;
+        return slot.id_;
+    }
+
+    ThreadSlot(const ThreadSlot&) = delete;
+    ThreadSlot& operator=(const ThreadSlot&) = delete;
+
+private:
+    ThreadSlot() {
+        for (size_t i = 0; i < kMaxThreads; ++i) {
+            bool expected = false;
+            if (Taken()[i].compare_exchange_strong(expected, true)) {
+                id_ = i;
+                return;
+            }
+        }
+        throw std::runtime_error("ConcurrentSet: too many threads");
+    }
+
+    ~ThreadSlot() {
+        Taken()[id_].store(false);
+    }
+
+    static std::atomic<bool>* Taken() {
+        static std::atomic<bool> taken[kMaxThreads];
+        return taken;
+    }
+
+    size_t id_;
+};
+}
+
+// Lock-free ordered set: a Harris-style skip list whose removed nodes are freed
+// through epoch-based reclamation. Every operation may run concurrently with any other.
+// Iteration is weakly consistent: it sees every element present for the whole walk
+// and may or may not see concurrent changes. An iterator pins the current epoch
+// until destroyed, so it must stay on the thread that created it.
+template <typename ValueType>
+class ConcurrentSet {
+    static const int kMaxHeight = 24;
+    static const size_t kRetireThreshold = 64;
+    static const uint64_t kIdle = UINT64_MAX;
+    static const uintptr_t kMarkBit = 1;
+
+    // the next pointers of every level are allocated right after the node,
+    // the low bit of a next pointer marks the owner node as removed on that level
+    struct alignas(std::atomic<uintptr_t>) Node {
+        Node(int height, const ValueType& value): value_{value}, height_{height}, owners_{2} {
+        }
+
+        std::atomic<uintptr_t>* Next() {
+            return reinterpret_cast<std::atomic<uintptr_t>*>(this + 1);
+        }
+
+        ValueType value_;
+        int height_;
+        // the inserter until it is done linking upper levels, and the eraser;
+        // the last one to let go unlinks the node and retires it
+        std::atomic<int> owners_;
+    };
+
+    struct alignas(64) EpochSlot {
+        std::atomic<uint64_t> epoch{kIdle};
+        size_t depth = 0;
+        std::vector<std::pair<Node*, uint64_t>> retired;
+    };
+
+    // keeps nodes reachable at construction time alive until destruction
+    class Guard {
+    public:
+        explicit Guard(const ConcurrentSet* set): set_{set} {
+            if (set_) {
+                set_->Enter();
+            }
+        }
+
+        Guard(const Guard& other): Guard(other.set_) {
+        }
+
+        Guard& operator=(const Guard& rhs) {
+            if (rhs.set_) {
+                rhs.set_->Enter();
+            }
+            if (set_) {
+                set_->Exit();
+            }
+            set_ = rhs.set_;
+            return *this;
+        }
+
+        ~Guard() {
+            if (set_) {
+                set_->Exit();
+            }
+        }
+
+    private:
+        const ConcurrentSet* set_;
+    };
+
+public:
+    class iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = ValueType;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const ValueType*;
+        using reference = const ValueType&;
+
+        iterator(): guard_{nullptr}, node_{nullptr} {
+        }
+
+        iterator& operator++() {
+            node_ = SkipRemoved(Ptr(node_->Next()[0].load(std::memory_order_acquire)));
+            return *this;
+        }
+
+        iterator operator++(int) {
+            iterator old(*this);
+            this->operator++();
+            return old;
+        }
+
+        bool operator==(const iterator& rhs) const {
+            return node_ == rhs.node_;
+        }
+
+        bool operator!=(const iterator& rhs) const {
+            return node_ != rhs.node_;
+        }
+
+        const ValueType& operator*() const {
+            return node_->value_;
+        }
+
+        const ValueType* operator->() const {
+            return &(node_->value_);
+        }
+
+    private:
+        friend class ConcurrentSet;
+
+        iterator(const ConcurrentSet* set, Node* node)
+            : guard_{node ? set : nullptr}, node_{node} {
+        }
+
+        Guard guard_;
+        Node* node_;
+    };
+
+    ConcurrentSet(): global_epoch_{0}, size_{0} {
+        for (int level = 0; level < kMaxHeight; ++level) {
+            head_[level].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    template <typename Iterator>
+    ConcurrentSet(Iterator first, Iterator last): ConcurrentSet() {
+        while (first != last) {
+            insert(*first);
+            ++first;
+        }
+    }
+
+    ConcurrentSet(const ConcurrentSet&) = delete;
+    ConcurrentSet& operator=(const ConcurrentSet&) = delete;
+
+    // must not run concurrently with any other operation
+    ~ConcurrentSet() {
+        Node* node = Ptr(head_[0].load(std::memory_order_relaxed));
+        while (node) {
+            Node* next = Ptr(node->Next()[0].load(std::memory_order_relaxed));
+            DestroyNode(node);
+            node = next;
+        }
+        for (auto& slot : slots_) {
+            for (auto& retired : slot.retired) {
+                DestroyNode(retired.first);
+            }
+        }
+    }
+
+    iterator begin() const {
+        Guard guard(this);
+        return iterator(this, SkipRemoved(Ptr(head_[0].load(std::memory_order_acquire))));
+    }
+
+    iterator end() const {
+        return iterator();
+    }
+
+    bool insert(const ValueType& value);
+    bool erase(const ValueType& value);
+    iterator find(const ValueType& value) const;
+    iterator lower_bound(const ValueType& value) const;
+
+    // exact only when no operation is in flight
+    size_t size() const {
+        return size_.load(std::memory_order_relaxed);
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+private:
+    static Node* Ptr(uintptr_t raw) {
+        return reinterpret_cast<Node*>(raw & ~kMarkBit);
+    }
+
+    static uintptr_t Raw(Node* node) {
+        return reinterpret_cast<uintptr_t>(node);
+    }
+
+    static bool IsMarked(uintptr_t raw) {
+        return (raw & kMarkBit) != 0;
+    }
+
+    static Node* SkipRemoved(Node* node) {
+        while (node) {
+            uintptr_t next = node->Next()[0].load(std::memory_order_acquire);
+            if (!IsMarked(next)) {
+                break;
+            }
+            node = Ptr(next);
+        }
+        return node;
+    }
+
+    static Node* CreateNode(int height, const ValueType& value);
+    static void DestroyNode(Node* node);
+    static int RandomHeight();
+
+    std::atomic<uintptr_t>& Link(Node* pred, int level) const {
+        return pred ? pred->Next()[level] : head_[level];
+    }
+
+    bool TryFind(const ValueType& value, Node** preds, Node** succs) const;
+    bool Find(const ValueType& value, Node** preds, Node** succs) const;
+
+    void Release(Node* node, Node** preds, Node** succs);
+    void Enter() const;
+    void Exit() const;
+    void Retire(Node* node);
+    void TryAdvance() const;
+    void Reclaim(EpochSlot& slot);
+
+    mutable std::atomic<uintptr_t> head_[kMaxHeight];
+    mutable std::atomic<uint64_t> global_epoch_;
+    mutable EpochSlot slots_[concurrent_set_internal::kMaxThreads];
+    std::atomic<size_t> size_;
+};
+
+
+template <typename ValueType>
+bool ConcurrentSet<ValueType>::insert(const ValueType& value) {
+    Guard guard(this);
+    Node* preds[kMaxHeight];
+    Node* succs[kMaxHeight];
+    Node* node = nullptr;
+    int height = RandomHeight();
+
+    while (true) {
+        if (Find(value, preds, succs)) {
+            if (node) {
+                DestroyNode(node);
+            }
+            return false;
+        }
+        if (!node) {
+            node = CreateNode(height, value);
+        }
+        for (int level = 0; level < height; ++level) {
+            node->Next()[level].store(Raw(succs[level]), std::memory_order_relaxed);
+        }
+        uintptr_t expected = Raw(succs[0]);
+        if (Link(preds[0], 0).compare_exchange_strong(expected, Raw(node),
+                                                      std::memory_order_acq_rel)) {
+            break;
+        }
+    }
+    size_.fetch_add(1, std::memory_order_relaxed);
+
+    // the node is in the set now, the upper levels are only shortcuts
+    for (int level = 1; level < height; ++level) {
+        bool linked = false;
+        while (!linked) {
+            uintptr_t next = node->Next()[level].load(std::memory_order_acquire);
+            if (IsMarked(next)) {
+                break;
+            }
+            if (next != Raw(succs[level]) &&
+                !node->Next()[level].compare_exchange_strong(next, Raw(succs[level]),
+                                                             std::memory_order_acq_rel)) {
+                continue;
+            }
+            uintptr_t expected = Raw(succs[level]);
+            if (Link(preds[level], level).compare_exchange_strong(expected, Raw(node),
+                                                                  std::memory_order_acq_rel)) {
+                linked = true;
+            } else if (!Find(value, preds, succs) || succs[0] != node) {
+                break;
+            }
+        }
+        if (!linked) {
+            break;
+        }
+    }
+
+    // a concurrent erase may have run before this thread linked an upper level,
+    // the node can only be retired once no level links it any more
+    Release(node, preds, succs);
+    return true;
+}
+
+template <typename ValueType>
+bool ConcurrentSet<ValueType>::erase(const ValueType& value) {
+    Guard guard(this);
+    Node* preds[kMaxHeight];
+    Node* succs[kMaxHeight];
+    if (!Find(value, preds, succs)) {
+        return false;
+    }
+
+    Node* victim = succs[0];
+    for (int level = victim->height_ - 1; level > 0; --level) {
+        uintptr_t next = victim->Next()[level].load(std::memory_order_acquire);
+        while (!IsMarked(next) &&
+               !victim->Next()[level].compare_exchange_weak(next, next | kMarkBit,
+                                                            std::memory_order_acq_rel)) {
+        }
+    }
+
+    // whoever marks the bottom level owns the removal
+    uintptr_t next = victim->Next()[0].load(std::memory_order_acquire);
+    while (true) {
+        if (IsMarked(next)) {
+            return false;
+        }
+        if (victim->Next()[0].compare_exchange_strong(next, next | kMarkBit,
+                                                      std::memory_order_acq_rel)) {
+            break;
+        }
+    }
+    size_.fetch_sub(1, std::memory_order_relaxed);
+
+    Release(victim, preds, succs);
+    return true;
+}
+
+template <typename ValueType>
+typename ConcurrentSet<ValueType>::iterator
+ConcurrentSet<ValueType>::find(const ValueType& value) const {
+    Guard guard(this);
+    Node* preds[kMaxHeight];
+    Node* succs[kMaxHeight];
+    if (!Find(value, preds, succs)) {
+        return end();
+    }
+    return iterator(this, succs[0]);
+}
+
+template <typename ValueType>
+typename ConcurrentSet<ValueType>::iterator
+ConcurrentSet<ValueType>::lower_bound(const ValueType& value) const {
+    Guard guard(this);
+    Node* preds[kMaxHeight];
+    Node* succs[kMaxHeight];
+    Find(value, preds, succs);
+    return iterator(this, succs[0]);
+}
+
+template <typename ValueType>
+typename ConcurrentSet<ValueType>::Node*
+ConcurrentSet<ValueType>::CreateNode(int height, const ValueType& value) {
+    void* memory = ::operator new(sizeof(Node) + height * sizeof(std::atomic<uintptr_t>));
+    Node* node = nullptr;
+    try {
+        node = new (memory) Node(height, value);
+    } catch (...) {
+        ::operator delete(memory);
+        throw;
+    }
+    for (int level = 0; level < height; ++level) {
+        new (node->Next() + level) std::atomic<uintptr_t>(0);
+    }
+    return node;
+}
+
+template <typename ValueType>
+void ConcurrentSet<ValueType>::DestroyNode(Node* node) {
+    node->~Node();
+    ::operator delete(node);
+}
+
+// geometric distribution with p = 1/2
+template <typename ValueType>
+int ConcurrentSet<ValueType>::RandomHeight() {
+    thread_local uint64_t state = 0x9E3779B97F4A7C15ull ^ reinterpret_cast<uintptr_t>(&state);
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return 1 + std::countr_zero(state | (uint64_t{1} << (kMaxHeight - 1)));
+}
+
+// fills preds/succs around value on every level and unlinks marked nodes on the way,
+// returns false when a concurrent change forces a restart
+template <typename ValueType>
+bool ConcurrentSet<ValueType>::TryFind(const ValueType& value,
+                                       Node** preds, Node** succs) const {
+    Node* pred = nullptr;
+    for (int level = kMaxHeight - 1; level >= 0; --level) {
+        Node* curr = Ptr(Link(pred, level).load(std::memory_order_acquire));
+        while (curr) {
+            uintptr_t succ = curr->Next()[level].load(std::memory_order_acquire);
+            if (IsMarked(succ)) {
+                uintptr_t expected = Raw(curr);
+                if (!Link(pred, level).compare_exchange_strong(expected, succ & ~kMarkBit,
+                                                               std::memory_order_acq_rel)) {
+                    return false;
+                }
+                curr = Ptr(succ);
+            } else if (curr->value_ < value) {
+                pred = curr;
+                curr = Ptr(succ);
+            } else {
+                break;
+            }
+        }
+        preds[level] = pred;
+        succs[level] = curr;
+    }
+    return true;
+}
+
+template <typename ValueType>
+bool ConcurrentSet<ValueType>::Find(const ValueType& value, Node** preds, Node** succs) const {
+    while (!TryFind(value, preds, succs)) {
+    }
+    return succs[0] && !(value < succs[0]->value_);
+}
+
+// the acq_rel decrement orders the inserter's upper-level links before the final
+// Find, which then sees and unlinks the node on every level
+template <typename ValueType>
+void ConcurrentSet<ValueType>::Release(Node* node, Node** preds, Node** succs) {
+    if (node->owners_.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+        return;
+    }
+    Find(node->value_, preds, succs);
+    Retire(node);
+}
+
+template <typename ValueType>
+void ConcurrentSet<ValueType>::Enter() const {
+    EpochSlot& slot = slots_[concurrent_set_internal::ThreadSlot::Id()];
+    if (slot.depth++ == 0) {
+        slot.epoch.store(global_epoch_.load(std::memory_order_relaxed),
+                         std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+}
+
+template <typename ValueType>
+void ConcurrentSet<ValueType>::Exit() const {
+    EpochSlot& slot = slots_[concurrent_set_internal::ThreadSlot::Id()];
+    if (--slot.depth == 0) {
+        slot.epoch.store(kIdle, std::memory_order_release);
+    }
+}
+
+template <typename ValueType>
+void ConcurrentSet<ValueType>::Retire(Node* node) {
+    EpochSlot& slot = slots_[concurrent_set_internal::ThreadSlot::Id()];
+    slot.retired.emplace_back(node, global_epoch_.load(std::memory_order_seq_cst));
+    if (slot.retired.size() >= kRetireThreshold) {
+        TryAdvance();
+        Reclaim(slot);
+    }
+}
+
+// the epoch moves forward once every thread inside an operation has seen it
+template <typename ValueType>
+void ConcurrentSet<ValueType>::TryAdvance() const {
+    uint64_t epoch = global_epoch_.load(std::memory_order_seq_cst);
+    for (const auto& slot : slots_) {
+        uint64_t local = slot.epoch.load(std::memory_order_seq_cst);
+        if (local != kIdle && local != epoch) {
+            return;
+        }
+    }
+    global_epoch_.compare_exchange_strong(epoch, epoch + 1, std::memory_order_seq_cst);
+}
+
+// a node retired in epoch e is unreachable for everybody once the epoch reaches e + 2
+template <typename ValueType>
+void ConcurrentSet<ValueType>::Reclaim(EpochSlot& slot) {
+    uint64_t epoch = global_epoch_.load(std::memory_order_seq_cst);
+    size_t kept = 0;
+    for (auto& retired : slot.retired) {
+        if (retired.second + 2 <= epoch) {
+            DestroyNode(retired.first);
+        } else {
+            slot.retired[kept++] = retired;
+        }
+    }
+    slot.retired.resize(kept);
+}
@@ -0,0 +1,295 @@
+#pragma once
+
+#include "set.h"
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <type_traits>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+// Read-only ordered set stored as one array in Eytzinger (BFS) order: the children
+// of the 1-based position k are 2k and 2k + 1. A search is a branch-free descent
+// whose next few levels are prefetched, instead of chasing tree pointers.
+// Sets of trivially copyable values can be saved to a file and mapped back without parsing.
+template <typename ValueType>
+class FrozenSet {
+    struct FileHeader {
+        char magic[8];
+        uint64_t value_size;
+        uint64_t count;
+        uint64_t reserved;
+    };
+
+    static constexpr char kMagic[8] = {'F', 'R', 'Z', 'N', 'S', 'E', 'T', '1'};
+
+public:
+    class iterator {
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = ValueType;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const ValueType*;
+        using reference = const ValueType&;
+
+        iterator(): set_{nullptr}, index_{0} {
+        }
+
+        // in-order successor in the implicit tree, 0 is end()
+        iterator& operator++() {
+            if (2 * index_ + 1 <= set_->size_) {
+                index_ = set_->LeftmostFrom(2 * index_ + 1);
+            } else {
+                index_ >>= std::countr_one(index_) + 1;
+            }
+            return *this;
+        }
+
+        iterator operator++(int) {
+            iterator old(*this);
+            this->operator++();
+            return old;
+        }
+
+        iterator& operator--() {
+            if (index_ == 0) {
+                index_ = set_->RightmostFrom(1);
+            } else if (2 * index_ <= set_->size_) {
+                index_ = set_->RightmostFrom(2 * index_);
+            } else {
+                index_ >>= std::countr_zero(index_) + 1;
+            }
+            return *this;
+        }
+
+        iterator operator--(int) {
+            iterator old(*this);
+            this->operator--();
+            return old;
+        }
+
+        bool operator==(const iterator& rhs) const {
+            return index_ == rhs.index_;
+        }
+
+        bool operator!=(const iterator& rhs) const {
+            return index_ != rhs.index_;
+        }
+
+        const ValueType& operator*() const {
+            return set_->At(index_);
+        }
+
+        const ValueType* operator->() const {
+            return &(set_->At(index_));
+        }
+
+    private:
+        friend class FrozenSet;
+
+        iterator(const FrozenSet* set, size_t index): set_{set}, index_{index} {
+        }
+
+        const FrozenSet* set_;
+        size_t index_;
+    };
+
+    FrozenSet(): data_{nullptr}, size_{0}, mapping_{nullptr}, mapping_size_{0} {
+    }
+
+    // the range must be sorted and free of duplicates
+    template <typename Iterator>
+    FrozenSet(Iterator first, Iterator last): FrozenSet() {
+        std::vector<ValueType> sorted(first, last);
+        size_ = sorted.size();
+        storage_.resize(size_);
+        size_t next = 0;
+        Fill(sorted, next, 1);
+        data_ = storage_.data();
+    }
+
+    explicit FrozenSet(const Set<ValueType>& set): FrozenSet(set.begin(), set.end()) {
+    }
+
+    FrozenSet(FrozenSet&& other): FrozenSet() {
+        swap(other);
+    }
+
+    FrozenSet& operator=(FrozenSet&& rhs) {
+        FrozenSet stolen(std::move(rhs));
+        swap(stolen);
+        return *this;
+    }
+
+    FrozenSet(const FrozenSet&) = delete;
+    FrozenSet& operator=(const FrozenSet&) = delete;
+
+    ~FrozenSet() {
+        if (mapping_) {
+            munmap(mapping_, mapping_size_);
+        }
+    }
+
+    void swap(FrozenSet& other) {
+        std::swap(storage_, other.storage_);
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+        std::swap(mapping_, other.mapping_);
+        std::swap(mapping_size_, other.mapping_size_);
+    }
+
+    iterator begin() const {
+        return iterator(this, size_ ? LeftmostFrom(1) : 0);
+    }
+
+    iterator end() const {
+        return iterator(this, 0);
+    }
+
+    iterator find(const ValueType& value) const {
+        iterator itr = lower_bound(value);
+        if (itr == end() || value < *itr) {
+            return end();
+        }
+        return itr;
+    }
+
+    iterator lower_bound(const ValueType& value) const {
+        size_t index = 1;
+        while (index <= size_) {
+            Prefetch(index);
+            index = 2 * index + (At(index) < value);
+        }
+        // drop the trailing right turns and the last left turn
+        return iterator(this, index >> (std::countr_one(index) + 1));
+    }
+
+    iterator upper_bound(const ValueType& value) const {
+        size_t index = 1;
+        while (index <= size_) {
+            Prefetch(index);
+            index = 2 * index + !(value < At(index));
+        }
+        return iterator(this, index >> (std::countr_one(index) + 1));
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    bool empty() const {
+        return size_ == 0;
+    }
+
+    void save(const std::string& path) const;
+    static FrozenSet map(const std::string& path);
+
+private:
+    const ValueType& At(size_t index) const {
+        return data_[index - 1];
+    }
+
+    // 16 positions below index are 4 levels down, one cache line for small values;
+    // near the leaves there is nothing that deep, and no pointer may be formed to it
+    void Prefetch(size_t index) const {
+#if defined(__GNUC__)
+        if (16 * index <= size_) {
+            __builtin_prefetch(data_ + 16 * index - 1);
+        }
+#endif
+    }
+
+    size_t LeftmostFrom(size_t index) const {
+        while (2 * index <= size_) {
+            index = 2 * index;
+        }
+        return index;
+    }
+
+    size_t RightmostFrom(size_t index) const {
+        while (2 * index + 1 <= size_) {
+            index = 2 * index + 1;
+        }
+        return index;
+    }
+
+    void Fill(std::vector<ValueType>& sorted, size_t& next, size_t index) {
+        if (index > size_) {
+            return;
+        }
+        Fill(sorted, next, 2 * index);
+        storage_[index - 1] = std::move(sorted[next++]);
+        Fill(sorted, next, 2 * index + 1);
+    }
+
+    std::vector<ValueType> storage_;
+    const ValueType* data_;
+    size_t size_;
+    void* mapping_;
+    size_t mapping_size_;
+};
+
+
+template <typename ValueType>
+void FrozenSet<ValueType>::save(const std::string& path) const {
+    static_assert(std::is_trivially_copyable_v<ValueType>,
+                  "only trivially copyable values can be saved");
+    FileHeader header{};
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.value_size = sizeof(ValueType);
+    header.count = size_;
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(data_), size_ * sizeof(ValueType));
+    if (!out) {
+        throw std::runtime_error("cannot write " + path);
+    }
+}
+
+// the file stays mapped for the lifetime of the returned set
+template <typename ValueType>
+FrozenSet<ValueType> FrozenSet<ValueType>::map(const std::string& path) {
+    static_assert(std::is_trivially_copyable_v<ValueType>,
+                  "only trivially copyable values can be mapped");
+    static_assert(alignof(ValueType) <= sizeof(FileHeader),
+                  "values would be misaligned after the header");
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("cannot open " + path);
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(FileHeader)) {
+        close(fd);
+        throw std::runtime_error("bad frozen set file " + path);
+    }
+    size_t length = static_cast<size_t>(info.st_size);
+    void* mapping = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        throw std::runtime_error("cannot map " + path);
+    }
+
+    const FileHeader* header = static_cast<const FileHeader*>(mapping);
+    if (std::memcmp(header->magic, kMagic, sizeof(kMagic)) != 0 ||
+        header->value_size != sizeof(ValueType) ||
+        header->count > (length - sizeof(FileHeader)) / sizeof(ValueType)) {
+        munmap(mapping, length);
+        throw std::runtime_error("bad frozen set file " + path);
+    }
+
+    FrozenSet result;
+    result.mapping_ = mapping;
+    result.mapping_size_ = length;
+    result.size_ = header->count;
+    result.data_ = reinterpret_cast<const ValueType*>(header + 1);
+    return result;
+}
@@ -0,0 +1,495 @@
+#pragma once
+
+#include "set.h"
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <initializer_list>
+#include <iterator>
+#include <limits>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Ordered set of unsigned integers stored as a 64-way radix trie of bitmaps.
+// Every node keeps a 64-bit mask of its non-empty children and only the present
+// children, indexed by popcount of the mask below the digit, inline right after the
+// mask in the same allocation; the bitmaps of the last level, 64 keys each, are stored
+// directly in the slots of their parent. Successor and predecessor queries use ctz/clz
+// on the masks, so every operation is O(bits / 6) word operations: 6 levels for 32-bit
+// keys and 11 for 64-bit keys, with no key comparisons.
+template <typename KeyType>
+class IntegerSet {
+    static_assert(std::is_unsigned_v<KeyType>, "IntegerSet needs an unsigned key type");
+
+    static const int kDigitBits = 6;
+    static const int kKeyBits = std::numeric_limits<KeyType>::digits;
+    static const int kLevels = (kKeyBits + kDigitBits - 1) / kDigitBits;
+    static_assert(kLevels >= 2, "IntegerSet needs keys wider than 6 bits");
+
+    struct Node;
+
+    // a child node, or on the level above the last a bitmap of the last level
+    union Slot {
+        Node* child;
+        uint64_t leaf;
+    };
+
+    // the slots are allocated right after the node, one per bit set in bits;
+    // erase shrinks a node in place, so there may be unused slots at the end
+    struct Node {
+        uint64_t bits;
+
+        Slot* Slots() {
+            return reinterpret_cast<Slot*>(this + 1);
+        }
+
+        const Slot* Slots() const {
+            return reinterpret_cast<const Slot*>(this + 1);
+        }
+    };
+
+public:
+    class iterator {
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = KeyType;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const KeyType*;
+        using reference = const KeyType&;
+
+        iterator(): set_{nullptr}, key_{0}, end_{true} {
+        }
+
+        iterator& operator++() {
+            end_ = key_ == std::numeric_limits<KeyType>::max() ||
+                   !set_->Successor(set_->root_, 0, key_ + 1, key_);
+            return *this;
+        }
+
+        iterator operator++(int) {
+            iterator old(*this);
+            this->operator++();
+            return old;
+        }
+
+        iterator& operator--() {
+            if (end_) {
+                key_ = set_->Max(set_->root_, 0);
+                end_ = false;
+            } else {
+                set_->Predecessor(set_->root_, 0, key_ - 1, key_);
+            }
+            return *this;
+        }
+
+        iterator operator--(int) {
+            iterator old(*this);
+            this->operator--();
+            return old;
+        }
+
+        bool operator==(const iterator& rhs) const {
+            return end_ == rhs.end_ && (end_ || key_ == rhs.key_);
+        }
+
+        bool operator!=(const iterator& rhs) const {
+            return !(*this == rhs);
+        }
+
+        const KeyType& operator*() const {
+            return key_;
+        }
+
+        const KeyType* operator->() const {
+            return &key_;
+        }
+
+    private:
+        friend class IntegerSet;
+
+        iterator(const IntegerSet* set, KeyType key, bool end)
+            : set_{set}, key_{key}, end_{end} {
+        }
+
+        const IntegerSet* set_;
+        KeyType key_;
+        bool end_;
+    };
+
+    IntegerSet(): root_{NewNode(0)}, size_{0} {
+    }
+
+    template <typename Iterator>
+    IntegerSet(Iterator first, Iterator last): IntegerSet() {
+        while (first != last) {
+            insert(*first);
+            ++first;
+        }
+    }
+
+    explicit IntegerSet(std::initializer_list<KeyType> init_list)
+                : IntegerSet(init_list.begin(), init_list.end()) {
+    }
+
+    IntegerSet(const IntegerSet& other): root_{Clone(other.root_, 0)}, size_{other.size_} {
+    }
+
+    IntegerSet(IntegerSet&& other): IntegerSet() {
+        swap(other);
+    }
+
+    IntegerSet& operator=(IntegerSet rhs) {
+        swap(rhs);
+        return *this;
+    }
+
+    void swap(IntegerSet& other) {
+        std::swap(root_, other.root_);
+        std::swap(size_, other.size_);
+    }
+
+    ~IntegerSet() {
+        Destroy(root_, 0);
+    }
+
+    iterator begin() const {
+        if (size_ == 0) {
+            return end();
+        }
+        return iterator(this, Min(root_, 0), false);
+    }
+
+    iterator end() const {
+        return iterator(this, 0, true);
+    }
+
+    std::pair<iterator, bool> insert(KeyType key);
+    void erase(KeyType key);
+
+    iterator find(KeyType key) const {
+        const Node* node = root_;
+        for (int level = 0; level + 2 < kLevels; ++level) {
+            int digit = Digit(key, level);
+            if (!((node->bits >> digit) & 1)) {
+                return end();
+            }
+            node = node->Slots()[Rank(node->bits, digit)].child;
+        }
+        int digit = Digit(key, kLevels - 2);
+        if (!((node->bits >> digit) & 1) ||
+            !((node->Slots()[Rank(node->bits, digit)].leaf >> Digit(key, kLevels - 1)) & 1)) {
+            return end();
+        }
+        return iterator(this, key, false);
+    }
+
+    iterator lower_bound(KeyType key) const {
+        KeyType result = 0;
+        if (!Successor(root_, 0, key, result)) {
+            return end();
+        }
+        return iterator(this, result, false);
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    bool empty() const {
+        return size_ == 0;
+    }
+
+private:
+    static int Shift(int level) {
+        return kDigitBits * (kLevels - 1 - level);
+    }
+
+    static int Digit(KeyType key, int level) {
+        return static_cast<int>((key >> Shift(level)) & 63);
+    }
+
+    // position of the child for digit among the present children
+    static size_t Rank(uint64_t bits, int digit) {
+        return std::popcount(bits & ((uint64_t{1} << digit) - 1));
+    }
+
+    // key with the digits of this level and below cleared
+    static KeyType Prefix(KeyType key, int level) {
+        int shift = Shift(level) + kDigitBits;
+        if (shift >= kKeyBits) {
+            return 0;
+        }
+        return key & ~((KeyType{1} << shift) - 1);
+    }
+
+    static Node* NewNode(uint64_t bits);
+    static void FreeNode(Node* node);
+    static Node* AddSlot(Node*& node, int digit, Slot slot);
+    static void RemoveSlot(Node* node, int digit);
+    static Node* Clone(const Node* node, int level);
+    static void Destroy(Node* node, int level);
+    static KeyType Min(const Node* node, int level);
+    static KeyType Max(const Node* node, int level);
+    static bool Successor(const Node* node, int level, KeyType key, KeyType& result);
+    static bool Predecessor(const Node* node, int level, KeyType key, KeyType& result);
+
+    Node* root_;
+    size_t size_;
+};
+
+// opt-in selection of the integer set for integral keys: OrderedSet<uint32_t>
+// is an IntegerSet, OrderedSet<T> is Set<T> for every other T
+template <typename ValueType>
+struct OrderedSetFor {
+    using type = Set<ValueType>;
+};
+
+template <>
+struct OrderedSetFor<uint32_t> {
+    using type = IntegerSet<uint32_t>;
+};
+
+template <>
+struct OrderedSetFor<uint64_t> {
+    using type = IntegerSet<uint64_t>;
+};
+
+template <typename ValueType>
+using OrderedSet = typename OrderedSetFor<ValueType>::type;
+
+
+template <typename KeyType>
+std::pair<typename IntegerSet<KeyType>::iterator, bool> IntegerSet<KeyType>::insert(KeyType key) {
+    Node** slot = &root_;
+    for (int level = 0; level + 2 < kLevels; ++level) {
+        int digit = Digit(key, level);
+        Node* node = *slot;
+        if (!((node->bits >> digit) & 1)) {
+            Node* child = NewNode(0);
+            try {
+                node = AddSlot(*slot, digit, Slot{child});
+            } catch (...) {
+                FreeNode(child);
+                throw;
+            }
+        }
+        slot = &node->Slots()[Rank(node->bits, digit)].child;
+    }
+
+    int digit = Digit(key, kLevels - 2);
+    Node* node = *slot;
+    if (!((node->bits >> digit) & 1)) {
+        Slot empty;
+        empty.leaf = 0;
+        node = AddSlot(*slot, digit, empty);
+    }
+    uint64_t& leaf = node->Slots()[Rank(node->bits, digit)].leaf;
+    uint64_t bit = uint64_t{1} << Digit(key, kLevels - 1);
+    if (leaf & bit) {
+        return {iterator(this, key, false), false};
+    }
+    leaf |= bit;
+    ++size_;
+    return {iterator(this, key, false), true};
+}
+
+template <typename KeyType>
+void IntegerSet<KeyType>::erase(KeyType key) {
+    Node* path[kLevels];
+    Node* node = root_;
+    for (int level = 0; level + 2 < kLevels; ++level) {
+        path[level] = node;
+        int digit = Digit(key, level);
+        if (!((node->bits >> digit) & 1)) {
+            return;
+        }
+        node = node->Slots()[Rank(node->bits, digit)].child;
+    }
+    path[kLevels - 2] = node;
+
+    int digit = Digit(key, kLevels - 2);
+    if (!((node->bits >> digit) & 1)) {
+        return;
+    }
+    uint64_t& leaf = node->Slots()[Rank(node->bits, digit)].leaf;
+    uint64_t bit = uint64_t{1} << Digit(key, kLevels - 1);
+    if (!(leaf & bit)) {
+        return;
+    }
+    leaf &= ~bit;
+    --size_;
+    if (leaf != 0) {
+        return;
+    }
+
+    // drop the slots and nodes that became empty, bottom-up; the root always stays
+    for (int level = kLevels - 2; level >= 0; --level) {
+        node = path[level];
+        RemoveSlot(node, Digit(key, level));
+        if (node->bits != 0 || level == 0) {
+            break;
+        }
+        FreeNode(node);
+    }
+}
+
+template <typename KeyType>
+typename IntegerSet<KeyType>::Node* IntegerSet<KeyType>::NewNode(uint64_t bits) {
+    void* memory = ::operator new(sizeof(Node) + std::popcount(bits) * sizeof(Slot));
+    Node* node = new (memory) Node;
+    node->bits = bits;
+    return node;
+}
+
+template <typename KeyType>
+void IntegerSet<KeyType>::FreeNode(Node* node) {
+    ::operator delete(node);
+}
+
+// reallocates node with one more slot for digit and stores the new node in place
+template <typename KeyType>
+typename IntegerSet<KeyType>::Node* IntegerSet<KeyType>::AddSlot(Node*& node, int digit,
+                                                                 Slot slot) {
+    size_t count = std::popcount(node->bits);
+    size_t rank = Rank(node->bits, digit);
+    Node* grown = NewNode(node->bits | (uint64_t{1} << digit));
+    std::copy(node->Slots(), node->Slots() + rank, grown->Slots());
+    grown->Slots()[rank] = slot;
+    std::copy(node->Slots() + rank, node->Slots() + count, grown->Slots() + rank + 1);
+    FreeNode(node);
+    node = grown;
+    return grown;
+}
+
+// never allocates, the freed slot stays unused at the end of the node
+template <typename KeyType>
+void IntegerSet<KeyType>::RemoveSlot(Node* node, int digit) {
+    size_t count = std::popcount(node->bits);
+    size_t rank = Rank(node->bits, digit);
+    std::copy(node->Slots() + rank + 1, node->Slots() + count, node->Slots() + rank);
+    node->bits &= ~(uint64_t{1} << digit);
+}
+
+// the copy only claims the children cloned so far, so a failed clone can be destroyed
+template <typename KeyType>
+typename IntegerSet<KeyType>::Node* IntegerSet<KeyType>::Clone(const Node* node, int level) {
+    size_t count = std::popcount(node->bits);
+    Node* copy = NewNode(node->bits);
+    if (level + 2 == kLevels) {
+        std::copy(node->Slots(), node->Slots() + count, copy->Slots());
+        return copy;
+    }
+    copy->bits = 0;
+    try {
+        for (size_t i = 0; i < count; ++i) {
+            copy->Slots()[i].child = Clone(node->Slots()[i].child, level + 1);
+            copy->bits |= uint64_t{1} << std::countr_zero(node->bits & ~copy->bits);
+        }
+    } catch (...) {
+        Destroy(copy, level);
+        throw;
+    }
+    return copy;
+}
+
+template <typename KeyType>
+void IntegerSet<KeyType>::Destroy(Node* node, int level) {
+    if (level + 2 < kLevels) {
+        for (size_t i = 0, count = std::popcount(node->bits); i < count; ++i) {
+            Destroy(node->Slots()[i].child, level + 1);
+        }
+    }
+    FreeNode(node);
+}
+
+// node must not be empty
+template <typename KeyType>
+KeyType IntegerSet<KeyType>::Min(const Node* node, int level) {
+    KeyType result = 0;
+    for (; level + 2 < kLevels; ++level) {
+        result |= static_cast<KeyType>(std::countr_zero(node->bits)) << Shift(level);
+        node = node->Slots()[0].child;
+    }
+    result |= static_cast<KeyType>(std::countr_zero(node->bits)) << Shift(kLevels - 2);
+    return result | static_cast<KeyType>(std::countr_zero(node->Slots()[0].leaf));
+}
+
+template <typename KeyType>
+KeyType IntegerSet<KeyType>::Max(const Node* node, int level) {
+    KeyType result = 0;
+    for (; level + 2 < kLevels; ++level) {
+        result |= static_cast<KeyType>(63 - std::countl_zero(node->bits)) << Shift(level);
+        node = node->Slots()[std::popcount(node->bits) - 1].child;
+    }
+    uint64_t leaf = node->Slots()[std::popcount(node->bits) - 1].leaf;
+    result |= static_cast<KeyType>(63 - std::countl_zero(node->bits)) << Shift(kLevels - 2);
+    return result | static_cast<KeyType>(63 - std::countl_zero(leaf));
+}
+
+// smallest key >= key below node, whose digits above level are taken from key
+template <typename KeyType>
+bool IntegerSet<KeyType>::Successor(const Node* node, int level, KeyType key, KeyType& result) {
+    int digit = Digit(key, level);
+    bool present = (node->bits >> digit) & 1;
+    if (level + 2 == kLevels) {
+        uint64_t above = present ? node->Slots()[Rank(node->bits, digit)].leaf &
+                                       (~uint64_t{0} << Digit(key, kLevels - 1))
+                                 : 0;
+        if (above) {
+            result = Prefix(key, kLevels - 1) | static_cast<KeyType>(std::countr_zero(above));
+            return true;
+        }
+    } else if (present &&
+               Successor(node->Slots()[Rank(node->bits, digit)].child, level + 1, key, result)) {
+        return true;
+    }
+
+    uint64_t above = digit == 63 ? 0 : node->bits & (~uint64_t{0} << (digit + 1));
+    if (!above) {
+        return false;
+    }
+    int next = std::countr_zero(above);
+    const Slot& slot = node->Slots()[Rank(node->bits, next)];
+    result = Prefix(key, level) | (static_cast<KeyType>(next) << Shift(level));
+    if (level + 2 == kLevels) {
+        result |= static_cast<KeyType>(std::countr_zero(slot.leaf));
+    } else {
+        result |= Min(slot.child, level + 1);
+    }
+    return true;
+}
+
+// largest key <= key below node
+template <typename KeyType>
+bool IntegerSet<KeyType>::Predecessor(const Node* node, int level, KeyType key,
+                                      KeyType& result) {
+    int digit = Digit(key, level);
+    bool present = (node->bits >> digit) & 1;
+    if (level + 2 == kLevels) {
+        int last = Digit(key, kLevels - 1);
+        uint64_t upto = last == 63 ? ~uint64_t{0} : (uint64_t{1} << (last + 1)) - 1;
+        uint64_t below = present ? node->Slots()[Rank(node->bits, digit)].leaf & upto : 0;
+        if (below) {
+            result = Prefix(key, kLevels - 1) | static_cast<KeyType>(63 - std::countl_zero(below));
+            return true;
+        }
+    } else if (present &&
+               Predecessor(node->Slots()[Rank(node->bits, digit)].child, level + 1, key, result)) {
+        return true;
+    }
+
+    uint64_t below = node->bits & ((uint64_t{1} << digit) - 1);
+    if (!below) {
+        return false;
+    }
+    int next = 63 - std::countl_zero(below);
+    const Slot& slot = node->Slots()[Rank(node->bits, next)];
+    result = Prefix(key, level) | (static_cast<KeyType>(next) << Shift(level));
+    if (level + 2 == kLevels) {
+        result |= static_cast<KeyType>(63 - std::countl_zero(slot.leaf));
+    } else {
+        result |= Max(slot.child, level + 1);
+    }
+    return true;
+}
@@ -1,8 +1,24 @@
 #include "set.h"
+#include "bulk_load.h"
+#include "concurrent_set.h"
+#include "frozen_set.h"
+#include "integer_set.h"
+#include "persistent_set.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
 #include <cstdlib>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <iterator>
 #include <set>
+#include <stdexcept>
 #include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
 
 void fail(const char *message) {
     std::cerr << "Fail:\n";
@@ -217,6 +233,695 @@ void check_erase() {
     std::cerr << "ok!\n";
 }
 
+/* check insert return value and hinted insertion */
+void check_hint_insert() {
+    std::cerr << "check hinted insert... ";
+    Set<int> s;
+    auto res = s.insert(5);
+    if (!res.second || *res.first != 5)
+        fail("wrong insert result");
+    res = s.insert(5);
+    if (res.second || *res.first != 5 || s.size() != 1)
+        fail("wrong insert result for duplicate");
+
+    Set<int> sorted;
+    for (int i = 0; i < 1000; ++i)
+        sorted.insert(sorted.end(), i);
+    Set<int> reversed;
+    auto hint = reversed.end();
+    for (int i = 999; i >= 0; --i)
+        hint = reversed.insert(hint, i);
+    Set<int> mixed;
+    for (int i = 0; i < 1000; ++i)
+        mixed.emplace_hint(mixed.begin(), (i * 7919) % 1000);
+    if (sorted.size() != 1000 || reversed.size() != 1000 || mixed.size() != 1000)
+        fail("wrong size after hinted insert");
+    auto it = sorted.begin(), rit = reversed.begin(), mit = mixed.begin();
+    for (int i = 0; i < 1000; ++i, ++it, ++rit, ++mit) {
+        if (*it != i || *rit != i || *mit != i)
+            fail("wrong order after hinted insert");
+    }
+    if (*sorted.insert(sorted.begin(), 500) != 500 || sorted.size() != 1000)
+        fail("wrong hinted insert of duplicate");
+    std::cerr << "ok!\n";
+}
+
+/* check move semantics, emplace and node handles */
+void check_move_and_nodes() {
+    std::cerr << "check move and node handles... ";
+    Set<std::string> s{"b", "a", "c"};
+    Set<std::string> moved(std::move(s));
+    if (moved.size() != 3 || !s.empty() || s.begin() != s.end())
+        fail("wrong move constructor");
+    s = std::move(moved);
+    if (s.size() != 3 || !moved.empty() || *s.begin() != "a")
+        fail("wrong move assignment");
+    static_assert(std::is_nothrow_move_constructible_v<Set<std::string>> &&
+                  std::is_nothrow_move_assignable_v<Set<std::string>>);
+    std::vector<Set<std::string>> sets(1);
+    sets[0].insert("x");
+    auto first_node = sets[0].begin();
+    for (int i = 0; i < 100; ++i)
+        sets.emplace_back();
+    if (sets[0].begin() != first_node || *sets[0].begin() != "x" || !sets[1].empty())
+        fail("vector reallocation copied the sets");
+    moved.insert("z");
+    moved.erase("z");
+    if (!moved.empty() || moved.begin() != moved.end())
+        fail("wrong update of moved-from set");
+
+    std::string long_string(100, 'x');
+    const char* buffer = long_string.data();
+    auto res = s.insert(std::move(long_string));
+    if (!res.second || res.first->data() != buffer)
+        fail("insert(ValueType&&) copied the value");
+    if (!s.emplace(3, 'd').second || s.emplace("a").second || s.size() != 5)
+        fail("wrong emplace");
+
+    auto node = s.extract("b");
+    if (node.empty() || s.size() != 4 || s.find("b") != s.end())
+        fail("wrong extract");
+    node.value() = "e";
+    auto inserted = s.insert(std::move(node));
+    if (!inserted.inserted || *inserted.position != "e" || !inserted.node.empty())
+        fail("wrong node insert");
+    if (!s.extract("missing").empty())
+        fail("wrong extract of missing value");
+
+    Set<std::string> other{"a", "f", "g"};
+    s.merge(other);
+    if (s.size() != 7 || other.size() != 1 || *other.begin() != "a")
+        fail("wrong merge");
+    std::string expected[] = {"a", "c", "ddd", "e", "f", "g", std::string(100, 'x')};
+    size_t idx = 0;
+    for (auto it = s.begin(); it != s.end(); ++it, ++idx) {
+        if (*it != expected[idx])
+            fail("wrong order after merge");
+    }
+
+    StrangeInt::init();
+    {
+        Set<StrangeInt> a{1, 2, 3};
+        Set<StrangeInt> b{3, 4};
+        a.merge(b);
+        auto extracted = a.extract(2);
+        Set<StrangeInt> c(std::move(a));
+        a = std::move(c);
+    }
+    if (StrangeInt::counter)
+        fail("wrong destructor after node handles");
+    std::cerr << "ok!\n";
+}
+
+/* check union, intersection and difference against std algorithms */
+void check_set_algebra() {
+    std::cerr << "check set algebra... ";
+    std::vector<int> lhs, rhs;
+    for (int i = 0; i < 20000; ++i) {
+        lhs.push_back((i * 7919) % 30011);
+        rhs.push_back((i * 104729) % 40009);
+    }
+    std::set<int> lhs_set(lhs.begin(), lhs.end()), rhs_set(rhs.begin(), rhs.end());
+    Set<int> rhs_tree(rhs.begin(), rhs.end());
+
+    for (int op = 0; op < 3; ++op) {
+        Set<int> tree(lhs.begin(), lhs.end());
+        std::vector<int> expected;
+        if (op == 0) {
+            tree.union_with(rhs_tree);
+            std::set_union(lhs_set.begin(), lhs_set.end(), rhs_set.begin(), rhs_set.end(),
+                           std::back_inserter(expected));
+        } else if (op == 1) {
+            tree.intersect_with(rhs_tree);
+            std::set_intersection(lhs_set.begin(), lhs_set.end(), rhs_set.begin(),
+                                  rhs_set.end(), std::back_inserter(expected));
+        } else {
+            tree.difference_with(rhs_tree);
+            std::set_difference(lhs_set.begin(), lhs_set.end(), rhs_set.begin(), rhs_set.end(),
+                                std::back_inserter(expected));
+        }
+        if (tree.size() != expected.size() ||
+            !std::equal(expected.begin(), expected.end(), tree.begin()))
+            fail("wrong set algebra result");
+        auto last = tree.end();
+        for (auto it = expected.rbegin(); it != expected.rend(); ++it) {
+            if (*(--last) != *it)
+                fail("wrong backward iteration after set algebra");
+        }
+        tree.insert(-1);
+        tree.erase(expected.front());
+        if (*tree.begin() != -1 || tree.size() != expected.size())
+            fail("wrong update after set algebra");
+    }
+    if (rhs_tree.size() != rhs_set.size())
+        fail("const set algebra changed its argument");
+
+    // perfectly balanced inputs of 2^13 and more keys have black height 13 and
+    // above, past the threshold where the recursion forks into async tasks
+    std::vector<int> evens, thirds;
+    for (int i = 0; i < 40000; ++i)
+        evens.push_back(2 * i);
+    for (int i = 0; i < 30000; ++i)
+        thirds.push_back(3 * i);
+    const Set<int> thirds_tree = Set<int>::from_sorted(thirds.begin(), thirds.size());
+    for (int op = 0; op < 3; ++op) {
+        Set<int> tree = Set<int>::from_sorted(evens.begin(), evens.size());
+        std::vector<int> expected;
+        if (op == 0) {
+            tree.union_with(thirds_tree);
+            std::set_union(evens.begin(), evens.end(), thirds.begin(), thirds.end(),
+                           std::back_inserter(expected));
+        } else if (op == 1) {
+            tree.intersect_with(Set<int>(thirds_tree));
+            std::set_intersection(evens.begin(), evens.end(), thirds.begin(), thirds.end(),
+                                  std::back_inserter(expected));
+        } else {
+            tree.difference_with(thirds_tree);
+            std::set_difference(evens.begin(), evens.end(), thirds.begin(), thirds.end(),
+                                std::back_inserter(expected));
+        }
+        if (tree.size() != expected.size() ||
+            !std::equal(expected.begin(), expected.end(), tree.begin()))
+            fail("wrong forked set algebra result");
+        if (*(--tree.end()) != expected.back())
+            fail("wrong backward iteration after forked set algebra");
+        for (size_t i = 0; i < expected.size(); i += 2)
+            tree.erase(expected[i]);
+        if (tree.size() != expected.size() / 2 || *tree.begin() != expected[1])
+            fail("wrong erase after forked set algebra");
+    }
+    if (thirds_tree.size() != thirds.size() ||
+        !std::equal(thirds.begin(), thirds.end(), thirds_tree.begin()))
+        fail("const forked set algebra changed its argument");
+
+    Set<std::string> words{"a", "b"};
+    Set<std::string> more{"b", "c"};
+    words.union_with(std::move(more));
+    if (words.size() != 3 || !more.empty())
+        fail("wrong union of moved set");
+    std::cerr << "ok!\n";
+}
+
+struct CopyCountingInt {
+    int x;
+    static int copies;
+    CopyCountingInt(int x): x(x) {
+    }
+    CopyCountingInt(const CopyCountingInt& rs): x(rs.x) {
+        ++copies;
+    }
+    bool operator <(const CopyCountingInt& rs) const {
+        return x < rs.x;
+    }
+};
+int CopyCountingInt::copies;
+
+/* check that persistent versions do not affect each other */
+void check_persistent() {
+    std::cerr << "check persistent set... ";
+    PersistentSet<int> empty;
+    PersistentSet<int> first = empty.insert(5).insert(1).insert(3);
+    PersistentSet<int> second = first.insert(4).erase(1);
+    PersistentSet<int> snapshot = second;
+    if (!empty.empty() || first.size() != 3 || second.size() != 3)
+        fail("wrong persistent size");
+    if (first.find(1) == first.end() || second.find(1) != second.end())
+        fail("erase changed old version");
+    if (first.find(4) != first.end() || *second.lower_bound(4) != 4)
+        fail("insert changed old version");
+    if (first.insert(3).size() != 3 || first.erase(42).size() != 3)
+        fail("wrong persistent insert/erase of existing/missing value");
+
+    std::set<int> expected;
+    PersistentSet<int> big;
+    for (int i = 0; i < 5000; ++i) {
+        int value = (i * 7919) % 3001;
+        if (i % 3 == 2) {
+            big = big.erase(value);
+            expected.erase(value);
+        } else {
+            big = big.insert(value);
+            expected.insert(value);
+        }
+    }
+    if (big.size() != expected.size() || !std::equal(expected.begin(), expected.end(), big.begin()))
+        fail("wrong persistent set content");
+    auto last = big.end();
+    if (*(--last) != *expected.rbegin() || *snapshot.begin() != 3)
+        fail("wrong persistent iteration");
+
+    StrangeInt::init();
+    {
+        PersistentSet<StrangeInt> s{3, 1, 2};
+        PersistentSet<StrangeInt> t = s.erase(2).insert(7);
+    }
+    if (StrangeInt::counter)
+        fail("persistent set leaks nodes");
+
+    // erasing a missing value copies no path
+    {
+        PersistentSet<CopyCountingInt> s;
+        for (int i = 0; i < 1000; i += 2) {
+            s = s.insert(i);
+        }
+        CopyCountingInt::copies = 0;
+        PersistentSet<CopyCountingInt> t = s.erase(501).erase(-1).erase(1001);
+        if (CopyCountingInt::copies != 0 || t.size() != s.size())
+            fail("persistent erase of a missing value copies nodes");
+    }
+    std::cerr << "ok!\n";
+}
+
+/* check concurrent set under simultaneous inserts and erases */
+void check_concurrent() {
+    std::cerr << "check concurrent set... ";
+    ConcurrentSet<std::string> words;
+    if (!words.insert("b") || !words.insert("a") || words.insert("a") || words.size() != 2)
+        fail("wrong concurrent insert");
+    if (*words.begin() != "a" || *words.lower_bound("aa") != "b" || words.find("c") != words.end())
+        fail("wrong concurrent lookup");
+    if (!words.erase("a") || words.erase("a") || words.size() != 1)
+        fail("wrong concurrent erase");
+
+    ConcurrentSet<int> s;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&s, t] {
+            for (int i = 0; i < 2000; ++i) {
+                s.insert(t * 10000 + i);
+                s.insert(i % 100);
+                if (i % 2 == 0)
+                    s.erase(t * 10000 + i);
+                s.erase((i + 50) % 100);
+                auto it = s.lower_bound(i % 100);
+                if (it != s.end() && *it < i % 100)
+                    fail("wrong concurrent lower_bound");
+            }
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+    size_t count = 0;
+    int previous = -1;
+    for (auto it = s.begin(); it != s.end(); ++it, ++count) {
+        if (*it <= previous)
+            fail("wrong concurrent order");
+        previous = *it;
+    }
+    if (count != s.size())
+        fail("wrong concurrent size");
+    for (int t = 0; t < 4; ++t) {
+        for (int i = 0; i < 2000; ++i) {
+            if ((s.find(t * 10000 + i) != s.end()) != (i % 2 == 1) && t * 10000 + i >= 100)
+                fail("lost concurrent update");
+        }
+    }
+
+    // every thread inserts and erases the same few keys, so erases race with
+    // inserters still linking upper levels and retired nodes get reclaimed
+    ConcurrentSet<int> contended;
+    threads.clear();
+    for (int t = 0; t < 8; ++t) {
+        threads.emplace_back([&contended, t] {
+            unsigned state = static_cast<unsigned>(t) * 2654435761u + 1;
+            for (int i = 0; i < 20000; ++i) {
+                state = state * 1103515245u + 12345u;
+                int key = static_cast<int>((state >> 16) % 16);
+                if ((state >> 8) % 2 == 0)
+                    contended.insert(key);
+                else
+                    contended.erase(key);
+                int previous = -1;
+                for (auto it = contended.lower_bound(key / 2); it != contended.end(); ++it) {
+                    if (*it <= previous || *it < key / 2)
+                        fail("wrong order under contended updates");
+                    previous = *it;
+                }
+            }
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+    count = 0;
+    previous = -1;
+    for (auto it = contended.begin(); it != contended.end(); ++it, ++count) {
+        if (*it <= previous || contended.find(*it) == contended.end())
+            fail("wrong contended order");
+        previous = *it;
+    }
+    if (count != contended.size())
+        fail("wrong contended size");
+    for (int key = 0; key < 16; ++key) {
+        bool present = contended.find(key) != contended.end();
+        if (contended.insert(key) == present || !contended.erase(key))
+            fail("wrong insert/erase after contended updates");
+    }
+    if (!contended.empty())
+        fail("wrong size after contended updates");
+    std::cerr << "ok!\n";
+}
+
+/* check cached extremes and double-ended priority queue operations */
+void check_min_max() {
+    std::cerr << "check min/max... ";
+    Set<int> s;
+    std::set<int> expected;
+    for (int i = 0; i < 1000; ++i) {
+        int value = (i * 7919) % 1009;
+        s.insert(value);
+        expected.insert(value);
+    }
+    while (!expected.empty()) {
+        if (s.min() != *expected.begin() || s.max() != *expected.rbegin() ||
+            *s.begin() != s.min() || *(--s.end()) != s.max())
+            fail("wrong min/max");
+        if (expected.size() % 2) {
+            if (s.pop_min() != *expected.begin())
+                fail("wrong pop_min");
+            expected.erase(expected.begin());
+        } else {
+            if (s.pop_max() != *expected.rbegin())
+                fail("wrong pop_max");
+            expected.erase(--expected.end());
+        }
+        if (s.size() != expected.size())
+            fail("wrong size after pop");
+    }
+    if (!s.empty() || s.begin() != s.end())
+        fail("wrong empty after pops");
+
+    Set<int> t{1, 2, 3, 4, 5, 6};
+    auto it = t.begin();
+    while (it != t.end()) {
+        if (*it % 2 == 0)
+            it = t.erase(it);
+        else
+            ++it;
+    }
+    if (t.size() != 3 || t.min() != 1 || t.max() != 5 || *(--t.end()) != 5)
+        fail("wrong erase by iterator");
+    t.union_with(Set<int>{0, 9});
+    if (t.min() != 0 || t.max() != 9)
+        fail("wrong min/max after union");
+    std::cerr << "ok!\n";
+}
+
+/* check Eytzinger layout searches, iteration and file mapping */
+void check_frozen() {
+    std::cerr << "check frozen set... ";
+    for (int n = 0; n < 70; ++n) {
+        Set<int> s;
+        for (int i = 0; i < n; ++i)
+            s.insert(2 * i);
+        FrozenSet<int> frozen(s);
+        if (frozen.size() != s.size() || !std::equal(s.begin(), s.end(), frozen.begin()))
+            fail("wrong frozen iteration");
+        auto last = frozen.end();
+        for (int i = n - 1; i >= 0; --i) {
+            if (*(--last) != 2 * i)
+                fail("wrong frozen backward iteration");
+        }
+        for (int value = -1; value <= 2 * n; ++value) {
+            auto lower = frozen.lower_bound(value);
+            auto upper = frozen.upper_bound(value);
+            int expected_lower = value <= 0 ? 0 : (value + 1) / 2 * 2;
+            int expected_upper = value < 0 ? 0 : value / 2 * 2 + 2;
+            if ((expected_lower >= 2 * n) != (lower == frozen.end()) ||
+                (lower != frozen.end() && *lower != expected_lower))
+                fail("wrong frozen lower_bound");
+            if ((expected_upper >= 2 * n) != (upper == frozen.end()) ||
+                (upper != frozen.end() && *upper != expected_upper))
+                fail("wrong frozen upper_bound");
+            if ((frozen.find(value) != frozen.end()) != (s.find(value) != s.end()))
+                fail("wrong frozen find");
+        }
+    }
+
+    std::vector<long long> values;
+    for (long long i = 0; i < 1000; ++i)
+        values.push_back(i * i);
+    FrozenSet<long long> frozen(values.begin(), values.end());
+    std::string path = (std::filesystem::temp_directory_path() / "frozen_set_test.bin").string();
+    frozen.save(path);
+    {
+        FrozenSet<long long> mapped = FrozenSet<long long>::map(path);
+        if (mapped.size() != values.size() ||
+            !std::equal(values.begin(), values.end(), mapped.begin()))
+            fail("wrong mapped frozen set");
+        if (*mapped.lower_bound(50) != 64 || mapped.find(63) != mapped.end())
+            fail("wrong mapped frozen lookup");
+    }
+    // a count whose byte size wraps around must not pass for the file length
+    {
+        std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+        uint64_t bogus_count = (uint64_t{1} << 61) + 1;
+        file.seekp(16);
+        file.write(reinterpret_cast<const char*>(&bogus_count), sizeof(bogus_count));
+    }
+    bool rejected = false;
+    try {
+        FrozenSet<long long>::map(path);
+    } catch (const std::runtime_error&) {
+        rejected = true;
+    }
+    if (!rejected)
+        fail("mapped a frozen set file with a bogus count");
+    std::remove(path.c_str());
+    std::cerr << "ok!\n";
+}
+
+/* compare the integer set with std::set on random operations */
+template <typename KeyType>
+void check_integer_set_for(KeyType mask) {
+    IntegerSet<KeyType> s;
+    std::set<KeyType> expected;
+    uint64_t state = 12345;
+    for (int i = 0; i < 20000; ++i) {
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        KeyType key = static_cast<KeyType>(state >> 7) & mask;
+        if (i % 3 == 2) {
+            s.erase(key);
+            expected.erase(key);
+        } else if (s.insert(key).second != expected.insert(key).second) {
+            fail("wrong integer set insert");
+        }
+        auto lower = s.lower_bound(key ^ 1);
+        auto expected_lower = expected.lower_bound(key ^ 1);
+        if ((lower == s.end()) != (expected_lower == expected.end()) ||
+            (lower != s.end() && *lower != *expected_lower))
+            fail("wrong integer set lower_bound");
+    }
+    if (s.size() != expected.size() || !std::equal(expected.begin(), expected.end(), s.begin()))
+        fail("wrong integer set content");
+    auto last = s.end();
+    for (auto it = expected.rbegin(); it != expected.rend(); ++it) {
+        if (*(--last) != *it)
+            fail("wrong integer set backward iteration");
+    }
+    IntegerSet<KeyType> copy = s;
+    for (KeyType key : expected) {
+        if (copy.find(key) == copy.end())
+            fail("wrong integer set find");
+        copy.erase(key);
+    }
+    if (!copy.empty() || copy.begin() != copy.end() || s.size() != expected.size())
+        fail("wrong integer set erase");
+    for (KeyType key : expected)
+        copy.insert(key);
+    if (copy.size() != expected.size() || !std::equal(expected.begin(), expected.end(), copy.begin()))
+        fail("wrong integer set insert after erasing everything");
+}
+
+void check_integer_set() {
+    std::cerr << "check integer set... ";
+    check_integer_set_for<uint32_t>(0xFFFFFFFFu);
+    check_integer_set_for<uint32_t>(0x3FFFu);
+    check_integer_set_for<uint64_t>(~0ull);
+    check_integer_set_for<uint64_t>(0xFFFF00000000FFFFull);
+    check_integer_set_for<uint16_t>(0xFFFFu);
+    check_integer_set_for<uint8_t>(0xFFu);
+
+    IntegerSet<uint32_t> edges{0, 0xFFFFFFFFu};
+    if (*edges.begin() != 0 || *(--edges.end()) != 0xFFFFFFFFu || ++(++edges.begin()) != edges.end())
+        fail("wrong integer set edges");
+    static_assert(std::is_same_v<OrderedSet<uint32_t>, IntegerSet<uint32_t>>);
+    static_assert(std::is_same_v<OrderedSet<int>, Set<int>>);
+    std::cerr << "ok!\n";
+}
+
+/* cached subtree aggregates: range sums over a custom value, min, and interval overlap */
+struct Reading {
+    int time;
+    int value;
+
+    bool operator<(const Reading& rhs) const {
+        return time < rhs.time;
+    }
+};
+
+struct ReadingSum {
+    using summary_type = long long;
+
+    static long long identity() {
+        return 0;
+    }
+
+    static long long lift(const Reading& reading) {
+        return reading.value;
+    }
+
+    static long long combine(long long lhs, long long rhs) {
+        return lhs + rhs;
+    }
+};
+
+void check_augmented() {
+    std::cerr << "check augmented... ";
+    Set<Reading, ReadingSum> readings;
+    std::vector<int> values(1000, 0);
+    std::vector<bool> present(1000, false);
+    for (int i = 0; i < 3000; ++i) {
+        int time = (i * 7919) % 1000;
+        if (i % 3 == 2) {
+            readings.erase(Reading{time, 0});
+            present[time] = false;
+        } else if (!present[time]) {
+            readings.insert(Reading{time, i % 97 - 40});
+            values[time] = i % 97 - 40;
+            present[time] = true;
+        }
+    }
+    for (int lo = 0; lo < 1000; lo += 37) {
+        for (int hi = lo; hi <= 1000; hi += 53) {
+            long long expected = 0;
+            for (int time = lo; time < hi; ++time)
+                expected += present[time] ? values[time] : 0;
+            if (readings.aggregate(Reading{lo, 0}, Reading{hi, 0}) != expected)
+                fail("wrong range sum");
+        }
+    }
+    long long total = 0;
+    for (int time = 0; time < 1000; ++time)
+        total += present[time] ? values[time] : 0;
+    if (readings.aggregate() != total)
+        fail("wrong total sum");
+
+    Set<int, augment::Min<int>> lhs{5, 9, 40, 41};
+    Set<int, augment::Min<int>> rhs{3, 8, 100};
+    lhs.union_with(std::move(rhs));
+    if (lhs.aggregate() != 3 || lhs.aggregate(4, 100) != 5 || lhs.aggregate(10, 40) != 2147483647)
+        fail("wrong min after union");
+    lhs.difference_with(Set<int, augment::Min<int>>{3, 5});
+    if (lhs.aggregate() != 8 || lhs.pop_min() != 8 || lhs.aggregate() != 9)
+        fail("wrong min after difference");
+
+    using Interval = std::pair<int, int>;
+    Set<Interval, augment::IntervalMaxEnd<int>> intervals;
+    std::vector<Interval> stored;
+    for (int i = 0; i < 500; ++i) {
+        int start = (i * 131) % 1000;
+        Interval interval{start, start + 1 + (i * 17) % 60};
+        if (intervals.insert(interval).second)
+            stored.push_back(interval);
+    }
+    std::sort(stored.begin(), stored.end());
+    for (int start = 0; start < 1100; start += 13) {
+        Interval query{start, start + 25};
+        std::vector<Interval> expected;
+        for (const auto& interval : stored)
+            if (interval.first < query.second && query.first < interval.second)
+                expected.push_back(interval);
+        std::vector<Interval> found;
+        intervals.overlapping(query, [&found](const Interval& interval) {
+            found.push_back(interval);
+        });
+        if (found != expected)
+            fail("wrong overlapping intervals");
+    }
+    std::cerr << "ok!\n";
+}
+
+/* O(n) build from sorted input and the external-sort bulk loader */
+void check_bulk_load() {
+    std::cerr << "check bulk load... ";
+    for (int n = 0; n < 70; ++n) {
+        std::vector<int> values;
+        for (int i = 0; i < n; ++i)
+            values.push_back(3 * i);
+        Set<int> s = Set<int>::from_sorted(values.begin(), values.size());
+        if (s.size() != values.size() || !std::equal(values.begin(), values.end(), s.begin()))
+            fail("wrong from_sorted iteration");
+        if (n > 0 && (s.min() != 0 || s.max() != 3 * (n - 1)))
+            fail("wrong from_sorted extremes");
+        if (s.height() > 1 + 2 * static_cast<size_t>(std::log2(n + 1)))
+            fail("from_sorted tree too high");
+        for (int i = 0; i < n; i += 2)
+            s.erase(3 * i);
+        s.insert(-1);
+        if (s.size() != static_cast<size_t>(n / 2 + 1) || *s.begin() != -1)
+            fail("wrong update after from_sorted");
+    }
+
+    Set<int, augment::Sum<int>> summed = Set<int, augment::Sum<int>>::from_sorted(
+        std::vector<int>{1, 2, 3, 4, 5}.begin(), 5);
+    if (summed.aggregate() != 15 || summed.aggregate(2, 5) != 9)
+        fail("wrong aggregate after from_sorted");
+
+    std::vector<uint32_t> keys;
+    std::set<uint32_t> expected;
+    for (uint32_t i = 0; i < 20000; ++i) {
+        keys.push_back(i * 2654435761u % 7919);
+        expected.insert(keys.back());
+    }
+    std::string path = (std::filesystem::temp_directory_path() / "bulk_load_test.bin").string();
+    {
+        std::ofstream out(path, std::ios::binary);
+        out.write(reinterpret_cast<const char*>(keys.data()), keys.size() * sizeof(uint32_t));
+    }
+    BulkLoadOptions options;
+    options.memory_budget = 4096;
+    options.temp_dir = std::filesystem::temp_directory_path().string();
+    BulkLoadStats stats;
+    Set<uint32_t> loaded = bulk_load<uint32_t>(path, options, &stats);
+    std::remove(path.c_str());
+    if (loaded.size() != expected.size() ||
+        !std::equal(expected.begin(), expected.end(), loaded.begin()))
+        fail("wrong bulk loaded set");
+    // 20 runs cannot share a budget below two 64 KB buffers, so they are merged
+    // two at a time: 20 -> 10 -> 5 -> 3 -> 2 -> output
+    if (stats.keys != keys.size() || stats.unique_keys != expected.size() || stats.runs != 20 ||
+        stats.merge_passes != 5 || stats.input_bytes != keys.size() * sizeof(uint32_t))
+        fail("wrong bulk load stats");
+
+    for (size_t budget : {size_t{1} << 20, size_t{4} << 10}) {
+        std::vector<uint32_t> sorted;
+        for (uint32_t i = 0; i < 100000; ++i)
+            sorted.push_back(i * 2654435761u);
+        {
+            std::ofstream out(path, std::ios::binary);
+            out.write(reinterpret_cast<const char*>(sorted.data()),
+                      sorted.size() * sizeof(uint32_t));
+        }
+        std::sort(sorted.begin(), sorted.end());
+        options.memory_budget = budget;
+        std::string sorted_path = path + ".sorted";
+        stats = sort_unique_file<uint32_t>(path, sorted_path, options);
+        std::vector<uint32_t> merged(sorted.size() + 1);
+        {
+            std::ifstream in(sorted_path, std::ios::binary);
+            in.read(reinterpret_cast<char*>(merged.data()), merged.size() * sizeof(uint32_t));
+            merged.resize(static_cast<size_t>(in.gcount()) / sizeof(uint32_t));
+        }
+        std::remove(path.c_str());
+        std::remove(sorted_path.c_str());
+        if (merged != sorted || stats.unique_keys != sorted.size())
+            fail("wrong multi-pass merge");
+        if ((budget == size_t{1} << 20) != (stats.merge_passes == 1))
+            fail("wrong number of merge passes");
+    }
+    std::cerr << "ok!\n";
+}
+
 void run_all() {
     check_constness();
     check_empty();
@@ -225,6 +930,16 @@ void run_all() {
     check_erase();
     check_copy_correctness();
     check_destructor();
+    check_hint_insert();
+    check_move_and_nodes();
+    check_set_algebra();
+    check_persistent();
+    check_concurrent();
+    check_min_max();
+    check_frozen();
+    check_integer_set();
+    check_augmented();
+    check_bulk_load();
 }
 }
 
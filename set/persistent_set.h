@@ -0,0 +1,471 @@
+#pragma once
+
+#include "set.h"
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Immutable red-black set: insert and erase return a new version which shares every
+// untouched subtree with the old one, so a snapshot is a copy of one pointer.
+// Nodes are never modified after construction and are freed by reference counting,
+// so versions may be handed to other threads and read there without locking.
+template <typename ValueType>
+class PersistentSet {
+    struct Node;
+    using NodePtr = std::shared_ptr<const Node>;
+
+    struct Node {
+        Node(Color color, NodePtr left, const ValueType& value, NodePtr right)
+            : value_{value}, left_{std::move(left)}, right_{std::move(right)}, color_{color} {
+        }
+
+        ValueType value_;
+        NodePtr left_;
+        NodePtr right_;
+        Color color_;
+    };
+
+    // a tree with a black (or empty) root and its black height
+    struct Subtree {
+        NodePtr root;
+        int black_height;
+    };
+
+public:
+    class iterator {
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = ValueType;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const ValueType*;
+        using reference = const ValueType&;
+
+        iterator(): root_{nullptr} {
+        }
+
+        iterator& operator++() {
+            const Node* node = path_.back();
+            if (node->right_) {
+                path_.push_back(node->right_.get());
+                PushLeftSpine();
+                return *this;
+            }
+            path_.pop_back();
+            while (!path_.empty() && path_.back()->right_.get() == node) {
+                node = path_.back();
+                path_.pop_back();
+            }
+            return *this;
+        }
+
+        iterator operator++(int) {
+            iterator old(*this);
+            this->operator++();
+            return old;
+        }
+
+        iterator& operator--() {
+            if (path_.empty()) {
+                path_.push_back(root_);
+                PushRightSpine();
+                return *this;
+            }
+            const Node* node = path_.back();
+            if (node->left_) {
+                path_.push_back(node->left_.get());
+                PushRightSpine();
+                return *this;
+            }
+            path_.pop_back();
+            while (!path_.empty() && path_.back()->left_.get() == node) {
+                node = path_.back();
+                path_.pop_back();
+            }
+            return *this;
+        }
+
+        iterator operator--(int) {
+            iterator old(*this);
+            this->operator--();
+            return old;
+        }
+
+        bool operator==(const iterator& rhs) const {
+            if (path_.empty() || rhs.path_.empty()) {
+                return path_.empty() && rhs.path_.empty();
+            }
+            return path_.back() == rhs.path_.back();
+        }
+
+        bool operator!=(const iterator& rhs) const {
+            return !(*this == rhs);
+        }
+
+        const ValueType& operator*() const {
+            return path_.back()->value_;
+        }
+
+        const ValueType* operator->() const {
+            return &(path_.back()->value_);
+        }
+
+    private:
+        friend class PersistentSet;
+
+        iterator(const Node* root, std::vector<const Node*> path)
+            : root_{root}, path_{std::move(path)} {
+        }
+
+        void PushLeftSpine() {
+            while (path_.back()->left_) {
+                path_.push_back(path_.back()->left_.get());
+            }
+        }
+
+        void PushRightSpine() {
+            while (path_.back()->right_) {
+                path_.push_back(path_.back()->right_.get());
+            }
+        }
+
+        // no parent pointers in shared nodes, so the iterator keeps the root-to-node path
+        const Node* root_;
+        std::vector<const Node*> path_;
+    };
+
+    PersistentSet(): root_{nullptr}, black_height_{0}, size_{0} {
+    }
+
+    template <typename Iterator>
+    PersistentSet(Iterator first, Iterator last): PersistentSet() {
+        while (first != last) {
+            *this = insert(*first);
+            ++first;
+        }
+    }
+
+    explicit PersistentSet(std::initializer_list<ValueType> init_list)
+                : PersistentSet(init_list.begin(), init_list.end()) {
+    }
+
+    iterator begin() const {
+        if (!root_) {
+            return end();
+        }
+        iterator itr(root_.get(), {root_.get()});
+        itr.PushLeftSpine();
+        return itr;
+    }
+
+    iterator end() const {
+        return iterator(root_.get(), {});
+    }
+
+    PersistentSet insert(const ValueType& value) const;
+    PersistentSet erase(const ValueType& value) const;
+    iterator find(const ValueType& value) const;
+    iterator lower_bound(const ValueType& value) const;
+
+    size_t size() const {
+        return size_;
+    }
+
+    bool empty() const {
+        return size_ == 0;
+    }
+
+private:
+    PersistentSet(Subtree tree, size_t size)
+        : root_{std::move(tree.root)}, black_height_{tree.black_height}, size_{size} {
+    }
+
+    static bool IsRed(const NodePtr& node) {
+        return node && node->color_ == Color::RED;
+    }
+
+    static bool IsBlack(const NodePtr& node) {
+        return !IsRed(node);
+    }
+
+    static NodePtr Make(Color color, NodePtr left, const ValueType& value, NodePtr right) {
+        return std::make_shared<const Node>(color, std::move(left), value, std::move(right));
+    }
+
+    static NodePtr Balance(Color color, NodePtr left, const ValueType& value, NodePtr right);
+    static NodePtr Insert(const NodePtr& node, const ValueType& value, bool& inserted);
+    static bool Contains(const Node* node, const ValueType& value);
+
+    static Subtree Child(const NodePtr& node, int parent_black_height);
+    static NodePtr JoinRight(const NodePtr& tree, int black_height,
+                             const ValueType& middle, const Subtree& right);
+    static NodePtr JoinLeft(const Subtree& left, const ValueType& middle,
+                            const NodePtr& tree, int black_height);
+    static Subtree Join(const Subtree& left, const ValueType& middle, const Subtree& right);
+    static Subtree Join2(const Subtree& left, const Subtree& right);
+    static bool Split(const Subtree& tree, const ValueType& key,
+                      Subtree& less, Subtree& greater);
+    static NodePtr SplitLast(const Subtree& tree, Subtree& rest);
+
+    NodePtr root_;
+    int black_height_;
+    size_t size_;
+};
+
+
+template <typename ValueType>
+PersistentSet<ValueType> PersistentSet<ValueType>::insert(const ValueType& value) const {
+    bool inserted = false;
+    NodePtr root = Insert(root_, value, inserted);
+    if (!inserted) {
+        return *this;
+    }
+    if (IsRed(root)) {
+        return PersistentSet({Make(Color::BLACK, root->left_, root->value_, root->right_),
+                              black_height_ + 1}, size_ + 1);
+    }
+    return PersistentSet({root, black_height_}, size_ + 1);
+}
+
+template <typename ValueType>
+PersistentSet<ValueType> PersistentSet<ValueType>::erase(const ValueType& value) const {
+    // a missing value would have Split copy a path only to throw it away
+    if (!Contains(root_.get(), value)) {
+        return *this;
+    }
+    Subtree less, greater;
+    Split({root_, black_height_}, value, less, greater);
+    return PersistentSet(Join2(less, greater), size_ - 1);
+}
+
+template <typename ValueType>
+bool PersistentSet<ValueType>::Contains(const Node* node, const ValueType& value) {
+    while (node) {
+        if (node->value_ < value) {
+            node = node->right_.get();
+        } else if (value < node->value_) {
+            node = node->left_.get();
+        } else {
+            return true;
+        }
+    }
+    return false;
+}
+
+template <typename ValueType>
+typename PersistentSet<ValueType>::iterator
+PersistentSet<ValueType>::find(const ValueType& value) const {
+    iterator itr = lower_bound(value);
+    if (itr == end() || value < *itr) {
+        return end();
+    }
+    return itr;
+}
+
+template <typename ValueType>
+typename PersistentSet<ValueType>::iterator
+PersistentSet<ValueType>::lower_bound(const ValueType& value) const {
+    std::vector<const Node*> path;
+    size_t candidate = 0;
+    const Node* node = root_.get();
+
+    while (node) {
+        path.push_back(node);
+        if (node->value_ < value) {
+            node = node->right_.get();
+        } else {
+            candidate = path.size();
+            if (!(value < node->value_)) {
+                break;
+            }
+            node = node->left_.get();
+        }
+    }
+
+    path.resize(candidate);
+    return iterator(root_.get(), std::move(path));
+}
+
+// Okasaki's rebalancing of a black node with a red child and a red grandchild
+template <typename ValueType>
+typename PersistentSet<ValueType>::NodePtr
+PersistentSet<ValueType>::Balance(Color color, NodePtr left, const ValueType& value,
+                                  NodePtr right) {
+    if (color == Color::BLACK) {
+        if (IsRed(left) && IsRed(left->left_)) {
+            const NodePtr& red = left->left_;
+            return Make(Color::RED, Make(Color::BLACK, red->left_, red->value_, red->right_),
+                        left->value_, Make(Color::BLACK, left->right_, value, right));
+        }
+        if (IsRed(left) && IsRed(left->right_)) {
+            const NodePtr& red = left->right_;
+            return Make(Color::RED, Make(Color::BLACK, left->left_, left->value_, red->left_),
+                        red->value_, Make(Color::BLACK, red->right_, value, right));
+        }
+        if (IsRed(right) && IsRed(right->left_)) {
+            const NodePtr& red = right->left_;
+            return Make(Color::RED, Make(Color::BLACK, left, value, red->left_),
+                        red->value_, Make(Color::BLACK, red->right_, right->value_, right->right_));
+        }
+        if (IsRed(right) && IsRed(right->right_)) {
+            const NodePtr& red = right->right_;
+            return Make(Color::RED, Make(Color::BLACK, left, value, right->left_),
+                        right->value_, Make(Color::BLACK, red->left_, red->value_, red->right_));
+        }
+    }
+    return Make(color, std::move(left), value, std::move(right));
+}
+
+// copies the search path only, returns node itself when value is already present
+template <typename ValueType>
+typename PersistentSet<ValueType>::NodePtr
+PersistentSet<ValueType>::Insert(const NodePtr& node, const ValueType& value, bool& inserted) {
+    if (!node) {
+        inserted = true;
+        return Make(Color::RED, nullptr, value, nullptr);
+    }
+    if (value < node->value_) {
+        NodePtr left = Insert(node->left_, value, inserted);
+        if (!inserted) {
+            return node;
+        }
+        return Balance(node->color_, std::move(left), node->value_, node->right_);
+    }
+    if (node->value_ < value) {
+        NodePtr right = Insert(node->right_, value, inserted);
+        if (!inserted) {
+            return node;
+        }
+        return Balance(node->color_, node->left_, node->value_, std::move(right));
+    }
+    return node;
+}
+
+// a child of a black node as a standalone tree, a red root is replaced by a black copy
+template <typename ValueType>
+typename PersistentSet<ValueType>::Subtree
+PersistentSet<ValueType>::Child(const NodePtr& node, int parent_black_height) {
+    if (!node) {
+        return {nullptr, 0};
+    }
+    if (IsRed(node)) {
+        return {Make(Color::BLACK, node->left_, node->value_, node->right_), parent_black_height};
+    }
+    return {node, parent_black_height - 1};
+}
+
+template <typename ValueType>
+typename PersistentSet<ValueType>::NodePtr
+PersistentSet<ValueType>::JoinRight(const NodePtr& tree, int black_height,
+                                    const ValueType& middle, const Subtree& right) {
+    if (IsBlack(tree) && black_height == right.black_height) {
+        return Make(Color::RED, tree, middle, right.root);
+    }
+
+    int child_black_height = IsBlack(tree) ? black_height - 1 : black_height;
+    NodePtr child = JoinRight(tree->right_, child_black_height, middle, right);
+    if (IsBlack(tree) && IsRed(child) && IsRed(child->right_)) {
+        const NodePtr& red = child->right_;
+        return Make(Color::RED, Make(Color::BLACK, tree->left_, tree->value_, child->left_),
+                    child->value_, Make(Color::BLACK, red->left_, red->value_, red->right_));
+    }
+    return Make(tree->color_, tree->left_, tree->value_, std::move(child));
+}
+
+template <typename ValueType>
+typename PersistentSet<ValueType>::NodePtr
+PersistentSet<ValueType>::JoinLeft(const Subtree& left, const ValueType& middle,
+                                   const NodePtr& tree, int black_height) {
+    if (IsBlack(tree) && black_height == left.black_height) {
+        return Make(Color::RED, left.root, middle, tree);
+    }
+
+    int child_black_height = IsBlack(tree) ? black_height - 1 : black_height;
+    NodePtr child = JoinLeft(left, middle, tree->left_, child_black_height);
+    if (IsBlack(tree) && IsRed(child) && IsRed(child->left_)) {
+        const NodePtr& red = child->left_;
+        return Make(Color::RED, Make(Color::BLACK, red->left_, red->value_, red->right_),
+                    child->value_, Make(Color::BLACK, child->right_, tree->value_, tree->right_));
+    }
+    return Make(tree->color_, std::move(child), tree->value_, tree->right_);
+}
+
+// every key of left < middle < every key of right
+template <typename ValueType>
+typename PersistentSet<ValueType>::Subtree
+PersistentSet<ValueType>::Join(const Subtree& left, const ValueType& middle,
+                               const Subtree& right) {
+    NodePtr root;
+    int black_height = 0;
+    if (left.black_height > right.black_height) {
+        root = JoinRight(left.root, left.black_height, middle, right);
+        black_height = left.black_height;
+    } else if (right.black_height > left.black_height) {
+        root = JoinLeft(left, middle, right.root, right.black_height);
+        black_height = right.black_height;
+    } else {
+        return {Make(Color::BLACK, left.root, middle, right.root), left.black_height + 1};
+    }
+
+    if (IsRed(root)) {
+        return {Make(Color::BLACK, root->left_, root->value_, root->right_), black_height + 1};
+    }
+    return {root, black_height};
+}
+
+template <typename ValueType>
+typename PersistentSet<ValueType>::Subtree
+PersistentSet<ValueType>::Join2(const Subtree& left, const Subtree& right) {
+    if (!left.root) {
+        return right;
+    }
+    Subtree rest;
+    NodePtr max_node = SplitLast(left, rest);
+    return Join(rest, max_node->value_, right);
+}
+
+template <typename ValueType>
+bool PersistentSet<ValueType>::Split(const Subtree& tree, const ValueType& key,
+                                     Subtree& less, Subtree& greater) {
+    if (!tree.root) {
+        less = greater = {nullptr, 0};
+        return false;
+    }
+
+    const Node* root = tree.root.get();
+    Subtree left = Child(root->left_, tree.black_height);
+    Subtree right = Child(root->right_, tree.black_height);
+    if (key < root->value_) {
+        Subtree left_greater;
+        bool found = Split(left, key, less, left_greater);
+        greater = Join(left_greater, root->value_, right);
+        return found;
+    }
+    if (root->value_ < key) {
+        Subtree right_less;
+        bool found = Split(right, key, right_less, greater);
+        less = Join(left, root->value_, right_less);
+        return found;
+    }
+    less = left;
+    greater = right;
+    return true;
+}
+
+// returns the node holding the maximum, the remaining keys go to rest
+template <typename ValueType>
+typename PersistentSet<ValueType>::NodePtr
+PersistentSet<ValueType>::SplitLast(const Subtree& tree, Subtree& rest) {
+    const Node* root = tree.root.get();
+    Subtree left = Child(root->left_, tree.black_height);
+    Subtree right = Child(root->right_, tree.black_height);
+    if (!right.root) {
+        rest = left;
+        return tree.root;
+    }
+    Subtree right_rest;
+    NodePtr max_node = SplitLast(right, right_rest);
+    rest = Join(left, root->value_, right_rest);
+    return max_node;
+}
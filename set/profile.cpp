@@ -0,0 +1,262 @@
+#include "set.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <random>
+#include <set>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+// Set versus std::set cost profile, printed as a JSON array with one object per
+// (container, key type, size, operation). Every case runs in a forked child;
+// rss_growth_kb is how far the resident set peaked above its size once the input
+// vectors were built, so it covers building the container and the operation but
+// not the inputs. Allocations are counted only during the timed operation.
+//
+//     profile [--max-size N]    sizes 1K..50M up to N, 1M by default
+
+namespace profile {
+
+size_t allocations = 0;
+size_t allocated_bytes = 0;
+}
+
+void* operator new(size_t size) {
+    ++profile::allocations;
+    profile::allocated_bytes += size;
+    if (void* memory = std::malloc(size ? size : 1)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+// not inlined, so the compiler does not pair free() with the new expression
+__attribute__((noinline)) void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+    operator delete(memory);
+}
+
+namespace profile {
+
+// volatile sink for lookup results
+volatile size_t sink;
+
+struct Result {
+    double ns_per_op;
+    size_t allocations;
+    size_t allocated_bytes;
+    size_t rss_growth_kb;
+    size_t height;
+    bool has_height;
+};
+
+// a field of /proc/self/status in kB, such as VmRSS or the peak VmHWM
+size_t status_kb(const std::string& field) {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, field.size() + 1, field + ":") == 0) {
+            return std::strtoull(line.c_str() + field.size() + 1, nullptr, 10);
+        }
+    }
+    return 0;
+}
+
+// returns the current resident set and restarts the peak from it
+size_t reset_peak_rss_kb() {
+    std::ofstream("/proc/self/clear_refs") << "5";
+    return status_kb("VmRSS");
+}
+
+// stored keys are even, lower_bound probes are the odd values in between
+template <typename Key>
+Key make_key(size_t i);
+
+template <>
+int make_key<int>(size_t i) {
+    return static_cast<int>(i);
+}
+
+template <>
+std::string make_key<std::string>(size_t i) {
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "key-%012zu", i);
+    return buffer;
+}
+
+template <typename Container>
+void tree_height(const Container&, Result& result) {
+    result.has_height = false;
+}
+
+template <typename ValueType>
+void tree_height(const Set<ValueType>& set, Result& result) {
+    result.height = set.height();
+    result.has_height = true;
+}
+
+template <typename Func>
+void measure(size_t ops, Result& result, Func func) {
+    size_t allocations_before = allocations;
+    size_t bytes_before = allocated_bytes;
+    auto start = std::chrono::steady_clock::now();
+    func();
+    auto finish = std::chrono::steady_clock::now();
+    result.ns_per_op = std::chrono::duration<double, std::nano>(finish - start).count() / ops;
+    result.allocations = allocations - allocations_before;
+    result.allocated_bytes = allocated_bytes - bytes_before;
+}
+
+template <typename Container, typename Key>
+Result run_case(const std::string& op, size_t size) {
+    std::vector<Key> keys;
+    keys.reserve(size);
+    for (size_t i = 0; i < size; ++i) {
+        keys.push_back(make_key<Key>(2 * i));
+    }
+    std::vector<Key> shuffled = keys;
+    std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937(42));
+    std::vector<Key> probes;
+    if (op == "lower_bound") {
+        probes.reserve(size);
+        for (size_t i = 0; i < size; ++i) {
+            probes.push_back(make_key<Key>(2 * i + 1));
+        }
+        std::shuffle(probes.begin(), probes.end(), std::mt19937(7));
+    }
+
+    Result result{};
+    size_t baseline_kb = reset_peak_rss_kb();
+    Container container;
+    if (op == "insert_random" || op == "insert_sorted") {
+        const std::vector<Key>& order = op == "insert_random" ? shuffled : keys;
+        measure(size, result, [&] {
+            for (const Key& key : order) {
+                container.insert(key);
+            }
+        });
+        tree_height(container, result);
+        result.rss_growth_kb = status_kb("VmHWM") - baseline_kb;
+        return result;
+    }
+
+    for (const Key& key : shuffled) {
+        container.insert(key);
+    }
+    tree_height(container, result);
+    size_t checksum = 0;
+    if (op == "find") {
+        measure(size, result, [&] {
+            for (const Key& key : shuffled) {
+                checksum += container.find(key) != container.end();
+            }
+        });
+    } else if (op == "lower_bound") {
+        measure(size, result, [&] {
+            for (const Key& probe : probes) {
+                checksum += container.lower_bound(probe) != container.end();
+            }
+        });
+    } else if (op == "erase") {
+        measure(size, result, [&] {
+            for (const Key& key : shuffled) {
+                container.erase(key);
+            }
+        });
+    } else if (op == "iterate") {
+        measure(size, result, [&] {
+            for (auto it = container.begin(); it != container.end(); ++it) {
+                ++checksum;
+            }
+        });
+    } else if (op == "copy") {
+        measure(size, result, [&] {
+            Container copy(container);
+            checksum += copy.size();
+        });
+    }
+    sink = checksum;
+    result.rss_growth_kb = status_kb("VmHWM") - baseline_kb;
+    return result;
+}
+
+void print_result(const Result& result) {
+    std::cout << ", \"ns_per_op\": " << result.ns_per_op
+              << ", \"allocations\": " << result.allocations
+              << ", \"allocated_bytes\": " << result.allocated_bytes
+              << ", \"rss_growth_kb\": " << result.rss_growth_kb << ", \"height\": ";
+    if (result.has_height) {
+        std::cout << result.height;
+    } else {
+        std::cout << "null";
+    }
+}
+
+// runs one case in a child process, prints a JSON object
+template <typename Container, typename Key>
+void fork_case(const std::string& container, const std::string& key, size_t size,
+               const std::string& op) {
+    std::cout << "  {\"container\": \"" << container << "\", \"key\": \"" << key
+              << "\", \"size\": " << size << ", \"op\": \"" << op << "\"";
+    std::cout.flush();
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        Result result = run_case<Container, Key>(op, size);
+        print_result(result);
+        std::cout.flush();
+        _exit(0);
+    }
+    int status = 0;
+    if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0) {
+        std::cout << ", \"error\": \"case failed\"";
+    }
+    std::cout << "}";
+}
+
+void run_all(size_t max_size) {
+    const std::string ops[] = {"insert_random", "insert_sorted", "find", "lower_bound",
+                               "erase", "iterate", "copy"};
+    bool first = true;
+    std::cout << "[\n";
+    for (size_t size : {size_t{1'000}, size_t{10'000}, size_t{100'000}, size_t{1'000'000},
+                        size_t{10'000'000}, size_t{50'000'000}}) {
+        if (size > max_size) {
+            break;
+        }
+        for (const std::string& op : ops) {
+            std::cout << (first ? "" : ",\n");
+            first = false;
+            fork_case<Set<int>, int>("Set", "int", size, op);
+            std::cout << ",\n";
+            fork_case<std::set<int>, int>("std::set", "int", size, op);
+            std::cout << ",\n";
+            fork_case<Set<std::string>, std::string>("Set", "string", size, op);
+            std::cout << ",\n";
+            fork_case<std::set<std::string>, std::string>("std::set", "string", size, op);
+        }
+    }
+    std::cout << "\n]\n";
+}
+}
+
+int main(int argc, char** argv) {
+    size_t max_size = 1'000'000;
+    for (int i = 1; i + 1 < argc; ++i) {
+        if (std::string(argv[i]) == "--max-size") {
+            max_size = std::strtoull(argv[i + 1], nullptr, 10);
+        }
+    }
+    profile::run_all(max_size);
+    return 0;
+}
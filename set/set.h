@@ -1,38 +1,156 @@
+#pragma once
+
 #include <algorithm>
+#include <bit>
+#include <cassert>
+#include <future>
 #include <initializer_list>
+#include <iterator>
+#include <limits>
+#include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 enum class Color {
     RED, BLACK
 }; 
 
-template <typename ValueType>
+// Augmentations for Set: every node caches combine() of lift(value) over its subtree
+// in order, combine must be associative and identity() its neutral element.
+namespace augment {
+
+struct None {
+    struct summary_type {
+    };
+
+    static summary_type identity() {
+        return {};
+    }
+
+    template <typename Value>
+    static summary_type lift(const Value&) {
+        return {};
+    }
+
+    static summary_type combine(summary_type, summary_type) {
+        return {};
+    }
+};
+
+template <typename T>
+struct Sum {
+    using summary_type = T;
+
+    static T identity() {
+        return T();
+    }
+
+    static T lift(const T& value) {
+        return value;
+    }
+
+    static T combine(const T& lhs, const T& rhs) {
+        return lhs + rhs;
+    }
+};
+
+template <typename T>
+struct Min {
+    using summary_type = T;
+
+    static T identity() {
+        return std::numeric_limits<T>::max();
+    }
+
+    static T lift(const T& value) {
+        return value;
+    }
+
+    static T combine(const T& lhs, const T& rhs) {
+        return std::min(lhs, rhs);
+    }
+};
+
+template <typename T>
+struct Max {
+    using summary_type = T;
+
+    static T identity() {
+        return std::numeric_limits<T>::lowest();
+    }
+
+    static T lift(const T& value) {
+        return value;
+    }
+
+    static T combine(const T& lhs, const T& rhs) {
+        return std::max(lhs, rhs);
+    }
+};
+
+// values are half-open intervals [first, second), the summary is the largest end
+template <typename Point>
+struct IntervalMaxEnd {
+    using summary_type = Point;
+
+    static Point identity() {
+        return std::numeric_limits<Point>::lowest();
+    }
+
+    static Point lift(const std::pair<Point, Point>& interval) {
+        return interval.second;
+    }
+
+    static Point combine(const Point& lhs, const Point& rhs) {
+        return std::max(lhs, rhs);
+    }
+};
+}
+
+template <typename ValueType, typename Augment = augment::None>
 class Set {
+public:
+    using summary_type = typename Augment::summary_type;
+
+private:
+    static constexpr bool kAugmented = !std::is_same_v<Augment, augment::None>;
+
     struct Node {
-        explicit Node(ValueType value): Node(value, Color::RED) {
+        // the sentinel, its value is never constructed
+        Node()
+            : left_{this}, right_{this}, parent_{this},
+              color_{Color::BLACK}, summary_{Augment::identity()} {
         }
 
-        Node(const ValueType& value, Color color)
-            : Node(value, nullptr, nullptr, nullptr, color) {  
+        template <typename... Args>
+        explicit Node(std::in_place_t, Args&&... args)
+            : value_(std::forward<Args>(args)...), left_{nullptr}, right_{nullptr},
+              parent_{nullptr}, color_{Color::RED}, summary_{Augment::identity()} {
         }
 
-        Node(const ValueType& value, Node* left,
-            Node* right, Node* parent, Color color)
-            : value_{value}, left_{left}, right_{right},
-              parent_{parent}, color_{color} {
+        ~Node() {
+            value_.~ValueType();
         }
 
-        ValueType value_;
+        union {
+            ValueType value_;
+        };
         Node* left_;
         Node* right_;
         Node* parent_;        
         Color color_;              
+        [[no_unique_address]] summary_type summary_;
     };
 
 public:
     class iterator {
     public:
         using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = ValueType;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const ValueType*;
+        using reference = const ValueType&;
 
         iterator(): set_{nullptr}, node_{nullptr} {
         }
@@ -55,7 +173,7 @@ public:
             if (node_ != set_->nil_) {
                 node_ = set_->Predecessor(node_);            
             } else {
-                node_ = set_->MaxValueNode(set_->root_);
+                node_ = set_->rightmost_;
             }
             return *this;
         }
@@ -83,13 +201,66 @@ public:
         }      
 
     private:
+        friend class Set;
+
         const Set* set_;
         Node* node_;        
     };  
 
-    Set(): nil_{new Node(ValueType(), Color::BLACK)}, size_{0} {
-        root_ = nil_;
-        nil_->left_ = nil_->right_ = nil_->parent_ = nil_;
+    class node_type {
+    public:
+        node_type(): node_{nullptr} {
+        }
+
+        node_type(node_type&& other): node_{other.node_} {
+            other.node_ = nullptr;
+        }
+
+        node_type& operator=(node_type&& rhs) {
+            if (this != &rhs) {
+                delete node_;
+                node_ = rhs.node_;
+                rhs.node_ = nullptr;
+            }
+            return *this;
+        }
+
+        node_type(const node_type&) = delete;
+        node_type& operator=(const node_type&) = delete;
+
+        ~node_type() {
+            delete node_;
+        }
+
+        bool empty() const {
+            return node_ == nullptr;
+        }
+
+        explicit operator bool() const {
+            return node_ != nullptr;
+        }
+
+        ValueType& value() const {
+            return node_->value_;
+        }
+
+    private:
+        friend class Set;
+
+        explicit node_type(Node* node): node_{node} {
+        }
+
+        Node* node_;
+    };
+
+    struct insert_return_type {
+        iterator position;
+        bool inserted;
+        node_type node;
+    };
+
+    Set(): nil_{Sentinel()}, size_{0} {
+        root_ = leftmost_ = rightmost_ = nil_;
     }        
 
     template <typename Iterator>
@@ -104,48 +275,230 @@ public:
                 : Set(init_list.begin(), init_list.end()) {
     }
 
-    Set(const Set<ValueType>& other): Set(other.begin(), other.end()) {
+    // O(n) build from count strictly increasing values, read once in order
+    template <typename InputIterator>
+    static Set from_sorted(InputIterator first, size_t count);
+
+    // copies the shape and colors of other in O(n), no comparisons or rebalancing
+    Set(const Set<ValueType, Augment>& other): Set() {
+        if (other.root_ != nil_) {
+            CloneTree(other.root_, root_, nil_);
+        }
+        leftmost_ = MinValueNode(root_);
+        rightmost_ = MaxValueNode(root_);
         size_ = other.size_;
     }
 
-    Set& operator=(const Set<ValueType>& rhs) {
+    // steals the tree without allocating, other is left empty
+    Set(Set<ValueType, Augment>&& other) noexcept
+        : root_{other.root_}, leftmost_{other.leftmost_}, rightmost_{other.rightmost_},
+          nil_{other.nil_}, size_{other.size_} {
+        other.root_ = other.leftmost_ = other.rightmost_ = nil_;
+        other.size_ = 0;
+    }
+
+    Set& operator=(const Set<ValueType, Augment>& rhs) {
         if (this == &rhs) {
             return *this;
         }
 
-        ClearAll(root_);
-        root_ = nil_;
-        iterator itr = rhs.begin();
-        while (itr != rhs.end()) {
-            insert(*itr);
-            ++itr;
+        Set<ValueType, Augment> copy(rhs);
+        swap(copy);
+        return *this;
+    }
+
+    Set& operator=(Set<ValueType, Augment>&& rhs) noexcept {
+        if (this == &rhs) {
+            return *this;
         }
 
-        size_ = rhs.size_;
+        Set<ValueType, Augment> stolen(std::move(rhs));
+        swap(stolen);
         return *this;
     }
 
+    void swap(Set<ValueType, Augment>& other) noexcept {
+        std::swap(root_, other.root_);
+        std::swap(leftmost_, other.leftmost_);
+        std::swap(rightmost_, other.rightmost_);
+        std::swap(size_, other.size_);
+    }
+
     ~Set() {
         if (root_ != nil_) {
             ClearAll(root_);
         }
-        delete nil_;
     }
 
     iterator begin() const {
-        return iterator(this, MinValueNode(root_));        
+        return iterator(this, leftmost_);
     }
 
     iterator end() const {
         return iterator(this, nil_);        
     } 
 
-    void insert(const ValueType& value) {
-        if (FindByValue(value) != nil_) {
+    std::pair<iterator, bool> insert(const ValueType& value) {
+        return InsertValue(value);
+    }
+
+    std::pair<iterator, bool> insert(ValueType&& value) {
+        return InsertValue(std::move(value));
+    }
+
+    // inserting right before or right after the hint skips the descent from root_
+    iterator insert(iterator hint, const ValueType& value) {
+        return emplace_hint(hint, value);
+    }
+
+    iterator insert(iterator hint, ValueType&& value) {
+        return emplace_hint(hint, std::move(value));
+    }
+
+    insert_return_type insert(node_type&& node) {
+        if (node.empty()) {
+            return {end(), false, node_type()};
+        }
+        Node* parent = nil_;
+        bool as_left = true;
+        Node* existing = FindInsertPosition(node.node_->value_, parent, as_left);
+        if (existing != nil_) {
+            return {iterator(this, existing), false, std::move(node)};
+        }
+        Node* released = node.node_;
+        node.node_ = nullptr;
+        RBInsert(released, parent, as_left);
+        return {iterator(this, released), true, node_type()};
+    }
+
+    // the value is constructed inside the node and thrown away if it is already present
+    template <typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args) {
+        Node* node = new Node(std::in_place, std::forward<Args>(args)...);
+        Node* parent = nil_;
+        bool as_left = true;
+        Node* existing = FindInsertPosition(node->value_, parent, as_left);
+        if (existing != nil_) {
+            delete node;
+            return {iterator(this, existing), false};
+        }
+        RBInsert(node, parent, as_left);
+        return {iterator(this, node), true};
+    }
+
+    template <typename... Args>
+    iterator emplace_hint(iterator hint, Args&&... args) {
+        Node* node = new Node(std::in_place, std::forward<Args>(args)...);
+        Node* parent = nil_;
+        bool as_left = true;
+        Node* existing = FindInsertPosition(hint.node_, node->value_, parent, as_left);
+        if (existing != nil_) {
+            delete node;
+            return iterator(this, existing);
+        }
+        RBInsert(node, parent, as_left);
+        return iterator(this, node);
+    }
+
+    // unlinks the node without destroying its value
+    node_type extract(iterator position) {
+        Node* node = position.node_;
+        RBUnlink(node);
+        return node_type(node);
+    }
+
+    node_type extract(const ValueType& value) {
+        Node* node = FindByValue(value);
+        if (node == nil_) {
+            return node_type();
+        }
+        return extract(iterator(this, node));
+    }
+
+    // moves every node missing here out of source, nothing is reallocated
+    void merge(Set<ValueType, Augment>& source) {
+        if (this == &source) {
             return;
         }
-        Node* node = new Node(value);
-        return RBInsert(node);
+        iterator itr = source.begin();
+        while (itr != source.end()) {
+            Node* node = itr.node_;
+            ++itr;
+            Node* parent = nil_;
+            bool as_left = true;
+            if (FindInsertPosition(node->value_, parent, as_left) == nil_) {
+                source.RBUnlink(node);
+                RBInsert(node, parent, as_left);
+            }
+        }
+    }
+
+    // join-based set algebra, the recursion on the two halves runs in parallel
+    void union_with(Set<ValueType, Augment>&& other);
+    void intersect_with(Set<ValueType, Augment>&& other);
+    void difference_with(Set<ValueType, Augment>&& other);
+
+    void union_with(const Set<ValueType, Augment>& other) {
+        union_with(Set<ValueType, Augment>(other));
+    }
+
+    void intersect_with(const Set<ValueType, Augment>& other) {
+        intersect_with(Set<ValueType, Augment>(other));
+    }
+
+    void difference_with(const Set<ValueType, Augment>& other) {
+        difference_with(Set<ValueType, Augment>(other));
+    }
+
+    // the successor is found before unlinking, no second search from root_
+    iterator erase(iterator position) {
+        Node* next = Successor(position.node_);
+        RBDelete(position.node_);
+        return iterator(this, next);
+    }
+
+    // double-ended priority queue access, the extremes are cached. The set
+    // must not be empty: the extremes of an empty set are the sentinel every
+    // Set of this type shares, whose value is never constructed
+    const ValueType& min() const {
+        assert(leftmost_ != nil_);
+        return leftmost_->value_;
+    }
+
+    const ValueType& max() const {
+        assert(rightmost_ != nil_);
+        return rightmost_->value_;
+    }
+
+    ValueType pop_min() {
+        assert(leftmost_ != nil_);
+        Node* node = leftmost_;
+        ValueType value = std::move(node->value_);
+        RBDelete(node);
+        return value;
+    }
+
+    ValueType pop_max() {
+        assert(rightmost_ != nil_);
+        Node* node = rightmost_;
+        ValueType value = std::move(node->value_);
+        RBDelete(node);
+        return value;
+    }
+
+    // combined summary of the values in [lo, hi), O(log n)
+    summary_type aggregate(const ValueType& lo, const ValueType& hi) const;
+
+    summary_type aggregate() const {
+        return root_->summary_;
+    }
+
+    // calls callback in order on every stored interval intersecting query,
+    // O(log n) per reported interval
+    template <typename Callback>
+    void overlapping(const ValueType& query, Callback callback) const
+        requires std::is_same_v<Augment, augment::IntervalMaxEnd<typename ValueType::first_type>> {
+        VisitOverlapping(root_, query, callback);
     }
 
     void erase(const ValueType& value) {
@@ -189,10 +542,24 @@ public:
         return size_ == 0;
     }
 
+    // nodes on the longest root-to-leaf path, for diagnostics
+    size_t height() const {
+        return Height(root_);
+    }
+
 private:
+    static Node* Sentinel();
+
+    template <typename Value>
+    std::pair<iterator, bool> InsertValue(Value&& value);
+
     void ClearAll(Node*& root);
+    void CloneTree(Node* source, Node*& slot, Node* parent);
     bool Equal(const ValueType& lhs, const ValueType& rhs) const;
     Node* FindByValue(const ValueType& value) const;
+    Node* FindInsertPosition(const ValueType& value, Node*& parent, bool& as_left) const;
+    Node* FindInsertPosition(Node* hint, const ValueType& value,
+                             Node*& parent, bool& as_left) const;
 
     Node* MinValueNode(Node* root) const;
     Node* MaxValueNode(Node* root) const;
@@ -204,22 +571,87 @@ private:
     void PaintRed(Node* node);
     void PaintBlack(Node* node);
 
+    void Pull(Node* node);
+    void PullUp(Node* node);
+    template <typename Callback>
+    void VisitOverlapping(Node* node, const ValueType& query, Callback& callback) const;
+
     void LeftRotate(Node* x_node);
     void RightRotate(Node* x_node);
-    void RBInsert(Node*& z_node);
+    void RBInsert(Node* z_node, Node* y_node, bool as_left);
     void RBInsertFixup(Node*& z_node);
     void RBTransplant(Node*& x_node, Node*& y_node);
+    void RBUnlink(Node* z_node);
     void RBDelete(Node*& z_node);
-    void RBDeleteFixup(Node*& z_node);
+    void RBDeleteFixup(Node* x_node, Node* x_parent);
+
+    // a detached red-black tree, the root is always black
+    struct Subtree {
+        Node* root;
+        int black_height;
+    };
+
+    static const int kMinForkBlackHeight = 10;
+    static int ForkDepth();
+    template <typename LeftTask, typename RightTask>
+    static void ForkJoin(bool fork, LeftTask&& left, RightTask&& right);
+
+    int BlackHeight(Node* root) const;
+    size_t Height(Node* root) const;
+    template <typename InputIterator>
+    Node* BuildSorted(InputIterator& first, size_t count, int depth, int red_depth);
+    Subtree TakeTree();
+    Subtree AdoptTree(Set<ValueType, Augment>& other);
+    void PlantTree(Subtree tree);
+    void DestroyTree(Subtree tree);
+
+    Subtree Child(Node* node, int parent_black_height);
+    Node* Link(Node* left, Node* middle, Node* right, Color color);
+    Node* JoinLeftRotate(Node* x_node);
+    Node* JoinRightRotate(Node* x_node);
+    Node* JoinRight(Node* tree, int black_height, Node* middle, Subtree right);
+    Node* JoinLeft(Subtree left, Node* middle, Node* tree, int black_height);
+    Subtree Join(Subtree left, Node* middle, Subtree right);
+    Subtree Join2(Subtree left, Subtree right);
+    Node* Split(Subtree tree, const ValueType& key, Subtree& less, Subtree& greater);
+    Node* SplitLast(Subtree tree, Subtree& rest);
+
+    Subtree UnionTrees(Subtree lhs, Subtree rhs, int depth, size_t& duplicates);
+    Subtree IntersectTrees(Subtree lhs, Subtree rhs, int depth, size_t& kept);
+    Subtree DifferenceTrees(Subtree lhs, Subtree rhs, int depth, size_t& removed);
 
     Node* root_;
+    Node* leftmost_;
+    Node* rightmost_;
     Node* nil_;
     size_t size_;
 };
 
 
-template <typename ValueType>
-void Set<ValueType>::ClearAll(Node*& root) {
+// one sentinel per instantiation, shared by every set and never written after it is
+// built, so trees move between sets and sets on different threads do not race on it
+template <typename ValueType, typename Augment>
+typename Set<ValueType, Augment>::Node* Set<ValueType, Augment>::Sentinel() {
+    static Node* const sentinel = new Node();
+    return sentinel;
+}
+
+template <typename ValueType, typename Augment>
+template <typename Value>
+std::pair<typename Set<ValueType, Augment>::iterator, bool> Set<ValueType, Augment>::InsertValue(Value&& value) {
+    Node* parent = nil_;
+    bool as_left = true;
+    Node* existing = FindInsertPosition(value, parent, as_left);
+    if (existing != nil_) {
+        return {iterator(this, existing), false};
+    }
+    Node* node = new Node(std::in_place, std::forward<Value>(value));
+    RBInsert(node, parent, as_left);
+    return {iterator(this, node), true};
+}
+
+template <typename ValueType, typename Augment>
+void Set<ValueType, Augment>::ClearAll(Node*& root) {
     if (root->left_ != nil_) {
         ClearAll(root->left_);
     }
@@ -229,8 +661,26 @@ void Set<ValueType>::ClearAll(Node*& root) {
     delete root;
 }
 
-template <typename ValueType>
-typename Set<ValueType>::Node* Set<ValueType>::FindByValue(const ValueType& value) const {
+// every copy is linked in before its children are cloned, so if a value copy throws
+// the partial tree is still reachable from root_ and freed by the destructor
+template <typename ValueType, typename Augment>
+void Set<ValueType, Augment>::CloneTree(Node* source, Node*& slot, Node* parent) {
+    Node* node = new Node(std::in_place, source->value_);
+    node->left_ = node->right_ = nil_;
+    node->parent_ = parent;
+    node->color_ = source->color_;
+    node->summary_ = source->summary_;
+    slot = node;
+    if (source->left_ != nil_) {
+        CloneTree(source->left_, node->left_, node);
+    }
+    if (source->right_ != nil_) {
+        CloneTree(source->right_, node->right_, node);
+    }
+}
+
+template <typename ValueType, typename Augment>
+typename Set<ValueType, Augment>::Node* Set<ValueType, Augment>::FindByValue(const ValueType& value) const {
     Node* current_node = root_;
 
     while (current_node != nil_) {
@@ -247,8 +697,87 @@ typename Set<ValueType>::Node* Set<ValueType>::FindByValue(const ValueType& valu
     return current_node;
 }
 
-template <typename ValueType>
-typename Set<ValueType>::Node* Set<ValueType>::MinValueNode(Node* root) const {
+// returns the node equal to value, or nil_ with the attach point stored in parent/as_left
+template <typename ValueType, typename Augment>
+typename Set<ValueType, Augment>::Node* Set<ValueType, Augment>::FindInsertPosition(const ValueType& value,
+                                                                  Node*& parent,
+                                                                  bool& as_left) const {
+    Node* current_node = root_;
+    parent = nil_;
+    as_left = true;
+
+    while (current_node != nil_) {
+        parent = current_node;
+        if (value < current_node->value_) {
+            as_left = true;
+            current_node = current_node->left_;
+        } else if (current_node->value_ < value) {
+            as_left = false;
+            current_node = current_node->right_;
+        } else {
+            return current_node;
+        }
+    }
+
+    return nil_;
+}
+
+// same as above, but first tries the gap right before or right after the hint
+template <typename ValueType, typename Augment>
+typename Set<ValueType, Augment>::Node* Set<ValueType, Augment>::FindInsertPosition(Node* hint,
+                                                                  const ValueType& value,
+                                                                  Node*& parent,
+                                                                  bool& as_left) const {
+    if (root_ == nil_) {
+        parent = nil_;
+        as_left = true;
+        return nil_;
+    }
+
+    if (hint == nil_) {
+        if (rightmost_->value_ < value) {
+            parent = rightmost_;
+            as_left = false;
+            return nil_;
+        }
+        return FindInsertPosition(value, parent, as_left);
+    }
+
+    if (value < hint->value_) {
+        Node* before = hint == leftmost_ ? nil_ : Predecessor(hint);
+        if (before != nil_ && !(before->value_ < value)) {
+            return FindInsertPosition(value, parent, as_left);
+        }
+        if (hint->left_ == nil_) {
+            parent = hint;
+            as_left = true;
+        } else {
+            parent = before;
+            as_left = false;
+        }
+        return nil_;
+    }
+
+    if (hint->value_ < value) {
+        Node* after = hint == rightmost_ ? nil_ : Successor(hint);
+        if (after != nil_ && !(value < after->value_)) {
+            return FindInsertPosition(value, parent, as_left);
+        }
+        if (hint->right_ == nil_) {
+            parent = hint;
+            as_left = false;
+        } else {
+            parent = after;
+            as_left = true;
+        }
+        return nil_;
+    }
+
+    return hint;
+}
+
+template <typename ValueType, typename Augment>
+typename Set<ValueType, Augment>::Node* Set<ValueType, Augment>::MinValueNode(Node* root) const {
     Node* min_val_node = root;
 
     while (min_val_node->left_ != nil_) {
@@ -258,8 +787,8 @@ typename Set<ValueType>::Node* Set<ValueType>::MinValueNode(Node* root) const {
     return min_val_node;
 }
 
-template <typename ValueType>
-typename Set<ValueType>::Node* Set<ValueType>::MaxValueNode(Node* root) const {
+template <typename ValueType, typename Augment>
+typename Set<ValueType, Augment>::Node* Set<ValueType, Augment>::MaxValueNode(Node* root) const {
     Node* max_val_node = root;
 
     while (max_val_node->right_ != nil_) {
@@ -269,8 +798,8 @@ typename Set<ValueType>::Node* Set<ValueType>::MaxValueNode(Node* root) const {
     return max_val_node;
 }
 
-template <typename ValueType>
-typename Set<ValueType>::Node* Set<ValueType>::Successor(Node* node) const {
+template <typename ValueType, typename Augment>
+typename Set<ValueType, Augment>::Node* Set<ValueType, Augment>::Successor(Node* node) const {
     if (node->right_ != nil_) {
         return MinValueNode(node->right_);
     }
@@ -284,8 +813,8 @@ typename Set<ValueType>::Node* Set<ValueType>::Successor(Node* node) const {
     return y_node;
 }
 
-template <typename ValueType>
-typename Set<ValueType>::Node* Set<ValueType>::Predecessor(Node* node) const {
+template <typename ValueType, typename Augment>
+typename Set<ValueType, Augment>::Node* Set<ValueType, Augment>::Predecessor(Node* node) const {
     if (node->left_ != nil_) {
         return MaxValueNode(node->left_);
     }
@@ -299,33 +828,115 @@ typename Set<ValueType>::Node* Set<ValueType>::Predecessor(Node* node) const {
     return y_node;
 }
 
-template <typename ValueType>
-bool Set<ValueType>::Equal(const ValueType& lhs, const ValueType& rhs) const {
+template <typename ValueType, typename Augment>
+bool Set<ValueType, Augment>::Equal(const ValueType& lhs, const ValueType& rhs) const {
     return !(lhs < rhs) && !(rhs < lhs);
 }
 
-template <typename ValueType>
-bool Set<ValueType>::RedFlag(Node* node) const {
+template <typename ValueType, typename Augment>
+bool Set<ValueType, Augment>::RedFlag(Node* node) const {
     return node->color_ == Color::RED;
 }
 
-template <typename ValueType>
-bool Set<ValueType>::BlackFlag(Node* node) const {
+template <typename ValueType, typename Augment>
+bool Set<ValueType, Augment>::BlackFlag(Node* node) const {
     return node->color_ == Color::BLACK;
 }
 
-template <typename ValueType>
-void Set<ValueType>::PaintRed(Node* node) {
+template <typename ValueType, typename Augment>
+void Set<ValueType, Augment>::PaintRed(Node* node) {
     node->color_ = Color::RED;
 }
 
-template <typename ValueType>
-void Set<ValueType>::PaintBlack(Node* node) {
+template <typename ValueType, typename Augment>
+void Set<ValueType, Augment>::PaintBlack(Node* node) {
     node->color_ = Color::BLACK;
 }
 
-template <typename ValueType>
-void Set<ValueType>::LeftRotate(Node* x_node) {
+template <typename ValueType, typename Augment>
+typename Set<ValueType, Augment>::summary_type
+Set<ValueType, Augment>::aggregate(const ValueType& lo, const ValueType& hi) const {
+    Node* split_node = root_;
+    while (split_node != nil_) {
+        if (split_node->value_ < lo) {
+            split_node = split_node->right_;
+        } else if (!(split_node->value_ < hi)) {
+            split_node = split_node->left_;
+        } else {
+            break;
+        }
+    }
+    if (split_node == nil_) {
+        return Augment::identity();
+    }
+
+    // values >= lo on the left of the split node, collected right to left
+    summary_type left = Augment::identity();
+    for (Node* node = split_node->left_; node != nil_;) {
+        if (node->value_ < lo) {
+            node = node->right_;
+        } else {
+            left = Augment::combine(
+                Augment::combine(Augment::lift(node->value_), node->right_->summary_), left);
+            node = node->left_;
+        }
+    }
+
+    // values < hi on the right of the split node, collected left to right
+    summary_type right = Augment::identity();
+    for (Node* node = split_node->right_; node != nil_;) {
+        if (!(node->value_ < hi)) {
+            node = node->left_;
+        } else {
+            right = Augment::combine(
+                right, Augment::combine(node->left_->summary_, Augment::lift(node->value_)));
+            node = node->right_;
+        }
+    }
+
+    return Augment::combine(Augment::combine(left, Augment::lift(split_node->value_)), right);
+}
+
+// recomputes the cached summary from the children, never called on nil_
+template <typename ValueType, typename Augment>
+void Set<ValueType, Augment>::Pull(Node* node) {
+    if constexpr (kAugmented) {
+        node->summary_ = Augment::combine(
+            Augment::combine(node->left_->summary_, Augment::lift(node->value_)),
+            node->right_->summary_);
+    }
+}
+
+template <typename ValueType, typename Augment>
+void Set<ValueType, Augment>::PullUp(Node* node) {
+    if constexpr (kAugmented) {
+        while (node != nil_) {
+            Pull(node);
+            node = node->parent_;
+        }
+    }
+}
+
+// a subtree whose largest end is <= query start cannot overlap it
+template <typename ValueType, typename Augment>
+template <typename Callback>
+void Set<ValueType, Augment>::VisitOverlapping(Node* node, const ValueType& query,
+                                               Callback& callback) const {
+    if (node == nil_ || !(query.first < node->summary_)) {
+        return;
+    }
+    VisitOverlapping(node->left_, query, callback);
+    if (!(node->value_.first < query.second)) {
+        return;
+    }
+    if (query.first < node->value_.second) {
+        callback(node->value_);
+    }
+    VisitOverlapping(node->right_, query, callback);
+}
+
+template <typename ValueType, typename Augment>
+void Set<ValueType, Augment>::LeftRotate(Node* x_node) {
     Node* y_node = x_node->right_;
     x_node->right_ = y_node->left_;
 
@@ -346,10 +957,12 @@ void Set<ValueType>::LeftRotate(Node* x_node) {
 
     y_node->left_ = x_node;
     x_node->parent_ = y_node;
+    Pull(x_node);
+    Pull(y_node);
 }
 
-template <typename ValueType>
-void Set<ValueType>::RightRotate(Node* x_node) {
+template <typename ValueType, typename Augment>
+void Set<ValueType, Augment>::RightRotate(Node* x_node) {
     auto y_node = x_node->left_;
     x_node->left_ = y_node->right_;
 
@@ -369,40 +982,38 @@ void Set<ValueType>::RightRotate(Node* x_node) {
 
     y_node->right_ = x_node;
     x_node->parent_ = y_node;
+    Pull(x_node);
+    Pull(y_node);
 }
 
-template <typename ValueType>
-void Set<ValueType>::RBInsert(Node*& z_node) {
-    Node* y_node = nil_;
-    Node* x_node = root_;
-
-    while (x_node != nil_) {
-        y_node = x_node;
-        if (z_node->value_ < x_node->value_) {
-            x_node = x_node->left_;
-        } else {
-            x_node = x_node->right_;
-        }
-    }
-
+// attaches z_node as a child of y_node found by FindInsertPosition
+template <typename ValueType, typename Augment>
+void Set<ValueType, Augment>::RBInsert(Node* z_node, Node* y_node, bool as_left) {
     z_node->parent_ = y_node;
     if (y_node == nil_) {
-        root_ = z_node;
-    } else if (z_node->value_ < y_node->value_) {
+        root_ = leftmost_ = rightmost_ = z_node;
+    } else if (as_left) {
+        if (y_node == leftmost_) {
+            leftmost_ = z_node;
+        }
         y_node->left_ = z_node;
     } else {
+        if (y_node == rightmost_) {
+            rightmost_ = z_node;
+        }
         y_node->right_ = z_node;
     }
 
     z_node->left_ = nil_;
     z_node->right_ = nil_;
+    PullUp(z_node);
     PaintRed(z_node);
     RBInsertFixup(z_node);
     ++size_;
 }
 
-template <typename ValueType>
-void Set<ValueType>::RBInsertFixup(Node*& z_node) {
+template <typename ValueType, typename Augment>
+void Set<ValueType, Augment>::RBInsertFixup(Node*& z_node) {
     while (RedFlag(z_node->parent_)) {
         if (z_node->parent_ == z_node->parent_->parent_->left_) {
             auto y_node = z_node->parent_->parent_->right_;
@@ -444,8 +1055,8 @@ void Set<ValueType>::RBInsertFixup(Node*& z_node) {
     PaintBlack(root_);
 }
 
-template <typename ValueType>
-void Set<ValueType>::RBTransplant(Node*& x_node, Node*& y_node) {
+template <typename ValueType, typename Augment>
+void Set<ValueType, Augment>::RBTransplant(Node*& x_node, Node*& y_node) {
     if (x_node->parent_ == nil_) {
         root_ = y_node;
 
@@ -456,12 +1067,24 @@ void Set<ValueType>::RBTransplant(Node*& x_node, Node*& y_node) {
         x_node->parent_->right_ = y_node;
     }
 
-    y_node->parent_ = x_node->parent_;
+    if (y_node != nil_) {
+        y_node->parent_ = x_node->parent_;
+    }
 }
 
-template <typename ValueType>
-void Set<ValueType>::RBDelete(Node*& z_node) {
+// detaches z_node from the tree and rebalances, the node itself stays alive
+template <typename ValueType, typename Augment>
+void Set<ValueType, Augment>::RBUnlink(Node* z_node) {
+    if (z_node == leftmost_) {
+        leftmost_ = Successor(z_node);
+    }
+    if (z_node == rightmost_) {
+        rightmost_ = Predecessor(z_node);
+    }
+
+    // x_node may be the sentinel, so its parent is tracked here instead of in nil_
     Node* x_node = nil_;
+    Node* x_parent = z_node->parent_;
     Node* y_node = z_node;
     Color y_original_color = y_node->color_;
 
@@ -478,9 +1101,10 @@ void Set<ValueType>::RBDelete(Node*& z_node) {
         y_original_color = y_node->color_;
         x_node = y_node->right_;
         if (y_node->parent_ == z_node) {
-            x_node->parent_ = y_node;
+            x_parent = y_node;
 
         } else {
+            x_parent = y_node->parent_;
             RBTransplant(y_node, y_node->right_);
             y_node->right_ = z_node->right_;
             y_node->right_->parent_ = y_node;
@@ -492,73 +1116,499 @@ void Set<ValueType>::RBDelete(Node*& z_node) {
         y_node->color_ = z_node->color_;
     }
 
+    PullUp(x_parent);
     if (y_original_color == Color::BLACK) {
-        RBDeleteFixup(x_node);
+        RBDeleteFixup(x_node, x_parent);
     }
 
     --size_;
+}
+
+template <typename ValueType, typename Augment>
+void Set<ValueType, Augment>::RBDelete(Node*& z_node) {
+    RBUnlink(z_node);
     delete z_node;
 }
 
-template <typename ValueType>
-void Set<ValueType>::RBDeleteFixup(Node*& x_node) {
+template <typename ValueType, typename Augment>
+void Set<ValueType, Augment>::RBDeleteFixup(Node* x_node, Node* x_parent) {
     while (x_node != root_ && BlackFlag(x_node)) {
-        if (x_node == x_node->parent_->left_) {
-            auto w_node = x_node->parent_->right_;
+        if (x_node == x_parent->left_) {
+            auto w_node = x_parent->right_;
             if (RedFlag(w_node)) {
                 PaintBlack(w_node);
-                PaintRed(x_node->parent_);
-                LeftRotate(x_node->parent_);
-                w_node = x_node->parent_->right_;
+                PaintRed(x_parent);
+                LeftRotate(x_parent);
+                w_node = x_parent->right_;
             }
 
             if (BlackFlag(w_node->left_) && BlackFlag(w_node->right_)) {
                 PaintRed(w_node);
-                x_node = x_node->parent_;
+                x_node = x_parent;
+                x_parent = x_node->parent_;
 
             } else {
                 if (BlackFlag(w_node->right_)) {
                     PaintBlack(w_node->left_);
                     PaintRed(w_node);
                     RightRotate(w_node);
-                    w_node = x_node->parent_->right_;
+                    w_node = x_parent->right_;
                 }
 
-                w_node->color_ = x_node->parent_->color_;
-                PaintBlack(x_node->parent_);
+                w_node->color_ = x_parent->color_;
+                PaintBlack(x_parent);
                 PaintBlack(w_node->right_);
-                LeftRotate(x_node->parent_);
+                LeftRotate(x_parent);
                 x_node = root_;
             }
 
         } else {
-            auto w_node = x_node->parent_->left_;
+            auto w_node = x_parent->left_;
             if (RedFlag(w_node)) {
                 PaintBlack(w_node);
-                PaintRed(x_node->parent_);
-                RightRotate(x_node->parent_);
-                w_node = x_node->parent_->left_;
+                PaintRed(x_parent);
+                RightRotate(x_parent);
+                w_node = x_parent->left_;
             }
 
             if (BlackFlag(w_node->left_) && BlackFlag(w_node->right_)) {
                 PaintRed(w_node);
-                x_node = x_node->parent_;
+                x_node = x_parent;
+                x_parent = x_node->parent_;
 
             } else {
                 if (BlackFlag(w_node->left_)) {
                     PaintBlack(w_node->right_);
                     PaintRed(w_node);
                     LeftRotate(w_node);
-                    w_node = x_node->parent_->left_;
+                    w_node = x_parent->left_;
                 }
-                w_node->color_ = x_node->parent_->color_;
-                PaintBlack(x_node->parent_);
+                w_node->color_ = x_parent->color_;
+                PaintBlack(x_parent);
                 PaintBlack(w_node->left_);
-                RightRotate(x_node->parent_);
+                RightRotate(x_parent);
                 x_node = root_;
             }
         }
     }
 
-    PaintBlack(x_node);
+    if (x_node != nil_) {
+        PaintBlack(x_node);
+    }
+}
+
+
+template <typename ValueType, typename Augment>
+void Set<ValueType, Augment>::union_with(Set<ValueType, Augment>&& other) {
+    if (this == &other) {
+        return;
+    }
+    size_t total = size_ + other.size_;
+    Subtree mine = TakeTree();
+    Subtree theirs = AdoptTree(other);
+    size_t duplicates = 0;
+    PlantTree(UnionTrees(mine, theirs, ForkDepth(), duplicates));
+    size_ = total - duplicates;
+}
+
+template <typename ValueType, typename Augment>
+void Set<ValueType, Augment>::intersect_with(Set<ValueType, Augment>&& other) {
+    if (this == &other) {
+        return;
+    }
+    Subtree mine = TakeTree();
+    Subtree theirs = AdoptTree(other);
+    size_t kept = 0;
+    PlantTree(IntersectTrees(mine, theirs, ForkDepth(), kept));
+    size_ = kept;
+}
+
+template <typename ValueType, typename Augment>
+void Set<ValueType, Augment>::difference_with(Set<ValueType, Augment>&& other) {
+    Subtree mine = TakeTree();
+    if (this == &other) {
+        DestroyTree(mine);
+        PlantTree({nil_, 0});
+        size_ = 0;
+        return;
+    }
+    Subtree theirs = AdoptTree(other);
+    size_t removed = 0;
+    PlantTree(DifferenceTrees(mine, theirs, ForkDepth(), removed));
+    size_ -= removed;
+}
+
+// one level more than needed to cover every core, to even out unbalanced splits
+template <typename ValueType, typename Augment>
+int Set<ValueType, Augment>::ForkDepth() {
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    int depth = 1;
+    while ((1u << (depth - 1)) < threads) {
+        ++depth;
+    }
+    return depth;
+}
+
+template <typename ValueType, typename Augment>
+template <typename LeftTask, typename RightTask>
+void Set<ValueType, Augment>::ForkJoin(bool fork, LeftTask&& left, RightTask&& right) {
+    if (!fork) {
+        left();
+        right();
+        return;
+    }
+    auto forked = std::async(std::launch::async, std::forward<LeftTask>(left));
+    right();
+    forked.get();
+}
+
+template <typename ValueType, typename Augment>
+int Set<ValueType, Augment>::BlackHeight(Node* root) const {
+    int black_height = 0;
+    while (root != nil_) {
+        if (BlackFlag(root)) {
+            ++black_height;
+        }
+        root = root->left_;
+    }
+    return black_height;
+}
+
+template <typename ValueType, typename Augment>
+template <typename InputIterator>
+Set<ValueType, Augment> Set<ValueType, Augment>::from_sorted(InputIterator first, size_t count) {
+    Set result;
+    // the halving build puts every leaf on the last two levels, painting the
+    // deepest level red keeps the black height equal on all paths
+    int red_depth = count > 1 ? static_cast<int>(std::bit_width(count)) - 1 : -1;
+    result.PlantTree({result.BuildSorted(first, count, 0, red_depth), 0});
+    result.size_ = count;
+    return result;
+}
+
+template <typename ValueType, typename Augment>
+template <typename InputIterator>
+typename Set<ValueType, Augment>::Node* Set<ValueType, Augment>::BuildSorted(
+    InputIterator& first, size_t count, int depth, int red_depth) {
+    if (count == 0) {
+        return nil_;
+    }
+    size_t left_count = (count - 1) / 2;
+    Node* left = BuildSorted(first, left_count, depth + 1, red_depth);
+    Node* middle = new Node(std::in_place, *first);
+    ++first;
+    Node* right = BuildSorted(first, count - 1 - left_count, depth + 1, red_depth);
+    return Link(left, middle, right, depth == red_depth ? Color::RED : Color::BLACK);
+}
+
+template <typename ValueType, typename Augment>
+size_t Set<ValueType, Augment>::Height(Node* root) const {
+    if (root == nil_) {
+        return 0;
+    }
+    return 1 + std::max(Height(root->left_), Height(root->right_));
+}
+
+template <typename ValueType, typename Augment>
+typename Set<ValueType, Augment>::Subtree Set<ValueType, Augment>::TakeTree() {
+    Subtree tree{root_, BlackHeight(root_)};
+    root_ = nil_;
+    return tree;
+}
+
+// takes the tree of other in O(log n), the sentinel is shared so no node is touched
+template <typename ValueType, typename Augment>
+typename Set<ValueType, Augment>::Subtree Set<ValueType, Augment>::AdoptTree(Set<ValueType, Augment>& other) {
+    Node* root = other.root_;
+    other.root_ = other.leftmost_ = other.rightmost_ = other.nil_;
+    other.size_ = 0;
+    return {root, BlackHeight(root)};
+}
+
+template <typename ValueType, typename Augment>
+void Set<ValueType, Augment>::PlantTree(Subtree tree) {
+    root_ = tree.root;
+    if (root_ != nil_) {
+        root_->parent_ = nil_;
+    }
+    leftmost_ = MinValueNode(root_);
+    rightmost_ = MaxValueNode(root_);
+}
+
+template <typename ValueType, typename Augment>
+void Set<ValueType, Augment>::DestroyTree(Subtree tree) {
+    if (tree.root != nil_) {
+        ClearAll(tree.root);
+    }
+}
+
+// detaches a child of a black node as a standalone tree
+template <typename ValueType, typename Augment>
+typename Set<ValueType, Augment>::Subtree Set<ValueType, Augment>::Child(Node* node, int parent_black_height) {
+    if (node == nil_) {
+        return {nil_, 0};
+    }
+    node->parent_ = nil_;
+    if (RedFlag(node)) {
+        PaintBlack(node);
+        return {node, parent_black_height};
+    }
+    return {node, parent_black_height - 1};
+}
+
+// the join code never writes to nil_, so disjoint subtrees can be processed concurrently
+template <typename ValueType, typename Augment>
+typename Set<ValueType, Augment>::Node* Set<ValueType, Augment>::Link(Node* left, Node* middle,
+                                                    Node* right, Color color) {
+    middle->left_ = left;
+    middle->right_ = right;
+    if (left != nil_) {
+        left->parent_ = middle;
+    }
+    if (right != nil_) {
+        right->parent_ = middle;
+    }
+    middle->color_ = color;
+    Pull(middle);
+    return middle;
+}
+
+template <typename ValueType, typename Augment>
+typename Set<ValueType, Augment>::Node* Set<ValueType, Augment>::JoinLeftRotate(Node* x_node) {
+    Node* y_node = x_node->right_;
+    x_node->right_ = y_node->left_;
+    if (y_node->left_ != nil_) {
+        y_node->left_->parent_ = x_node;
+    }
+    y_node->left_ = x_node;
+    x_node->parent_ = y_node;
+    Pull(x_node);
+    Pull(y_node);
+    return y_node;
+}
+
+template <typename ValueType, typename Augment>
+typename Set<ValueType, Augment>::Node* Set<ValueType, Augment>::JoinRightRotate(Node* x_node) {
+    Node* y_node = x_node->left_;
+    x_node->left_ = y_node->right_;
+    if (y_node->right_ != nil_) {
+        y_node->right_->parent_ = x_node;
+    }
+    y_node->right_ = x_node;
+    x_node->parent_ = y_node;
+    Pull(x_node);
+    Pull(y_node);
+    return y_node;
+}
+
+// walks down the right spine of the taller tree to a black node of matching height
+template <typename ValueType, typename Augment>
+typename Set<ValueType, Augment>::Node* Set<ValueType, Augment>::JoinRight(Node* tree, int black_height,
+                                                         Node* middle, Subtree right) {
+    if (BlackFlag(tree) && black_height == right.black_height) {
+        return Link(tree, middle, right.root, Color::RED);
+    }
+
+    int child_black_height = BlackFlag(tree) ? black_height - 1 : black_height;
+    Node* child = JoinRight(tree->right_, child_black_height, middle, right);
+    tree->right_ = child;
+    child->parent_ = tree;
+    if (BlackFlag(tree) && RedFlag(child) && RedFlag(child->right_)) {
+        PaintBlack(child->right_);
+        return JoinLeftRotate(tree);
+    }
+    Pull(tree);
+    return tree;
+}
+
+template <typename ValueType, typename Augment>
+typename Set<ValueType, Augment>::Node* Set<ValueType, Augment>::JoinLeft(Subtree left, Node* middle,
+                                                        Node* tree, int black_height) {
+    if (BlackFlag(tree) && black_height == left.black_height) {
+        return Link(left.root, middle, tree, Color::RED);
+    }
+
+    int child_black_height = BlackFlag(tree) ? black_height - 1 : black_height;
+    Node* child = JoinLeft(left, middle, tree->left_, child_black_height);
+    tree->left_ = child;
+    child->parent_ = tree;
+    if (BlackFlag(tree) && RedFlag(child) && RedFlag(child->left_)) {
+        PaintBlack(child->left_);
+        return JoinRightRotate(tree);
+    }
+    Pull(tree);
+    return tree;
+}
+
+// every key of left < middle < every key of right
+template <typename ValueType, typename Augment>
+typename Set<ValueType, Augment>::Subtree Set<ValueType, Augment>::Join(Subtree left, Node* middle,
+                                                      Subtree right) {
+    Node* root = nullptr;
+    int black_height = 0;
+    if (left.black_height > right.black_height) {
+        root = JoinRight(left.root, left.black_height, middle, right);
+        black_height = left.black_height;
+    } else if (right.black_height > left.black_height) {
+        root = JoinLeft(left, middle, right.root, right.black_height);
+        black_height = right.black_height;
+    } else {
+        root = Link(left.root, middle, right.root, Color::RED);
+        black_height = left.black_height;
+    }
+
+    root->parent_ = nil_;
+    if (RedFlag(root)) {
+        PaintBlack(root);
+        ++black_height;
+    }
+    return {root, black_height};
+}
+
+template <typename ValueType, typename Augment>
+typename Set<ValueType, Augment>::Subtree Set<ValueType, Augment>::Join2(Subtree left, Subtree right) {
+    if (left.root == nil_) {
+        return right;
+    }
+    Subtree rest;
+    Node* max_node = SplitLast(left, rest);
+    return Join(rest, max_node, right);
+}
+
+// returns the node equal to key (or nil_), the other keys go to less and greater
+template <typename ValueType, typename Augment>
+typename Set<ValueType, Augment>::Node* Set<ValueType, Augment>::Split(Subtree tree, const ValueType& key,
+                                                     Subtree& less, Subtree& greater) {
+    if (tree.root == nil_) {
+        less = greater = {nil_, 0};
+        return nil_;
+    }
+
+    Node* root = tree.root;
+    Subtree left = Child(root->left_, tree.black_height);
+    Subtree right = Child(root->right_, tree.black_height);
+    if (key < root->value_) {
+        Node* found = Split(left, key, less, left);
+        greater = Join(left, root, right);
+        return found;
+    }
+    if (root->value_ < key) {
+        Node* found = Split(right, key, right, greater);
+        less = Join(left, root, right);
+        return found;
+    }
+    less = left;
+    greater = right;
+    return root;
+}
+
+template <typename ValueType, typename Augment>
+typename Set<ValueType, Augment>::Node* Set<ValueType, Augment>::SplitLast(Subtree tree, Subtree& rest) {
+    Node* root = tree.root;
+    Subtree left = Child(root->left_, tree.black_height);
+    Subtree right = Child(root->right_, tree.black_height);
+    if (right.root == nil_) {
+        rest = left;
+        return root;
+    }
+    Node* max_node = SplitLast(right, right);
+    rest = Join(left, root, right);
+    return max_node;
+}
+
+template <typename ValueType, typename Augment>
+typename Set<ValueType, Augment>::Subtree Set<ValueType, Augment>::UnionTrees(Subtree lhs, Subtree rhs,
+                                                            int depth, size_t& duplicates) {
+    if (lhs.root == nil_) {
+        return rhs;
+    }
+    if (rhs.root == nil_) {
+        return lhs;
+    }
+
+    Node* root = lhs.root;
+    Subtree left = Child(root->left_, lhs.black_height);
+    Subtree right = Child(root->right_, lhs.black_height);
+    Subtree less, greater;
+    Node* found = Split(rhs, root->value_, less, greater);
+    if (found != nil_) {
+        delete found;
+        ++duplicates;
+    }
+
+    size_t left_duplicates = 0;
+    size_t right_duplicates = 0;
+    bool fork = depth > 0 && std::min(lhs.black_height, rhs.black_height) >= kMinForkBlackHeight;
+    ForkJoin(fork, [&] {
+        left = UnionTrees(left, less, depth - 1, left_duplicates);
+    }, [&] {
+        right = UnionTrees(right, greater, depth - 1, right_duplicates);
+    });
+    duplicates += left_duplicates + right_duplicates;
+    return Join(left, root, right);
+}
+
+template <typename ValueType, typename Augment>
+typename Set<ValueType, Augment>::Subtree Set<ValueType, Augment>::IntersectTrees(Subtree lhs, Subtree rhs,
+                                                                int depth, size_t& kept) {
+    if (lhs.root == nil_ || rhs.root == nil_) {
+        DestroyTree(lhs);
+        DestroyTree(rhs);
+        return {nil_, 0};
+    }
+
+    Node* root = lhs.root;
+    Subtree left = Child(root->left_, lhs.black_height);
+    Subtree right = Child(root->right_, lhs.black_height);
+    Subtree less, greater;
+    Node* found = Split(rhs, root->value_, less, greater);
+
+    size_t left_kept = 0;
+    size_t right_kept = 0;
+    bool fork = depth > 0 && std::min(lhs.black_height, rhs.black_height) >= kMinForkBlackHeight;
+    ForkJoin(fork, [&] {
+        left = IntersectTrees(left, less, depth - 1, left_kept);
+    }, [&] {
+        right = IntersectTrees(right, greater, depth - 1, right_kept);
+    });
+    kept += left_kept + right_kept;
+
+    if (found == nil_) {
+        delete root;
+        return Join2(left, right);
+    }
+    delete found;
+    ++kept;
+    return Join(left, root, right);
+}
+
+template <typename ValueType, typename Augment>
+typename Set<ValueType, Augment>::Subtree Set<ValueType, Augment>::DifferenceTrees(Subtree lhs, Subtree rhs,
+                                                                 int depth, size_t& removed) {
+    if (lhs.root == nil_ || rhs.root == nil_) {
+        DestroyTree(rhs);
+        return lhs;
+    }
+
+    Node* root = rhs.root;
+    Subtree left = Child(root->left_, rhs.black_height);
+    Subtree right = Child(root->right_, rhs.black_height);
+    Subtree less, greater;
+    Node* found = Split(lhs, root->value_, less, greater);
+    delete root;
+    if (found != nil_) {
+        delete found;
+        ++removed;
+    }
+
+    size_t left_removed = 0;
+    size_t right_removed = 0;
+    bool fork = depth > 0 && std::min(lhs.black_height, rhs.black_height) >= kMinForkBlackHeight;
+    ForkJoin(fork, [&] {
+        less = DifferenceTrees(less, left, depth - 1, left_removed);
+    }, [&] {
+        greater = DifferenceTrees(greater, right, depth - 1, right_removed);
+    });
+    removed += left_removed + right_removed;
+    return Join2(less, greater);
 }